@@ -21,6 +21,7 @@
  */
 
 #include <osgTransparency/DepthPeelingBin.h>
+#include <osgTransparency/FragmentCompositor.h>
 #include <osgTransparency/FragmentListOITBin.h>
 #include <osgTransparency/MultiLayerDepthPeelingBin.h>
 #include <osgTransparency/MultiLayerParameters.h>
@@ -30,15 +31,32 @@
 #include <osg/Geode>
 #include <osg/Geometry>
 #include <osg/ShapeDrawable>
+#include <osg/Timer>
 #include <osgGA/TrackballManipulator>
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 
+#include <boost/make_shared.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
 #include <limits>
+#include <map>
+#include <vector>
 
 osg::Node *createCubesScene(unsigned int side, unsigned int cubesPerPrimitive,
                             float alpha);
 
+typedef std::map<std::string, double> Timings;
+typedef bool (*FrameStatsGetter)(
+    const osg::State *, bbp::osgTransparency::BaseRenderBin::FrameStats &);
+Timings timeRenderBin(bbp::osgTransparency::BaseRenderBin *renderBin,
+                      FrameStatsGetter getFrameStats, osg::Node *scene,
+                      osg::Program *program, unsigned int width,
+                      unsigned int height, unsigned int frames);
+void printSortBenchmark(const Timings &sorts, const Timings &networks);
+
 int main(int argc, char *argv[])
 {
     osg::ArgumentParser args(&argc, argv);
@@ -59,6 +77,10 @@ int main(int argc, char *argv[])
 
     bool distanceDependentAlpha = args.read("--alpha-by-distance");
 
+    /* Draws every cube twice to produce coplanar fragments, the result
+       must look like a single set of cubes with alpha 1 - (1 - alpha)^2 */
+    const bool coplanar = args.read("--coplanar");
+
     bool singleQuery = args.read("--single-query");
 
     unsigned int width = 800, height = 600;
@@ -72,11 +94,22 @@ int main(int argc, char *argv[])
     }
 
     const bool alphaAware = args.read("--alpha-aware");
+    const bool temporalPartition = args.read("--temporal-partition");
+    const bool histogramPartition = args.read("--histogram-partition");
+
+    /* Renders the scene with 1, 2, 4 ... slices up to --slices (32 by
+       default) and prints the passes and GPU time of each configuration. */
+    const bool benchmarkSlices = args.read("--benchmark-slices");
 
     std::string algorithm = "depth-peeling";
     args.read("--algorithm", algorithm);
 
     bbp::osgTransparency::BaseRenderBin *renderBin = 0;
+    /* Render bins without and with sorting networks to compare the time of
+       each sort and display batch. */
+    osg::ref_ptr<bbp::osgTransparency::BaseRenderBin> sortBenchmarkBins[2];
+    bool deferredShading = false;
+    bool picking = false;
 
 #ifdef OSG_GL3_AVAILABLE
     if (algorithm == "lists")
@@ -88,29 +121,144 @@ int main(int argc, char *argv[])
             parameters.setCaptureCallback(
                 0, bbp::osgTransparency::extractFragmentStatistics);
         }
+        else if (args.read("--print-stats-async"))
+        {
+            parameters.setCaptureCallback(
+                0, bbp::osgTransparency::FragmentReadback(
+                       bbp::osgTransparency::printFragmentStatistics));
+        }
+        else if (args.read("--cpu-composite"))
+        {
+            /* Composites the captures on the CPU and prints the throughput */
+            using namespace bbp::osgTransparency;
+            const boost::shared_ptr<FragmentCompositor> compositor =
+                boost::make_shared<FragmentCompositor>();
+            parameters.setCaptureCallback(
+                0, FragmentReadback(
+                       [compositor](const FragmentReadback::Frame& frame) {
+                           compositeFrame(frame, *compositor);
+                           const FragmentCompositor::Statistics& stats =
+                               compositor->getStatistics();
+                           std::cout << frame.frameNumber << " cpu_composite "
+                                     << stats.fragments << " fragments "
+                                     << stats.seconds << " s "
+                                     << stats.fragmentsPerSecondPerThread()
+                                     << " fragments/s/thread" << std::endl;
+                       },
+                       true));
+        }
+        else if (args.read("--pick"))
+        {
+            /* Prints the objects under the center of the window */
+            using namespace bbp::osgTransparency;
+            parameters.enableObjectIDs();
+            picking = true;
+            const unsigned int x = width / 2;
+            const unsigned int y = height / 2;
+            parameters.setCaptureCallback(0, [x, y](const FragmentData &data) {
+                const FragmentData::PickedFragments fragments = data.pick(x, y);
+                std::cout << "pick";
+                for (const auto &fragment : fragments)
+                    std::cout << ' ' << fragment.objectID << ':'
+                              << fragment.depth << ':' << fragment.alpha;
+                std::cout << std::endl;
+                return true;
+            });
+        }
         if (alphaAware)
             parameters.enableAlphaCutOff(0.99);
+        if (args.read("--precise-alpha-cut-off"))
+            parameters.setAlphaCutOffEncoding(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    TRANSPARENCY_16_BITS);
+        if (args.read("--prefix-sum"))
+            parameters.setFragmentStorage(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    PREFIX_SUM_ARRAYS);
+        if (args.read("--paged-lists"))
+            parameters.setFragmentStorage(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    PAGED_LISTS);
+        if (args.read("--shader-storage"))
+            parameters.setFragmentBufferType(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    SHADER_STORAGE_BUFFER);
+        if (args.read("--compact-records"))
+            parameters.setFragmentEncoding(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    COMPACT_RECORDS);
+        if (args.read("--split-records"))
+            parameters.setFragmentEncoding(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    SPLIT_RECORDS);
+        unsigned int kBufferSize = 0;
+        if (args.read("--k-buffer", kBufferSize))
+        {
+            parameters.setFragmentStorage(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::K_BUFFER);
+            parameters.setKBufferSize(kBufferSize);
+        }
+        unsigned int sortingNetworkSize = 0;
+        if (args.read("--sorting-network", sortingNetworkSize))
+            parameters.setSortingNetworkMaxSize(sortingNetworkSize);
+        if (args.read("--compute-resolve"))
+            parameters.setListResolve(
+                bbp::osgTransparency::FragmentListOITBin::Parameters::
+                    COMPUTE_BINNING);
+        unsigned int memoryBudget = 0;
+        if (args.read("--memory-budget", memoryBudget))
+            parameters.setMemoryBudget(size_t(memoryBudget) << 20);
+        if (args.read("--opaque-depth-test"))
+            parameters.setOpaqueDepthTest(true);
+        float partialSortThreshold = 0;
+        if (args.read("--partial-sort", partialSortThreshold))
+            parameters.enablePartialSort(partialSortThreshold);
+        deferredShading = args.read("--deferred-shading");
+        if (deferredShading)
+        {
+            /* The material ID is the RGB8 color of the fragment. */
+            parameters.enableDeferredShading(R"(
+            #version 420
+            vec3 shadeDeferredFragment(vec3 normal, uint material, float depth)
+            {
+                vec3 color = unpackUnorm4x8(material).rgb;
+                return color * abs(normal.z);
+            })");
+        }
+
+        unsigned int benchmarkSortSize = 0;
+        if (args.read("--benchmark-sort", benchmarkSortSize))
+        {
+            using namespace bbp::osgTransparency;
+            parameters.setSortingNetworkMaxSize(0);
+            sortBenchmarkBins[0] = new FragmentListOITBin(parameters);
+            parameters.setSortingNetworkMaxSize(benchmarkSortSize);
+            sortBenchmarkBins[1] = new FragmentListOITBin(parameters);
+        }
 
         renderBin = new bbp::osgTransparency::FragmentListOITBin(parameters);
     }
 #endif
+    auto createMultiLayerBin = [&](const unsigned int numSlices) {
+        typedef bbp::osgTransparency::MultiLayerDepthPeelingBin::Parameters
+            Parameters;
+        Parameters parameters(numSlices, (void *)0, alphaAware, 1, (void *)0,
+                              temporalPartition ? Parameters::OptBool(true)
+                                                : Parameters::OptBool(),
+                              histogramPartition ? Parameters::OptBool(true)
+                                                 : Parameters::OptBool());
+        if (passes != 0)
+            parameters.maximumPasses = passes;
+        parameters.singleQueryPerPass = singleQuery;
+        return new bbp::osgTransparency::MultiLayerDepthPeelingBin(parameters);
+    };
+
     if (algorithm == "depth-peeling" || renderBin == 0)
     {
         if (slices == 0)
-        {
             renderBin = new bbp::osgTransparency::DepthPeelingBin();
-        }
         else
-        {
-            bbp::osgTransparency::MultiLayerDepthPeelingBin::Parameters
-                parameters(slices, (void *)0, alphaAware);
-            if (passes != 0)
-                parameters.maximumPasses = passes;
-            parameters.singleQueryPerPass = singleQuery;
-            bbp::osgTransparency::MultiLayerDepthPeelingBin *mldpb =
-                new bbp::osgTransparency::MultiLayerDepthPeelingBin(parameters);
-            renderBin = mldpb;
-        }
+            renderBin = createMultiLayerBin(slices);
     }
 
     osgUtil::RenderBin::addRenderBinPrototype("alphaBlended", renderBin);
@@ -118,12 +266,49 @@ int main(int argc, char *argv[])
     osgViewer::Viewer viewer;
 
     osg::Node *scene = createCubesScene(side, cubesPerPrimitive, alpha);
+    if (coplanar)
+    {
+        osg::Geode *geode = scene->asGeode();
+        const unsigned int drawables = geode->getNumDrawables();
+        for (unsigned int i = 0; i != drawables; ++i)
+            geode->addDrawable(new osg::Geometry(
+                *geode->getDrawable(i)->asGeometry(), osg::CopyOp()));
+    }
 
     osg::StateSet *stateSet = scene->getOrCreateStateSet();
     stateSet->setRenderBinDetails(1, "alphaBlended");
 
+#ifdef OSG_GL3_AVAILABLE
+    if (picking)
+    {
+        /* Each primitive is a different object, 0 is left for nothing. */
+        osg::Geode *geode = scene->asGeode();
+        for (unsigned int i = 0; i != geode->getNumDrawables(); ++i)
+            bbp::osgTransparency::FragmentListOITBin::setObjectID(
+                *geode->getDrawable(i)->getOrCreateStateSet(), i + 1);
+    }
+#endif
+
     osg::Program *program = new osg::Program();
-    if (distanceDependentAlpha)
+    if (deferredShading)
+    {
+        /* The capture only stores the shading inputs */
+        osg::Shader *frag = new osg::Shader(osg::Shader::FRAGMENT);
+        frag->setShaderSource(R"(
+        #version 130
+        in vec4 color;
+        in vec3 normal;
+        float fragmentAlpha() { return color.a; }
+        float fragmentDepth() { return gl_FragCoord.z; }
+        vec3 fragmentNormal() { return normal; }
+        uint fragmentMaterial()
+        {
+            uvec3 c = uvec3(color.rgb * 255.0);
+            return c.r | c.g << 8 | c.b << 16;
+        })");
+        program->addShader(frag);
+    }
+    else if (distanceDependentAlpha)
     {
         /* Replacing the default fragment shader with a new one */
         osg::Shader *vert = new osg::Shader(osg::Shader::VERTEX);
@@ -167,6 +352,72 @@ int main(int argc, char *argv[])
     }
     renderBin->addExtraShadersForState(stateSet, program);
 
+    if (sortBenchmarkBins[0])
+    {
+        if (!getenv("OSGTRANSPARENCY_GPU_TIMING"))
+        {
+            std::cerr << "--benchmark-sort needs OSGTRANSPARENCY_GPU_TIMING"
+                      << std::endl;
+            return 1;
+        }
+        frames = std::max(frames, 10u);
+        const FrameStatsGetter getFrameStats =
+            bbp::osgTransparency::FragmentListOITBin::getFrameStats;
+        const Timings sorts = timeRenderBin(sortBenchmarkBins[0], getFrameStats,
+                                            scene, program, width, height,
+                                            frames);
+        const Timings networks =
+            timeRenderBin(sortBenchmarkBins[1], getFrameStats, scene, program,
+                          width, height, frames);
+        printSortBenchmark(sorts, networks);
+        return 0;
+    }
+
+    if (benchmarkSlices)
+    {
+        if (!getenv("OSGTRANSPARENCY_GPU_TIMING"))
+        {
+            std::cerr << "--benchmark-slices needs OSGTRANSPARENCY_GPU_TIMING"
+                      << std::endl;
+            return 1;
+        }
+        frames = std::max(frames, 10u);
+        const unsigned int maxSlices = slices ? slices : 32;
+        std::cout << "slices passes partition_ms peel_ms total_ms frame_ms"
+                  << std::endl;
+        std::vector<unsigned int> sliceCounts;
+        for (unsigned int i = 1; i < maxSlices; i *= 2)
+            sliceCounts.push_back(i);
+        sliceCounts.push_back(maxSlices);
+
+        unsigned int fastest = 0;
+        double fastestTime = std::numeric_limits<double>::max();
+        for (const unsigned int i : sliceCounts)
+        {
+            using bbp::osgTransparency::MultiLayerDepthPeelingBin;
+            osg::ref_ptr<bbp::osgTransparency::BaseRenderBin> bin =
+                createMultiLayerBin(i);
+            Timings timings =
+                timeRenderBin(bin, MultiLayerDepthPeelingBin::getFrameStats,
+                              scene, program, width, height, frames);
+            /* The depth partition is skipped with a single slice */
+            const double partition = timings["depth_partition"];
+            const double peel = timings["peel"];
+            std::cout << i << ' ' << timings["passes"] << ' '
+                      << partition << ' ' << peel << ' ' << partition + peel
+                      << ' ' << timings["frame"] << std::endl;
+            if (partition + peel < fastestTime)
+            {
+                fastestTime = partition + peel;
+                fastest = i;
+            }
+        }
+        /* Beyond this point the bandwidth of the wider render targets costs
+           more than the passes saved. */
+        std::cout << "break_even_slices " << fastest << std::endl;
+        return 0;
+    }
+
     viewer.setSceneData(scene);
     viewer.setUpViewInWindow(50, 50, width, height);
     viewer.addEventHandler(new osgViewer::StatsHandler);
@@ -270,3 +521,87 @@ osg::Node *createCubesScene(unsigned int side, unsigned int cubesPerPrimitive,
 
     return geode;
 }
+
+Timings timeRenderBin(bbp::osgTransparency::BaseRenderBin *renderBin,
+                      const FrameStatsGetter getFrameStats, osg::Node *scene,
+                      osg::Program *program, const unsigned int width,
+                      const unsigned int height, const unsigned int frames)
+{
+    /* The first frames are skipped because they include the shader
+       compilation and the buffer allocations. */
+    const unsigned int warmUpFrames = 2;
+
+    osgUtil::RenderBin::addRenderBinPrototype("alphaBlended", renderBin);
+    renderBin->addExtraShadersForState(scene->getOrCreateStateSet(), program);
+
+    /* The statistics of a frame are only known a few frames later, when its
+       GPU timer queries are resolved. Each frame is accounted once. */
+    Timings timings;
+    std::map<std::string, unsigned int> samples;
+    unsigned int lastFrame = 0;
+    double seconds = 0;
+    {
+        osgViewer::Viewer viewer;
+        viewer.setSceneData(scene);
+        viewer.setUpViewInWindow(50, 50, width, height);
+        viewer.setCameraManipulator(new osgGA::TrackballManipulator());
+        const osg::State *state =
+            viewer.getCamera()->getGraphicsContext()->getState();
+
+        osg::Timer_t start = 0;
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            if (i == warmUpFrames)
+                start = osg::Timer::instance()->tick();
+            viewer.frame();
+
+            bbp::osgTransparency::BaseRenderBin::FrameStats stats;
+            if (!getFrameStats(state, stats) || stats.frame < warmUpFrames ||
+                stats.frame <= lastFrame)
+                continue;
+            lastFrame = stats.frame;
+            for (const auto &step : stats.milliseconds)
+            {
+                timings[step.first] += step.second;
+                ++samples[step.first];
+            }
+            timings["passes"] += stats.passes;
+            ++samples["passes"];
+        }
+        if (frames > warmUpFrames)
+            seconds = osg::Timer::instance()->delta_s(
+                start, osg::Timer::instance()->tick());
+    }
+
+    for (Timings::iterator i = timings.begin(); i != timings.end(); ++i)
+        i->second /= samples[i->first];
+    if (frames > warmUpFrames)
+        timings["frame"] = seconds * 1000 / (frames - warmUpFrames);
+    return timings;
+}
+
+void printSortBenchmark(const Timings &sorts, const Timings &networks)
+{
+    /* The batches are sorted by maximum list length instead of by name. */
+    const std::string prefix = "sort_and_display_";
+    std::map<unsigned int, std::string> batches;
+    for (Timings::const_iterator i = sorts.begin(); i != sorts.end(); ++i)
+    {
+        if (i->first.compare(0, prefix.size(), prefix) == 0)
+            batches[atoi(i->first.c_str() + prefix.size())] = i->first;
+    }
+
+    std::cout << "max_list_length sort_ms network_ms speedup" << std::endl;
+    for (std::map<unsigned int, std::string>::const_iterator i =
+             batches.begin();
+         i != batches.end(); ++i)
+    {
+        const Timings::const_iterator network = networks.find(i->second);
+        if (network == networks.end())
+            continue;
+        const double sort = sorts.find(i->second)->second;
+        std::cout << i->first << ' ' << sort << ' ' << network->second << ' '
+                  << (network->second > 0 ? sort / network->second : 0)
+                  << std::endl;
+    }
+}
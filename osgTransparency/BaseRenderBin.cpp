@@ -29,9 +29,11 @@
 
 #include <osg/Config>
 #include <osg/GL>
+#include <osg/GLExtensions>
 #include <osg/ShapeDrawable>
 #include <osg/Version>
 
+#include <algorithm>
 #include <iostream>
 
 namespace bbp
@@ -273,17 +275,105 @@ void BaseRenderBin::sortImplementation()
 }
 
 #ifdef OSG_GL3_AVAILABLE
-void BaseRenderBin::renderBounds(osg::RenderInfo& /*renderInfo*/,
-                                 osg::StateSet* /*baseStateSet*/,
-                                 ProgramMap& /*programs*/,
-                                 BoundShapesStorage& /*shapes*/,
-                                 osg::RefMatrix* /*projection*/)
+namespace
+{
+void _reserveBoundsInstances(BoundsInstances& instances, const size_t count)
+{
+    if (instances.capacity >= count)
+        return;
+
+    /* The buffer object of a TextureBuffer can't be resized once created,
+       so a new texture is created each time the capacity has to grow. */
+    size_t capacity = std::max(size_t(64), instances.capacity);
+    while (capacity < count)
+        capacity *= 2;
+    instances.capacity = capacity;
+
+    instances.data = new osg::Image();
+    instances.data->allocateImage(capacity * BoundsInstances::INSTANCE_TEXELS,
+                                  1, 1, GL_RGBA, GL_FLOAT);
+    instances.data->setInternalTextureFormat(GL_RGBA32F_ARB);
+    instances.buffer = new TextureBuffer();
+    instances.buffer->setImage(instances.data.get());
+
+    if (!instances.stateSet)
+    {
+        instances.stateSet = new osg::StateSet();
+        instances.stateSet->addUniform(
+            new osg::Uniform("boundsInstances", int(instances.textureUnit)));
+    }
+    instances.stateSet->setTextureAttributeAndModes(instances.textureUnit,
+                                                    instances.buffer.get());
+}
+}
+
+void BaseRenderBin::renderBounds(osg::RenderInfo& renderInfo,
+                                 osg::StateSet* baseStateSet,
+                                 osg::Program* program,
+                                 BoundsInstances& instances,
+                                 osg::RefMatrix* projection)
 {
     OSGTRANSPARENCY_TRACE_FUNCTION();
 
-    /* To be adapted to GL3 without fixed pipeline */
-    std::cerr << "Unimplemented: " << __FILE__ << ':' << __LINE__ << std::endl;
-    abort();
+    osg::State& state = *renderInfo.getState();
+
+    size_t count = 0;
+    for (StateGraphList::const_iterator i = _stateGraphList.begin();
+         i != _stateGraphList.end(); ++i)
+    {
+        count += (*i)->_leaves.size();
+    }
+    if (count == 0)
+        return;
+
+    _reserveBoundsInstances(instances, count);
+
+    /* Writing the model-view-projection matrix and the corners of the
+       bounding box of each render leaf to the instance buffer. */
+    osg::Vec4f* texel = (osg::Vec4f*)instances.data->data();
+    for (StateGraphList::const_iterator i = _stateGraphList.begin();
+         i != _stateGraphList.end(); ++i)
+    {
+        osgUtil::StateGraph* graph = *i;
+        for (osgUtil::StateGraph::LeafList::const_iterator l =
+                 graph->_leaves.begin();
+             l != graph->_leaves.end(); ++l)
+        {
+            osgUtil::RenderLeaf* leaf = l->get();
+            const osg::Drawable* drawable = leaf->getDrawable();
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 3, 2)
+            const osg::BoundingBox& bbox = drawable->getBoundingBox();
+#else
+            const osg::BoundingBox& bbox = drawable->getBound();
+#endif
+            osg::Matrix matrix = projection ? *projection : *leaf->_projection;
+            if (leaf->_modelview.valid())
+                matrix.preMult(*leaf->_modelview);
+            /* Each row of an OSG matrix is a column of the GLSL matrix */
+            for (int row = 0; row != 4; ++row)
+                *texel++ = osg::Vec4f(matrix(row, 0), matrix(row, 1),
+                                      matrix(row, 2), matrix(row, 3));
+            *texel++ = osg::Vec4f(bbox.xMin(), bbox.yMin(), bbox.zMin(), 1);
+            *texel++ = osg::Vec4f(bbox.xMax(), bbox.yMax(), bbox.zMax(), 1);
+        }
+    }
+    instances.data->dirty();
+
+    /* The program goes in the state set of the instances, so the base
+       state set of the caller isn't modified. */
+    instances.stateSet->setAttributeAndModes(program);
+    state.pushStateSet(baseStateSet);
+    state.pushStateSet(instances.stateSet.get());
+    state.apply();
+    /* The box vertices are generated in the vertex shader */
+    state.disableAllVertexArrays();
+
+    const osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+    /* A triangle strip covering the 6 faces of a box */
+    ext->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 14, GLsizei(count));
+
+    state.popStateSet();
+    state.popStateSet();
 }
 #else
 void BaseRenderBin::renderBounds(osg::RenderInfo& renderInfo,
@@ -31,6 +31,9 @@
 
 #include <boost/shared_ptr.hpp>
 
+#include <map>
+#include <string>
+
 namespace bbp
 {
 namespace osgTransparency
@@ -47,6 +50,33 @@ public:
 
     class Parameters;
 
+    /**
+       Statistics of the last frame drawn by a render bin in a graphics
+       context.
+
+       The GPU times are only measured when the OSGTRANSPARENCY_GPU_TIMING
+       environment variable is set. Timer queries are resolved
+       asynchronously, so with GPU timing enabled the statistics lag a few
+       frames behind the frame being drawn.
+     */
+    struct FrameStats
+    {
+        FrameStats()
+            : frame(0)
+            , passes(0)
+        {
+        }
+
+        /** Frame number these statistics belong to. */
+        unsigned int frame;
+        /** Number of times the scene geometry was rendered in the frame. */
+        unsigned int passes;
+        /** GPU time in milliseconds of each timed step of the frame. The
+            times of steps executed several times in a frame (e.g. once per
+            tile) are added up. Empty if GPU timing is disabled. */
+        std::map<std::string, float> milliseconds;
+    };
+
     /*--- Public member functions ---*/
 
     /**
@@ -154,15 +184,33 @@ protected:
                 OcclusionQueryGroup* queryGroup = 0);
 
 public:
+#ifdef OSG_GL3_AVAILABLE
+    /**
+       Renders the bounding boxes of the drawables from the RenderLeafs in a
+       single instanced draw.
+       The per state extra shaders can't be used because all the boxes are
+       drawn at once, instead the given program is used for all of them.
+       Its vertex stage must be shaders/GL3/bounds.vert, which reads the
+       boxes from the instance buffer, and shaders/GL3/bounds.frag provides
+       fragmentDepth for the fragment stage.
+       The instance buffer is rewritten every frame.
+     */
+    void renderBounds(osg::RenderInfo& renderInfo, osg::StateSet* baseStateSet,
+                      osg::Program* program, BoundsInstances& instances,
+                      osg::RefMatrix* projection = 0);
+#else
     /**
        Renders the bounds of the drawables from the RenderLeafs.
        The shapes map will be filled internally and can be reused for following
        frames but mustn't be shared between contexts. Dynamic resizing of
        bounding shapes is neither supported.
+       The boxes are drawn one by one with the extra shaders of each state,
+       which can't be combined in a single instanced draw as in GL3.
      */
     void renderBounds(osg::RenderInfo& renderInfo, osg::StateSet* baseStateSet,
                       ProgramMap& programs, BoundShapesStorage& shapes,
                       osg::RefMatrix* projection = 0);
+#endif
 
 private:
     /*--- Private member functions ---*/
@@ -35,6 +35,7 @@
 #include "BaseParameters.h"
 #include "DepthPeelingBin.h"
 
+#include "util/CameraCache.h"
 #include "util/constants.h"
 #include "util/extensions.h"
 #include "util/helpers.h" // Before including boost
@@ -275,6 +276,17 @@ public:
 
     friend class Tile;
 
+    /*--- Public member variables ---*/
+
+    /* Buffers and base state sets of the camera, created by the context */
+    osg::ref_ptr<osg::TextureRectangle> targetBlendColorTexture;
+    osg::ref_ptr<osg::FrameBufferObject> blendBuffer;
+    osg::ref_ptr<osg::StateSet> baseBlendStateSet;
+    osg::ref_ptr<osg::StateSet> baseFirstPassStateSet;
+    osg::ref_ptr<osg::StateSet> basePeelStateSet;
+    osg::ref_ptr<osg::StateSet> finalStateSet;
+    osg::ref_ptr<osg::Uniform> lowerLeftCornerUniform;
+
     /*--- Public constructor/destructor ---*/
 
     Screen(osg::RenderInfo& renderInfo, Context* context);
@@ -331,6 +343,13 @@ public:
     }
 
     osg::Viewport* getTileViewport() { return _offscreenViewport.get(); }
+
+    /* GPU memory used by the buffers that are not shared with other
+       screens */
+    size_t getMemoryUsage() const
+    {
+        return size_t(getWidth()) * getHeight() * 4;
+    }
 protected:
     /*--- Protected destructor ---*/
     ~Screen() {}
@@ -366,18 +385,9 @@ public:
 
     Parameters parameters;
 
-    osg::ref_ptr<osg::TextureRectangle> targetBlendColorTexture;
-    osg::ref_ptr<osg::StateSet> baseBlendStateSet;
-    osg::ref_ptr<osg::FrameBufferObject> blendBuffer;
-
-    osg::ref_ptr<osg::StateSet> baseFirstPassStateSet;
     ProgramMap firstPassPrograms;
-
-    osg::ref_ptr<osg::StateSet> basePeelStateSet;
     ProgramMap peelPassPrograms;
 
-    osg::ref_ptr<osg::StateSet> finalStateSet;
-
     osg::ref_ptr<osg::FrameBufferObject> auxiliaryBuffer;
 
     osg::ref_ptr<osg::Geometry> quad;
@@ -439,10 +449,13 @@ private:
 
     ProgramMap _extraShaders;
 
-    osg::ref_ptr<osg::Uniform> _lowerLeftCornerUniform;
-
     unsigned int _id;
+    /* Screen of the camera being rendered */
     osg::ref_ptr<Screen> _screen;
+    /* Screens of the cameras rendered recently, which are reused as long as
+       the camera viewport doesn't change. The tile textures are shared by
+       all of them through _freeTextures. */
+    CameraCache<osg::ref_ptr<Screen>> _screens;
 
     std::map<GLenum, TextureList> _freeTextures;
 
@@ -533,15 +546,12 @@ DepthPeelingBin::_Impl::Tile::~Tile()
 
 void DepthPeelingBin::_Impl::Tile::createStateSets()
 {
-    /* Getting the context to shallow copy the base state sets from it */
-    Context& c = _screen->getContext();
-
     Uniforms uniforms;
     Attributes attributes;
     using namespace keywords;
 
-    /* First pass */
-    _firstPassStateSet = new osg::StateSet(*c.baseFirstPassStateSet);
+    /* First pass, the base state sets of the screen are shallow copied */
+    _firstPassStateSet = new osg::StateSet(*_screen->baseFirstPassStateSet);
     /* The first pass needs the scaling and offset uniforms to convert
        offscreen coordinates to onscreen. */
     uniforms.insert(_screenOffset);
@@ -552,7 +562,7 @@ void DepthPeelingBin::_Impl::Tile::createStateSets()
                   _attributes = attributes);
 
     /* Peel pass */
-    _peelStateSet = new osg::StateSet(*c.basePeelStateSet);
+    _peelStateSet = new osg::StateSet(*_screen->basePeelStateSet);
     uniforms.clear();
     attributes.clear();
     uniforms.insert(_screenOffset);
@@ -565,7 +575,7 @@ void DepthPeelingBin::_Impl::Tile::createStateSets()
     /* Blend pass */
     /* The blend pass needs the offset uniforms to convert onscreen
        coordinates to offscreen. */
-    _blendStateSet = new osg::StateSet(*c.baseBlendStateSet);
+    _blendStateSet = new osg::StateSet(*_screen->baseBlendStateSet);
     uniforms.clear();
     attributes.clear();
     attributes[new osg::Viewport(_x, _y, _width + _padX, _height + _padY)] =
@@ -718,7 +728,7 @@ void DepthPeelingBin::_Impl::Tile::blend(osg::RenderInfo& renderInfo)
     osg::State& state = *renderInfo.getState();
 
     /* Blending of front to back layer */
-    _screen->getContext().blendBuffer->apply(state);
+    _screen->blendBuffer->apply(state);
     state.pushStateSet(_blendStateSet.get());
     state.apply();
     if (_passes == 1)
@@ -882,6 +892,7 @@ void DepthPeelingBin::_Impl::Context::createBuffersAndTextures()
     GLint tileHeight = _screen->getTileViewport()->height();
 
     /* Creating FBOs */
+    osg::ref_ptr<osg::FrameBufferObject>& blendBuffer = _screen->blendBuffer;
     blendBuffer = new osg::FrameBufferObject();
 
     /* Keeping textures that already have at least the required size. */
@@ -908,6 +919,8 @@ void DepthPeelingBin::_Impl::Context::createBuffersAndTextures()
     }
 
     /* Creating color textures for blending of each layer */
+    osg::ref_ptr<osg::TextureRectangle>& targetBlendColorTexture =
+        _screen->targetBlendColorTexture;
     targetBlendColorTexture =
         createTexture<osg::TextureRectangle>(screenWidth, screenHeight);
     osg::FrameBufferAttachment buffer(targetBlendColorTexture.get());
@@ -922,6 +935,8 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
     Attributes attributes;
     Uniforms uniforms;
 
+    Screen& screen = *_screen;
+
     /* The rendering code may be executed before any other object is drawn,
        that makes possible that the correct viewport hasn't been applied yet.
        The reason is really wierd, it seems that RenderStage's default
@@ -932,7 +947,7 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
     /*
       First pass state set
     */
-    baseFirstPassStateSet = new osg::StateSet;
+    screen.baseFirstPassStateSet = new osg::StateSet;
     /* Reserving the 4 first texture numbers for textures units used in the
        vertex shading */
     modes.clear();
@@ -942,12 +957,13 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
     modes[GL_CULL_FACE] = OFF_OVERRIDE;
     attributes[new osg::BlendEquation(RGBA_MAX)] = ON_OVERRIDE;
     attributes[new osg::BlendFunc(GL_ONE, GL_ONE)] = ON_OVERRIDE;
-    setupStateSet(baseFirstPassStateSet.get(), modes, attributes, uniforms);
+    setupStateSet(screen.baseFirstPassStateSet.get(), modes, attributes,
+                  uniforms);
 
     /*
        Peel state set
     */
-    basePeelStateSet = new osg::StateSet;
+    screen.basePeelStateSet = new osg::StateSet;
     modes.clear();
     attributes.clear();
     uniforms.clear();
@@ -959,17 +975,19 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
        vertex and fragment shading */
     uniforms.insert(
         new osg::Uniform("depthBuffer", (int)parameters.reservedTextureUnits));
-    setupStateSet(basePeelStateSet.get(), modes, attributes, uniforms);
+    setupStateSet(screen.basePeelStateSet.get(), modes, attributes, uniforms);
     setupTexture("blendedBuffer", (int)parameters.reservedTextureUnits + 1,
-                 *basePeelStateSet, targetBlendColorTexture.get());
+                 *screen.basePeelStateSet,
+                 screen.targetBlendColorTexture.get());
 
     /*
        Blend state set
     */
-    baseBlendStateSet = new osg::StateSet;
+    screen.baseBlendStateSet = new osg::StateSet;
     // clang-format off
     addProgram(
-        baseBlendStateSet.get(), _vertex_shaders = strings(BYPASS_VERT_SHADER),
+        screen.baseBlendStateSet.get(),
+        _vertex_shaders = strings(BYPASS_VERT_SHADER),
         _fragment_shaders = strings(R"(
         #extension GL_ARB_draw_buffers : enable
         #extension GL_ARB_tecture_rectangle : enable
@@ -988,17 +1006,18 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
     attributes[new osg::BlendEquation(FUNC_ADD)] = ON;
     attributes[new osg::BlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE)] = ON;
 
-    attributes[_screen->getCamera()->getViewport()] = ON_OVERRIDE_PROTECTED;
+    attributes[screen.getCamera()->getViewport()] = ON_OVERRIDE_PROTECTED;
     uniforms.insert(new osg::Uniform("colorTexture", 0));
-    setupStateSet(baseBlendStateSet.get(), modes, attributes, uniforms);
+    setupStateSet(screen.baseBlendStateSet.get(), modes, attributes, uniforms);
 
     /*
        Final copy state set
     */
-    finalStateSet = new osg::StateSet();
+    screen.finalStateSet = new osg::StateSet();
     // clang-format off
     addProgram(
-        finalStateSet.get(), _vertex_shaders = strings(BYPASS_VERT_SHADER),
+        screen.finalStateSet.get(),
+        _vertex_shaders = strings(BYPASS_VERT_SHADER),
         _fragment_shaders = strings(R"(
          #extension GL_ARB_tecture_rectangle : enable
          uniform sampler2DRect blendBuffer;
@@ -1012,14 +1031,15 @@ void DepthPeelingBin::_Impl::Context::createBaseStateSets()
     modes.clear();
     attributes.clear();
     uniforms.clear();
-    _lowerLeftCornerUniform = new osg::Uniform("lowerLeftCorner", osg::Vec2());
-    uniforms.insert(_lowerLeftCornerUniform);
+    screen.lowerLeftCornerUniform =
+        new osg::Uniform("lowerLeftCorner", osg::Vec2());
+    uniforms.insert(screen.lowerLeftCornerUniform);
     modes[GL_DEPTH] = OFF;
     attributes[new osg::BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA)] = ON;
     attributes[new osg::BlendEquation(FUNC_ADD)] = ON;
-    setupTexture("blendBuffer", 0, *finalStateSet,
-                 targetBlendColorTexture.get());
-    setupStateSet(finalStateSet.get(), modes, attributes, uniforms);
+    setupTexture("blendBuffer", 0, *screen.finalStateSet,
+                 screen.targetBlendColorTexture.get());
+    setupStateSet(screen.finalStateSet.get(), modes, attributes, uniforms);
 }
 
 void DepthPeelingBin::_Impl::Context::updatePrograms(
@@ -1054,9 +1074,11 @@ void DepthPeelingBin::_Impl::Context::startFrame(DepthPeelingBin* bin,
     osg::State& state = *renderInfo.getState();
 
     osg::Camera* camera = renderInfo.getCurrentCamera();
-    if (getScreen() == 0 || !getScreen()->valid(camera))
+    _screen = _screens.find(camera);
+    if (_screen == 0 || !_screen->valid(camera))
     {
         _screen = new Screen(renderInfo, this);
+        _screens.insert(camera, _screen);
         createBuffersAndTextures();
         createBaseStateSets();
     }
@@ -1081,7 +1103,7 @@ void DepthPeelingBin::_Impl::Context::startFrame(DepthPeelingBin* bin,
        the camera and it's not necessarily at 0, 0. */
     _screen->getTileViewport()->apply(state);
 
-    blendBuffer->apply(state);
+    _screen->blendBuffer->apply(state);
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
@@ -1097,10 +1119,10 @@ void DepthPeelingBin::_Impl::Context::finishFrame(
     FBOExtensions* fbo_ext = getFBOExtensions(state.getContextID());
     osg::Camera* camera = renderInfo.getCurrentCamera();
 
-    _lowerLeftCornerUniform->set(
+    _screen->lowerLeftCornerUniform->set(
         osg::Vec2(camera->getViewport()->x(), camera->getViewport()->y()));
 
-    state.apply(finalStateSet.get());
+    state.apply(_screen->finalStateSet.get());
     camera->getViewport()->apply(state);
 
 /* Returning to previously bound buffer. */
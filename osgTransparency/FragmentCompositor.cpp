@@ -0,0 +1,252 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FragmentCompositor.h"
+#include "FragmentDump.h"
+
+#include <osg/Timer>
+
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+namespace
+{
+/* Lists shorter than this are sorted by insertion, like in
+   sort_and_display.frag */
+const size_t INSERTION_SORT_MAX_SIZE = 32;
+
+/* Maps a float to an unsigned integer with the same ordering. */
+uint32_t orderedBits(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+void insertionSort(uint64_t* keys, const size_t size)
+{
+    for (size_t i = 1; i < size; ++i)
+    {
+        const uint64_t key = keys[i];
+        size_t j = i;
+        for (; j > 0 && key < keys[j - 1]; --j)
+            keys[j] = keys[j - 1];
+        keys[j] = key;
+    }
+}
+
+/* Unpacks RGBA8 colors with red in the low byte into premultiplied
+   floating point RGBA. The loop has no branches so it can be vectorized. */
+void unpackColors(const uint32_t* colors, const size_t size, float* rgba)
+{
+    const float scale = 1 / 255.0f;
+    for (size_t i = 0; i < size; ++i)
+    {
+        const uint32_t color = colors[i];
+        const float alpha = float(color >> 24) * scale;
+        rgba[i * 4] = float(color & 0xFF) * scale * alpha;
+        rgba[i * 4 + 1] = float((color >> 8) & 0xFF) * scale * alpha;
+        rgba[i * 4 + 2] = float((color >> 16) & 0xFF) * scale * alpha;
+        rgba[i * 4 + 3] = alpha;
+    }
+}
+
+unsigned char toUnorm8(const float value)
+{
+    return (unsigned char)(std::min(std::max(value, 0.f), 1.f) * 255 + 0.5f);
+}
+
+/* The work shared by all the threads of a composite call. */
+class Job
+{
+public:
+    Job(const FragmentDump& dump, const osg::Vec4& background,
+        osg::Image& image)
+        : _dump(dump)
+        , _background(background)
+        , _image(image)
+        , _nextRow(0)
+    {
+    }
+
+    /* Composites rows until there are none left. The number of fragments
+       processed and the maximum list length found are returned in the
+       arguments. */
+    void process(size_t& fragments, size_t& maxListLength)
+    {
+        /* Scratch arrays reused by all the pixels processed by a thread */
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> colors;
+        std::vector<float> rgba;
+
+        fragments = 0;
+        maxListLength = 0;
+        const unsigned int width = _dump.getWidth();
+        const unsigned int height = _dump.getHeight();
+        for (unsigned int y = ++_nextRow - 1; y < height; y = ++_nextRow - 1)
+        {
+            unsigned char* out = _image.data(0, y);
+            for (unsigned int x = 0; x != width; ++x, out += 4)
+            {
+                /* The keys are the depth in the high bits and the storage
+                   order in the low bits, so the sort is deterministic
+                   regardless of the algorithm. */
+                keys.clear();
+                colors.clear();
+                /* The pixel count bounds the lists of corrupted captures */
+                const size_t count = _dump.getCount(x, y);
+                keys.reserve(count);
+                colors.reserve(count);
+                for (const FragmentDump::Fragment& fragment :
+                     _dump.getFragments(x, y))
+                {
+                    if (keys.size() == count)
+                        break;
+                    keys.push_back(uint64_t(orderedBits(fragment.depth))
+                                       << 32 |
+                                   colors.size());
+                    colors.push_back(fragment.color);
+                }
+                const size_t size = keys.size();
+                fragments += size;
+                maxListLength = std::max(maxListLength, size);
+
+                if (size < INSERTION_SORT_MAX_SIZE)
+                    insertionSort(keys.data(), size);
+                else
+                    std::sort(keys.begin(), keys.end());
+
+                rgba.resize(size * 4);
+                unpackColors(colors.data(), size, rgba.data());
+                _blend(keys.data(), size, rgba.data(), out);
+            }
+        }
+    }
+
+private:
+    const FragmentDump& _dump;
+    const osg::Vec4 _background;
+    osg::Image& _image;
+    OpenThreads::Atomic _nextRow;
+
+    void _blend(const uint64_t* keys, const size_t size, const float* rgba,
+                unsigned char* out) const
+    {
+        /* Front to back blending with the same operation order as
+           sort_and_display.frag. The inner loops are 4-wide. */
+        float color[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i != size; ++i)
+        {
+            const float* fragment = rgba + uint32_t(keys[i]) * 4;
+            const float transmittance = 1 - color[3];
+            for (int j = 0; j != 4; ++j)
+                color[j] += fragment[j] * transmittance;
+        }
+        const float transmittance = 1 - color[3];
+        for (int j = 0; j != 4; ++j)
+            out[j] = toUnorm8(color[j] + _background[j] * transmittance);
+    }
+};
+
+class Worker : public OpenThreads::Thread
+{
+public:
+    explicit Worker(Job& job)
+        : fragments(0)
+        , maxListLength(0)
+        , _job(job)
+    {
+    }
+
+    virtual void run() { _job.process(fragments, maxListLength); }
+
+    size_t fragments;
+    size_t maxListLength;
+
+private:
+    Job& _job;
+};
+}
+
+/*
+  Constructors
+*/
+
+FragmentCompositor::FragmentCompositor(const unsigned int threads)
+    : _numThreads(threads ? threads
+                          : std::max(1, OpenThreads::GetNumberOfProcessors()))
+{
+    std::memset(&_statistics, 0, sizeof(_statistics));
+}
+
+/*
+  Member functions
+*/
+
+osg::ref_ptr<osg::Image> FragmentCompositor::composite(
+    const FragmentDump& dump, const osg::Vec4& background)
+{
+    const osg::Timer_t start = osg::Timer::instance()->tick();
+
+    osg::ref_ptr<osg::Image> image(new osg::Image());
+    image->allocateImage(dump.getWidth(), dump.getHeight(), 1, GL_RGBA,
+                         GL_UNSIGNED_BYTE);
+    Job job(dump, background, *image);
+
+    /* There's no point in having more threads than rows */
+    const unsigned int threads =
+        std::max(1u, std::min(_numThreads, dump.getHeight()));
+    std::vector<Worker*> workers;
+    for (unsigned int i = 1; i < threads; ++i)
+    {
+        workers.push_back(new Worker(job));
+        workers.back()->start();
+    }
+    Statistics statistics;
+    job.process(statistics.fragments, statistics.maxListLength);
+    for (Worker* worker : workers)
+    {
+        worker->join();
+        statistics.fragments += worker->fragments;
+        statistics.maxListLength =
+            std::max(statistics.maxListLength, worker->maxListLength);
+        delete worker;
+    }
+
+    statistics.pixels = size_t(dump.getWidth()) * dump.getHeight();
+    statistics.threads = threads;
+    statistics.seconds =
+        osg::Timer::instance()->delta_s(start,
+                                        osg::Timer::instance()->tick());
+    _statistics = statistics;
+    return image;
+}
+}
+}
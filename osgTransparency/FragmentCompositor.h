@@ -0,0 +1,120 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_FRAGMENTCOMPOSITOR_H
+#define OSGTRANSPARENCY_FRAGMENTCOMPOSITOR_H
+
+#include <osgTransparency/api.h>
+
+#include <osg/Image>
+#include <osg/Vec4>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+class FragmentDump;
+
+/**
+   CPU reference implementation of the sort and display pass of
+   FragmentListOITBin.
+
+   The fragments of each pixel are sorted by depth and blended front to back
+   with premultiplied alpha, exactly as sort_and_display.frag does, but
+   without the limits of the GPU implementation on the list length.
+   The resulting image can be used as the ground truth to validate the GPU
+   algorithms without a GPU, and the statistics as a throughput baseline for
+   compositing captures outside the renderer.
+
+   The image rows are distributed dynamically among the threads of the
+   compositor. The calling thread takes part in the work.
+
+   With K_BUFFER storage only the K nearest fragments are composited, the
+   approximation of the fragments beyond them is not part of the capture.
+
+   @version 0.9.0
+*/
+class OSGTRANSPARENCY_API FragmentCompositor : boost::noncopyable
+{
+public:
+    /*--- Public declarations ---*/
+
+    /** Statistics of the last call to composite */
+    struct Statistics
+    {
+        size_t pixels;
+        size_t fragments;
+        /** Length of the longest fragment list */
+        size_t maxListLength;
+        double seconds;
+        unsigned int threads;
+
+        /** Throughput per thread */
+        double fragmentsPerSecondPerThread() const
+        {
+            return seconds > 0 && threads ? fragments / seconds / threads
+                                          : 0;
+        }
+    };
+
+    /*--- Public constructors/destructor ---*/
+
+    /**
+       @param threads Number of threads to use, 0 to use one per processor.
+    */
+    explicit FragmentCompositor(unsigned int threads = 0);
+
+    /*--- Public member functions ---*/
+
+    unsigned int getNumThreads() const { return _numThreads; }
+
+    /**
+       Composite the fragments of a capture.
+
+       Pixels without fragments are left with the background color, the
+       rest are blended on top of it as the GPU does with
+       glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA).
+       @param dump The captured fragments, either mapped from a file or
+              wrapping the arrays of a FragmentReadback::Frame.
+       @param background Premultiplied background color.
+       @return A GL_RGBA/GL_UNSIGNED_BYTE image of the size of the capture,
+               with the first row at the bottom like the framebuffer.
+    */
+    osg::ref_ptr<osg::Image> composite(
+        const FragmentDump& dump,
+        const osg::Vec4& background = osg::Vec4(0, 0, 0, 0));
+
+    const Statistics& getStatistics() const { return _statistics; }
+
+private:
+    /*--- Private member attributes ---*/
+
+    unsigned int _numThreads;
+    Statistics _statistics;
+};
+}
+}
+#endif
@@ -0,0 +1,405 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "FragmentDump.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+namespace
+{
+static_assert(sizeof(FragmentDump::Header) == 128,
+              "The header layout is part of the file format");
+
+const char MAGIC[8] = {'O', 'S', 'G', 'T', 'F', 'R', 'A', 'G'};
+const uint64_t END = std::numeric_limits<uint64_t>::max();
+const uint32_t EMPTY_LIST = 0xFFFFFFFF;
+
+uint64_t align(const uint64_t offset)
+{
+    const uint64_t alignment = FragmentDump::SECTION_ALIGNMENT;
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+unsigned int depthWord(const FragmentDump::Header& header)
+{
+    /* Full records start with the next pointer */
+    return header.recordSize == 3 ? 1 : 0;
+}
+
+uint32_t nullPage(const FragmentDump::Header& header)
+{
+    return EMPTY_LIST >> header.pageFillBits;
+}
+
+/* Returns an empty string if the header is valid for a file of the given
+   size, or the reason why it's not. */
+std::string validate(const FragmentDump::Header& header, const size_t size)
+{
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        return "not a fragment dump";
+    if (header.byteOrder != FragmentDump::BYTE_ORDER_MARK)
+        return "unsupported byte order";
+    if (header.version != FragmentDump::VERSION)
+        return "unsupported version " +
+               boost::lexical_cast<std::string>(header.version);
+    if (header.storage > FragmentDump::K_BUFFER)
+        return "unknown storage mode";
+    if (header.recordSize != 2 && header.recordSize != 3)
+        return "invalid record size";
+    if (header.storage == FragmentDump::PAGED_LISTS &&
+        (header.fragmentsPerPage == 0 || header.pageFillBits == 0 ||
+         header.pageFillBits >= 32))
+        return "invalid page layout";
+    if (header.storage == FragmentDump::K_BUFFER && header.kBufferSize == 0)
+        return "invalid K-buffer size";
+
+    const uint64_t pixels = uint64_t(header.width) * header.height;
+    const FragmentDump::Section* sections[] = {&header.counts, &header.heads,
+                                               &header.fragments,
+                                               &header.pageLinks};
+    const uint64_t sizes[] = {
+        pixels * sizeof(uint32_t), pixels * sizeof(uint32_t),
+        header.numFragments * header.recordSize * sizeof(uint32_t),
+        header.storage == FragmentDump::PAGED_LISTS
+            ? header.numPages * sizeof(uint32_t)
+            : 0};
+    for (size_t i = 0; i != 4; ++i)
+    {
+        const FragmentDump::Section& section = *sections[i];
+        if (section.size != sizes[i] ||
+            section.offset % FragmentDump::SECTION_ALIGNMENT != 0 ||
+            section.offset > size || section.size > size - section.offset)
+            return "section out of bounds";
+    }
+    return std::string();
+}
+
+/* Fills in the identification fields and sections of a header.
+   Returns the size of the file. */
+uint64_t layout(FragmentDump::Header& header)
+{
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.byteOrder = FragmentDump::BYTE_ORDER_MARK;
+    header.version = FragmentDump::VERSION;
+
+    const uint64_t pixels = uint64_t(header.width) * header.height;
+    header.counts.offset = align(sizeof(FragmentDump::Header));
+    header.counts.size = pixels * sizeof(uint32_t);
+    header.heads.offset = align(header.counts.offset + header.counts.size);
+    header.heads.size = header.counts.size;
+    header.fragments.offset = align(header.heads.offset + header.heads.size);
+    header.fragments.size =
+        header.numFragments * header.recordSize * sizeof(uint32_t);
+    /* Empty sections have offset 0 */
+    header.pageLinks.size = header.storage == FragmentDump::PAGED_LISTS
+                                ? header.numPages * sizeof(uint32_t)
+                                : 0;
+    if (!header.pageLinks.size)
+    {
+        header.pageLinks.offset = 0;
+        return header.fragments.offset + header.fragments.size;
+    }
+    header.pageLinks.offset =
+        align(header.fragments.offset + header.fragments.size);
+    return header.pageLinks.offset + header.pageLinks.size;
+}
+
+void pad(std::ofstream& out, const uint64_t offset)
+{
+    static const char zeros[FragmentDump::SECTION_ALIGNMENT] = {0};
+    const uint64_t position = out.tellp();
+    out.write(zeros, offset - position);
+}
+}
+
+const uint32_t FragmentDump::VERSION;
+const uint32_t FragmentDump::BYTE_ORDER_MARK;
+const size_t FragmentDump::SECTION_ALIGNMENT;
+
+/*
+  Constructors/destructor
+*/
+
+FragmentDump::FragmentDump(const std::string& filename)
+    : _data(0)
+    , _size(0)
+    , _memoryHeader()
+    , _header(0)
+    , _counts(0)
+    , _heads(0)
+    , _records(0)
+    , _pageLinks(0)
+{
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Could not open fragment dump: " + filename);
+
+    struct stat info;
+    if (::fstat(fd, &info) == -1 || size_t(info.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        throw std::runtime_error("Invalid fragment dump " + filename +
+                                 ": file too small");
+    }
+    _size = info.st_size;
+    _data = ::mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_data == MAP_FAILED)
+        throw std::runtime_error("Could not map fragment dump: " + filename);
+
+    _header = static_cast<const Header*>(_data);
+    const std::string error = validate(*_header, _size);
+    if (!error.empty())
+    {
+        ::munmap(_data, _size);
+        throw std::runtime_error("Invalid fragment dump " + filename + ": " +
+                                 error);
+    }
+
+    const char* data = static_cast<const char*>(_data);
+    _counts = reinterpret_cast<const uint32_t*>(data + _header->counts.offset);
+    _heads = reinterpret_cast<const uint32_t*>(data + _header->heads.offset);
+    _records =
+        reinterpret_cast<const uint32_t*>(data + _header->fragments.offset);
+    if (_header->storage == PAGED_LISTS)
+        _pageLinks = reinterpret_cast<const uint32_t*>(
+            data + _header->pageLinks.offset);
+}
+
+FragmentDump::FragmentDump(const Header& header, const uint32_t* counts,
+                           const uint32_t* heads, const uint32_t* records,
+                           const uint32_t* pageLinks)
+    : _data(0)
+    , _size(0)
+    , _memoryHeader(header)
+    , _header(&_memoryHeader)
+    , _counts(counts)
+    , _heads(heads)
+    , _records(records)
+    , _pageLinks(0)
+{
+    const uint64_t size = layout(_memoryHeader);
+    const std::string error = validate(_memoryHeader, size);
+    if (!error.empty())
+        throw std::runtime_error("Invalid fragment data: " + error);
+    if (header.storage == PAGED_LISTS)
+    {
+        if (!pageLinks && header.numPages)
+            throw std::runtime_error("Invalid fragment data: missing pages");
+        _pageLinks = pageLinks;
+    }
+}
+
+FragmentDump::~FragmentDump()
+{
+    if (_data)
+        ::munmap(_data, _size);
+}
+
+/*
+  Member functions
+*/
+
+FragmentDump::Fragments FragmentDump::getFragments(const unsigned int x,
+                                                   const unsigned int y) const
+{
+    Fragments fragments;
+    fragments.first = const_iterator(*this, size_t(y) * _header->width + x);
+    return fragments;
+}
+
+void FragmentDump::write(const std::string& filename, const Header& header,
+                         const uint32_t* counts, const uint32_t* heads,
+                         const uint32_t* records, const uint32_t* pageLinks)
+{
+    Header out = header;
+    layout(out);
+
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not open file for writing: " +
+                                 filename);
+    file.write(reinterpret_cast<const char*>(&out), sizeof(Header));
+    pad(file, out.counts.offset);
+    file.write(reinterpret_cast<const char*>(counts), out.counts.size);
+    pad(file, out.heads.offset);
+    file.write(reinterpret_cast<const char*>(heads), out.heads.size);
+    pad(file, out.fragments.offset);
+    file.write(reinterpret_cast<const char*>(records), out.fragments.size);
+    if (out.pageLinks.size)
+    {
+        pad(file, out.pageLinks.offset);
+        file.write(reinterpret_cast<const char*>(pageLinks),
+                   out.pageLinks.size);
+    }
+    if (!file)
+        throw std::runtime_error("Error writing fragment dump: " + filename);
+}
+
+/*
+  FragmentDump::const_iterator
+*/
+
+FragmentDump::const_iterator::const_iterator()
+    : _dump(0)
+    , _record(END)
+    , _last(END)
+    , _page(0)
+    , _remaining(0)
+{
+}
+
+FragmentDump::const_iterator::const_iterator(const FragmentDump& dump,
+                                             const size_t pixel)
+    : _dump(&dump)
+    , _record(END)
+    , _last(END)
+    , _page(0)
+    , _remaining(dump._counts[pixel])
+{
+    const Header& header = *dump._header;
+    const uint32_t head = dump._heads[pixel];
+    switch (header.storage)
+    {
+    case LINKED_LISTS:
+        if (head != EMPTY_LIST)
+            _record = head;
+        break;
+    case PREFIX_SUM_ARRAYS:
+        if (dump._counts[pixel] != 0)
+        {
+            _record = head;
+            _last = _record + dump._counts[pixel];
+        }
+        break;
+    case PAGED_LISTS:
+        _page = head >> header.pageFillBits;
+        if (_page != nullPage(header))
+        {
+            /* Only the last page allocated can be partially filled */
+            _record = uint64_t(_page) * header.fragmentsPerPage;
+            _last = _record + (head & ((1u << header.pageFillBits) - 1));
+            if (_record == _last)
+                _nextPage();
+        }
+        break;
+    case K_BUFFER:
+        _record = pixel * header.kBufferSize;
+        _last = _record + header.kBufferSize;
+        break;
+    }
+    _checkRecord();
+}
+
+FragmentDump::Fragment FragmentDump::const_iterator::operator*() const
+{
+    const Header& header = *_dump->_header;
+    const uint32_t* record = _dump->_records + _record * header.recordSize;
+    Fragment fragment;
+    std::memcpy(&fragment.depth, record + depthWord(header), sizeof(float));
+    fragment.color = record[depthWord(header) + 1];
+    return fragment;
+}
+
+FragmentDump::const_iterator& FragmentDump::const_iterator::operator++()
+{
+    const Header& header = *_dump->_header;
+    --_remaining;
+    switch (header.storage)
+    {
+    case LINKED_LISTS:
+    {
+        const uint32_t next = _dump->_records[_record * header.recordSize];
+        _record = next == EMPTY_LIST ? END : next;
+        break;
+    }
+    case PREFIX_SUM_ARRAYS:
+    case K_BUFFER:
+        if (++_record == _last)
+            _record = END;
+        break;
+    case PAGED_LISTS:
+        if (++_record == _last)
+            _nextPage();
+        break;
+    }
+    _checkRecord();
+    return *this;
+}
+
+FragmentDump::const_iterator FragmentDump::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+void FragmentDump::const_iterator::_nextPage()
+{
+    const Header& header = *_dump->_header;
+    _page = _page < header.numPages ? _dump->_pageLinks[_page]
+                                    : nullPage(header);
+    if (_page == nullPage(header))
+    {
+        _record = END;
+        return;
+    }
+    _record = uint64_t(_page) * header.fragmentsPerPage;
+    _last = _record + header.fragmentsPerPage;
+}
+
+void FragmentDump::const_iterator::_checkRecord()
+{
+    if (_record == END)
+        return;
+    const Header& header = *_dump->_header;
+    /* Records out of range or beyond the pixel count can only come from a
+       truncated or corrupted capture, the list is cut there. The count
+       bounds the walk when next pointers or page links form a cycle. */
+    if (_record >= header.numFragments || _remaining == 0)
+    {
+        _record = END;
+        return;
+    }
+    /* Unused K-buffer records are at the end of each pixel array */
+    if (header.storage == K_BUFFER &&
+        _dump->_records[_record * header.recordSize + depthWord(header)] ==
+            EMPTY_LIST)
+        _record = END;
+}
+}
+}
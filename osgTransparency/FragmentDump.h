@@ -0,0 +1,248 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_FRAGMENTDUMP_H
+#define OSGTRANSPARENCY_FRAGMENTDUMP_H
+
+#include <osgTransparency/api.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <stdint.h>
+#include <string>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+/**
+   Read-only access to a fragment dump file through a memory mapping.
+
+   A dump contains the fragments captured by FragmentListOITBin in one frame
+   (or one tile of a frame) with the same layout they had in GPU memory.
+   The file starts with a FragmentDump::Header followed by the sections
+   listed in it. Each section starts at an offset multiple of
+   SECTION_ALIGNMENT, so the whole file can be mapped and all the arrays
+   accessed in place. All values are stored in the byte order of the
+   machine that wrote the file, which is given by the byteOrder field.
+
+   Sections:
+   - counts: width * height 32-bit fragment counts in row major order.
+   - heads: width * height 32-bit list heads, whose meaning depends on the
+     storage mode, see FragmentData::getHeads.
+   - fragments: numFragments records of recordSize 32-bit words.
+   - pageLinks: numPages 32-bit indices of the previous page of each page.
+     Only present with PAGED_LISTS storage.
+
+   The fragment lists of each pixel can be iterated with getFragments
+   regardless of the storage mode.
+
+   @version 0.9.0
+*/
+class OSGTRANSPARENCY_API FragmentDump : boost::noncopyable
+{
+public:
+    /*--- Public declarations ---*/
+
+    /** Same values as FragmentListOITBin::Parameters::FragmentStorage */
+    enum Storage
+    {
+        LINKED_LISTS,
+        PREFIX_SUM_ARRAYS,
+        PAGED_LISTS,
+        K_BUFFER
+    };
+
+    static const uint32_t VERSION = 1;
+    static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static const size_t SECTION_ALIGNMENT = 4096;
+
+    /** Byte range of a section inside the file */
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    /** File header, 128 bytes */
+    struct Header
+    {
+        /** "OSGTFRAG" */
+        char magic[8];
+        /** BYTE_ORDER_MARK written in the byte order of the file */
+        uint32_t byteOrder;
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        /** A Storage value */
+        uint32_t storage;
+        uint32_t recordSize;
+        uint32_t fragmentsPerPage;
+        /** Number of low bits of the PAGED_LISTS heads with the fill count
+            of the last page. */
+        uint32_t pageFillBits;
+        /** Records per pixel with K_BUFFER storage */
+        uint32_t kBufferSize;
+        uint32_t frameNumber;
+        uint64_t numFragments;
+        uint64_t numPages;
+        Section counts;
+        Section heads;
+        Section fragments;
+        Section pageLinks;
+    };
+
+    struct Fragment
+    {
+        float depth;
+        /** RGBA8 color, red in the lowest byte */
+        uint32_t color;
+    };
+
+    /** Forward iterator over the fragments of a pixel in storage order,
+        which is not sorted by depth. */
+    class OSGTRANSPARENCY_API const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Fragment value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Fragment* pointer;
+        typedef Fragment reference;
+
+        const_iterator();
+
+        Fragment operator*() const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        bool operator==(const const_iterator& other) const
+        {
+            return _record == other._record;
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return _record != other._record;
+        }
+
+    private:
+        friend class FragmentDump;
+        const_iterator(const FragmentDump& dump, size_t pixel);
+
+        void _nextPage();
+        void _checkRecord();
+
+        const FragmentDump* _dump;
+        uint64_t _record;
+        uint64_t _last;
+        uint32_t _page;
+        /* Records left according to the pixel count */
+        uint32_t _remaining;
+    };
+
+    /** The fragments of a pixel as a range usable in range based for
+        loops. */
+    struct Fragments
+    {
+        const_iterator first;
+        const_iterator last;
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+    };
+
+    /*--- Public constructors/destructor ---*/
+
+    /**
+       Maps a dump file.
+       @throw std::runtime_error if the file can't be mapped, it's not a
+              fragment dump, it has a different byte order or an
+              unsupported version, or its sections are out of bounds.
+    */
+    explicit FragmentDump(const std::string& filename);
+
+    /**
+       Wraps fragment arrays already in memory, e.g. the ones of a
+       FragmentReadback::Frame, to access them as a dump.
+       The sections of the header are ignored and the arrays are not copied,
+       so they must outlive this object. pageLinks can be 0 if the storage
+       is not PAGED_LISTS.
+       @throw std::runtime_error if the header is not valid.
+    */
+    FragmentDump(const Header& header, const uint32_t* counts,
+                 const uint32_t* heads, const uint32_t* records,
+                 const uint32_t* pageLinks);
+
+    ~FragmentDump();
+
+    /*--- Public member functions ---*/
+
+    const Header& getHeader() const { return *_header; }
+    unsigned int getWidth() const { return _header->width; }
+    unsigned int getHeight() const { return _header->height; }
+    Storage getStorage() const { return Storage(_header->storage); }
+
+    const uint32_t* getCounts() const { return _counts; }
+    const uint32_t* getHeads() const { return _heads; }
+    const uint32_t* getRecords() const { return _records; }
+    /** Return 0 if the storage is not PAGED_LISTS */
+    const uint32_t* getPageLinks() const { return _pageLinks; }
+
+    /** The number of fragments captured for a pixel. */
+    uint32_t getCount(const unsigned int x, const unsigned int y) const
+    {
+        return _counts[size_t(y) * _header->width + x];
+    }
+
+    /** The fragments of a pixel.
+        With K_BUFFER storage only the K nearest fragments are returned.
+        At most getCount(x, y) fragments are returned, so the iteration
+        ends even if the lists of a corrupted dump have cycles. */
+    Fragments getFragments(unsigned int x, unsigned int y) const;
+
+    /**
+       Write a dump file.
+       The sections of the header are computed by this function, all the
+       other fields must be filled in by the caller. pageLinks can be 0 if
+       the storage is not PAGED_LISTS.
+       @throw std::runtime_error if the file can't be written.
+    */
+    static void write(const std::string& filename, const Header& header,
+                      const uint32_t* counts, const uint32_t* heads,
+                      const uint32_t* records, const uint32_t* pageLinks);
+
+private:
+    /*--- Private member attributes ---*/
+
+    void* _data;
+    size_t _size;
+    /* Copy of the header given to the in-memory constructor */
+    Header _memoryHeader;
+    const Header* _header;
+    const uint32_t* _counts;
+    const uint32_t* _heads;
+    const uint32_t* _records;
+    const uint32_t* _pageLinks;
+};
+}
+}
+#endif
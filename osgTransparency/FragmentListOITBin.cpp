@@ -24,10 +24,15 @@
 
 #ifdef OSG_GL3_AVAILABLE
 
+#include "FragmentCompositor.h"
+#include "FragmentDump.h"
 #include "FragmentListOITBin.h"
 #include "TextureBuffer.h"
 
+#include "util/CameraCache.h"
+#include "util/FrameStatsTracker.h"
 #include "util/GPUTimer.h"
+#include "util/SortingNetwork.h"
 #include "util/constants.h"
 #include "util/extensions.h"
 #include "util/glerrors.h"
@@ -45,10 +50,26 @@
 #include <osg/Stencil>
 #include <osg/TextureRectangle>
 #include <osg/ValueObject>
+#include <osg/Version>
+
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+#include <osg/ContextData>
+#include <osg/GLObjects>
+#endif
+
+#include <OpenThreads/Condition>
+#include <OpenThreads/Thread>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 namespace bbp
 {
@@ -62,12 +83,106 @@ const unsigned int MEAN_FRAGMENTS_PER_PIXEL =
                ? strtol(getenv("OSGTRANSPARENCY_FRAGMENTS_PER_PIXEL"), 0, 10)
                : 24)
         : 24;
+/* Number of fragments per page for paged lists. The page fill count is
+   stored in the PAGE_FILL_BITS least significant bits of the list head, the
+   largest value is reserved to lock the list while a new page is being
+   allocated. */
+const unsigned int PAGE_FILL_BITS = 4;
+const unsigned int FRAGMENTS_PER_PAGE =
+    getenv("OSGTRANSPARENCY_FRAGMENTS_PER_PAGE")
+        ? (strtol(getenv("OSGTRANSPARENCY_FRAGMENTS_PER_PAGE"), 0, 10) > 0 &&
+                   strtol(getenv("OSGTRANSPARENCY_FRAGMENTS_PER_PAGE"), 0,
+                          10) < (1 << PAGE_FILL_BITS) - 1
+               ? strtol(getenv("OSGTRANSPARENCY_FRAGMENTS_PER_PAGE"), 0, 10)
+               : 4)
+        : 4;
+/* List head value for pixels without any page, the page index is all ones
+   and the fill count says that the page is full. */
+const GLuint EMPTY_PAGED_LIST = (0xFFFFFFFF << PAGE_FILL_BITS) |
+                                FRAGMENTS_PER_PAGE;
 const unsigned int MAX_FRAGMENT_COUNT_INTERVALS = 8;
 /* The first sorting interval has a minimum fragment count of 8 */
 const unsigned int MAX_FRAGMENTS_PER_LIST = 4 << MAX_FRAGMENT_COUNT_INTERVALS;
 
 const bool GPU_TIMING = getenv("OSGTRANSPARENCY_GPU_TIMING") != 0;
 
+/* Number of elements scanned by each work group of the prefix sum compute
+   shader. Must match BLOCK_SIZE in prefix_sum.comp */
+const unsigned int PREFIX_SUM_BLOCK_SIZE = 1024;
+/* Minimum GL_MAX_COMPUTE_WORK_GROUP_COUNT guaranteed by the spec. The
+   prefix sum work groups loop over the blocks beyond this count. */
+const unsigned int MAX_COMPUTE_WORK_GROUPS = 65535;
+/* Image unit used for the block sums of the prefix sum. The units before this
+   one are used by the fragment capture pass. */
+const int PREFIX_SUM_BLOCK_SUMS_IMAGE_UNIT = 4;
+/* Image unit used for the page links of paged lists. */
+const int PAGE_LINKS_IMAGE_UNIT = 5;
+/* Image unit used for the tail accumulators of the K-buffer. */
+const int TAIL_IMAGE_UNIT = 6;
+/* Image unit used for the histogram of fragment count ranges. */
+const int COUNT_HISTOGRAM_IMAGE_UNIT = 7;
+/* Image units that can hold the colors of split records. Page links and
+   block sums are never used at the same time, so the one not used by the
+   storage mode is taken. */
+const int SPLIT_COLORS_PAGED_IMAGE_UNIT = PREFIX_SUM_BLOCK_SUMS_IMAGE_UNIT;
+const int SPLIT_COLORS_IMAGE_UNIT = PAGE_LINKS_IMAGE_UNIT;
+/* Image unit used for the output of the compute list resolve. The tail
+   accumulators are never used at the same time. */
+const int RESOLVED_COLORS_IMAGE_UNIT = TAIL_IMAGE_UNIT;
+/* Image unit used for the object IDs in the capture. Object IDs are not
+   supported with the K-buffer, so the tail accumulators are never used at
+   the same time. */
+const int OBJECT_IDS_IMAGE_UNIT = TAIL_IMAGE_UNIT;
+/* Number of 32-bit words of the tail accumulator of each pixel. */
+const unsigned int TAIL_WORDS = 5;
+const unsigned int MAX_K_BUFFER_SIZE = 64;
+/* The number of comparators grows as n log^2 n, larger networks produce
+   shaders too long to be worth compiling. */
+const unsigned int MAX_SORTING_NETWORK_SIZE = 128;
+
+/* Compute list resolve. The lists up to MAX_THREAD_LIST_LENGTH fragments
+   are resolved by a single thread and RESOLVE_PIXELS_PER_GROUP lists are
+   resolved by each work group. Longer lists are resolved by a whole work
+   group. */
+const unsigned int MAX_THREAD_LIST_LENGTH = 32;
+const unsigned int RESOLVE_PIXELS_PER_GROUP = 64;
+/* Words in the pixel bins buffer before the work lists: the histogram,
+   the work list cursors and the indirect dispatch commands. */
+const unsigned int PIXEL_BINS_HEADER_WORDS = MAX_FRAGMENT_COUNT_INTERVALS * 5;
+const unsigned int DISPATCH_COMMANDS_OFFSET =
+    MAX_FRAGMENT_COUNT_INTERVALS * 2 * sizeof(GLuint);
+
+/* Fragment buffer resizing policy. The buffer is grown when the fragment
+   count gets above GROW_THRESHOLD times the capacity and shrunk when it stays
+   below SHRINK_THRESHOLD times the capacity for SHRINK_DELAY consecutive
+   fragment count readbacks. In both cases the new capacity is RESIZE_FACTOR
+   times the fragment count. */
+const float GROW_THRESHOLD = 0.9;
+const float SHRINK_THRESHOLD = 0.25;
+const unsigned int SHRINK_DELAY = 120;
+const float RESIZE_FACTOR = 1.5;
+const size_t MIN_FRAGMENT_CAPACITY = 1 << 16;
+/* Maximum number of fragment count readbacks in flight. */
+const size_t MAX_PENDING_READBACKS = 3;
+/* The smallest memory budget accepted. */
+const size_t MIN_MEMORY_BUDGET = 16 << 20;
+
+/* Returns the projection matrix of the first render leaf of a bin. */
+osg::RefMatrix* findProjection(const osgUtil::RenderBin& bin)
+{
+    const osgUtil::RenderBin::RenderLeafList& leaves = bin.getRenderLeafList();
+    if (!leaves.empty())
+        return leaves.front()->_projection.get();
+    const osgUtil::RenderBin::StateGraphList& graphs = bin.getStateGraphList();
+    for (osgUtil::RenderBin::StateGraphList::const_iterator i = graphs.begin();
+         i != graphs.end(); ++i)
+    {
+        if (!(*i)->_leaves.empty())
+            return (*i)->_leaves.front()->_projection.get();
+    }
+    return 0;
+}
+
 /*
   TextureBuffer allocation callback
 */
@@ -90,6 +205,109 @@ public:
 
     virtual void subload(const TextureBuffer&, osg::State&) const {}
 };
+
+/* Reallocates the storage of a texture buffer that uses SubloadCallback.
+   The previous contents are discarded. */
+void resizeTextureBuffer(TextureBuffer& texture, const size_t width,
+                         osg::State& state)
+{
+    texture.setTextureWidth(width);
+
+    osg::GLBufferObject* buffer =
+        texture.getGLBufferObject(state.getContextID());
+    if (!buffer)
+        /* Not allocated yet, the subload callback will take care of it */
+        return;
+
+    const osg::GLExtensions* extensions =
+        osg::GLExtensions::Get(state.getContextID(), true);
+    buffer->bindBuffer();
+    extensions->glBufferData(GL_TEXTURE_BUFFER, width * sizeof(GLuint), 0,
+                             GL_DYNAMIC_DRAW);
+    buffer->unbindBuffer();
+    checkGLErrors("After texture buffer resize");
+}
+
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+/* Deletes the sync objects released by a Context the next time OSG flushes
+   the deleted objects of the graphics context. */
+class SyncObjectManager : public osg::GraphicsObjectManager
+{
+public:
+    SyncObjectManager(unsigned int contextID)
+        : osg::GraphicsObjectManager("osgTransparency::SyncObjectManager",
+                                     contextID)
+    {
+    }
+
+    void scheduleSyncForDeletion(const GLsync sync)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _syncs.push_back(sync);
+    }
+
+    virtual void flushDeletedGLObjects(double, double&)
+    {
+        flushAllDeletedGLObjects();
+    }
+
+    virtual void flushAllDeletedGLObjects()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        for (const GLsync sync : _syncs)
+            glDeleteSync(sync);
+        _syncs.clear();
+    }
+
+    virtual void deleteAllGLObjects() { flushAllDeletedGLObjects(); }
+
+    virtual void discardAllGLObjects()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _syncs.clear();
+    }
+
+private:
+    OpenThreads::Mutex _mutex;
+    std::vector<GLsync> _syncs;
+};
+#endif
+
+/* Maps the first words of the storage of a texture buffer for reading during
+   its lifetime. The pointer is 0 if the texture is 0 or not allocated. */
+class TextureBufferMapping : boost::noncopyable
+{
+public:
+    TextureBufferMapping(TextureBuffer* texture, const size_t words,
+                         osg::State& state)
+        : _buffer(texture ? texture->getGLBufferObject(state.getContextID())
+                          : 0)
+        , _words(0)
+    {
+        if (!_buffer || words == 0)
+            return;
+        _buffer->bindBuffer();
+        _words = static_cast<const uint32_t*>(
+            glMapBufferRange(GL_TEXTURE_BUFFER, 0, words * sizeof(GLuint),
+                             GL_MAP_READ_BIT));
+        _buffer->unbindBuffer();
+        checkGLErrors("After texture buffer mapping");
+    }
+
+    ~TextureBufferMapping()
+    {
+        if (!_words)
+            return;
+        _buffer->bindBuffer();
+        glUnmapBuffer(GL_TEXTURE_BUFFER);
+        _buffer->unbindBuffer();
+    }
+
+    const uint32_t* get() const { return _words; }
+private:
+    osg::GLBufferObject* _buffer;
+    const uint32_t* _words;
+};
 }
 
 typedef boost::shared_ptr<FragmentListOITBin::Parameters> ParametersPtr;
@@ -111,13 +329,19 @@ public:
             s_contextMap.erase(object);
         }
     };
-    static Context& getContext(osg::State* state,
+    static Context& getContext(osg::State* state, osg::Camera* camera,
                                const ParametersPtr& parameters);
+    static bool getFragmentBufferStats(const osg::State* state,
+                                       FragmentBufferStats& stats);
+    static bool getFrameStats(const osg::State* state, FrameStats& stats);
 
 private:
     static OpenThreads::Mutex s_contextMapMutex;
     typedef boost::shared_ptr<Context> ContextPtr;
-    typedef std::map<const void*, ContextPtr> ContextMap;
+    /* Each graphics context keeps the resources of the cameras it renders
+       most recently. */
+    typedef CameraCache<ContextPtr> ContextCache;
+    typedef std::map<const void*, ContextCache> ContextMap;
     static ContextMap s_contextMap;
     static StateObserver s_stateObserver;
 };
@@ -135,12 +359,37 @@ struct FragmentListOITBin::Parameters::_Impl
 {
     _Impl()
         : alphaCutOffThreshold(0)
+        , alphaCutOffEncoding(TRANSPARENCY_8_BITS)
+        , fragmentStorage(LINKED_LISTS)
+        , fragmentBufferType(TEXTURE_BUFFER)
+        , fragmentEncoding(FULL_RECORDS)
+        , kBufferSize(8)
+        , sortingNetworkMaxSize(0)
+        , listResolve(STENCIL_BATCHES)
+        , memoryBudget(0)
+        , opaqueDepthTest(false)
+        , minTransmittance(0)
+        , partialSortThreshold(0)
+        , objectIDs(false)
     {
     }
 
     OpenThreads::Mutex mutex;
     std::map<unsigned int, CaptureCallback> captureCallbacks;
     float alphaCutOffThreshold;
+    AlphaCutOffEncoding alphaCutOffEncoding;
+    FragmentStorage fragmentStorage;
+    FragmentBufferType fragmentBufferType;
+    FragmentEncoding fragmentEncoding;
+    unsigned int kBufferSize;
+    unsigned int sortingNetworkMaxSize;
+    ListResolve listResolve;
+    size_t memoryBudget;
+    bool opaqueDepthTest;
+    std::string deferredShadingSource;
+    float minTransmittance;
+    float partialSortThreshold;
+    bool objectIDs;
 };
 
 FragmentListOITBin::Parameters::Parameters()
@@ -155,6 +404,19 @@ FragmentListOITBin::Parameters::Parameters(const Parameters& other)
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(other._impl->mutex);
     _impl->captureCallbacks = other._impl->captureCallbacks;
     _impl->alphaCutOffThreshold = other._impl->alphaCutOffThreshold;
+    _impl->alphaCutOffEncoding = other._impl->alphaCutOffEncoding;
+    _impl->fragmentStorage = other._impl->fragmentStorage;
+    _impl->fragmentBufferType = other._impl->fragmentBufferType;
+    _impl->fragmentEncoding = other._impl->fragmentEncoding;
+    _impl->kBufferSize = other._impl->kBufferSize;
+    _impl->sortingNetworkMaxSize = other._impl->sortingNetworkMaxSize;
+    _impl->listResolve = other._impl->listResolve;
+    _impl->memoryBudget = other._impl->memoryBudget;
+    _impl->opaqueDepthTest = other._impl->opaqueDepthTest;
+    _impl->deferredShadingSource = other._impl->deferredShadingSource;
+    _impl->minTransmittance = other._impl->minTransmittance;
+    _impl->partialSortThreshold = other._impl->partialSortThreshold;
+    _impl->objectIDs = other._impl->objectIDs;
 }
 
 FragmentListOITBin::Parameters::~Parameters()
@@ -186,6 +448,166 @@ bool FragmentListOITBin::Parameters::isAlphaCutOffEnabled() const
     return _impl->alphaCutOffThreshold != 0;
 }
 
+void FragmentListOITBin::Parameters::setAlphaCutOffEncoding(
+    const AlphaCutOffEncoding encoding)
+{
+    _impl->alphaCutOffEncoding = encoding;
+}
+
+FragmentListOITBin::Parameters::AlphaCutOffEncoding
+    FragmentListOITBin::Parameters::getAlphaCutOffEncoding() const
+{
+    return _impl->alphaCutOffEncoding;
+}
+
+void FragmentListOITBin::Parameters::setFragmentStorage(
+    const FragmentStorage storage)
+{
+    _impl->fragmentStorage = storage;
+}
+
+FragmentListOITBin::Parameters::FragmentStorage
+    FragmentListOITBin::Parameters::getFragmentStorage() const
+{
+    return _impl->fragmentStorage;
+}
+
+void FragmentListOITBin::Parameters::setFragmentBufferType(
+    const FragmentBufferType type)
+{
+    _impl->fragmentBufferType = type;
+}
+
+FragmentListOITBin::Parameters::FragmentBufferType
+    FragmentListOITBin::Parameters::getFragmentBufferType() const
+{
+    return _impl->fragmentBufferType;
+}
+
+void FragmentListOITBin::Parameters::setFragmentEncoding(
+    const FragmentEncoding encoding)
+{
+    _impl->fragmentEncoding = encoding;
+}
+
+FragmentListOITBin::Parameters::FragmentEncoding
+    FragmentListOITBin::Parameters::getFragmentEncoding() const
+{
+    return _impl->fragmentEncoding;
+}
+
+void FragmentListOITBin::Parameters::setKBufferSize(const unsigned int size)
+{
+    if (size == 0 || size > MAX_K_BUFFER_SIZE)
+        throw std::runtime_error("Invalid K-buffer size");
+    _impl->kBufferSize = size;
+}
+
+unsigned int FragmentListOITBin::Parameters::getKBufferSize() const
+{
+    return _impl->kBufferSize;
+}
+
+void FragmentListOITBin::Parameters::setSortingNetworkMaxSize(
+    const unsigned int size)
+{
+    if (size > MAX_SORTING_NETWORK_SIZE)
+        throw std::runtime_error("Invalid sorting network size");
+    _impl->sortingNetworkMaxSize = size;
+}
+
+unsigned int FragmentListOITBin::Parameters::getSortingNetworkMaxSize() const
+{
+    return _impl->sortingNetworkMaxSize;
+}
+
+void FragmentListOITBin::Parameters::setListResolve(const ListResolve resolve)
+{
+    _impl->listResolve = resolve;
+}
+
+FragmentListOITBin::Parameters::ListResolve
+    FragmentListOITBin::Parameters::getListResolve() const
+{
+    return _impl->listResolve;
+}
+
+void FragmentListOITBin::Parameters::setMemoryBudget(const size_t bytes)
+{
+    if (bytes != 0 && bytes < MIN_MEMORY_BUDGET)
+        throw std::runtime_error("Invalid memory budget");
+    _impl->memoryBudget = bytes;
+}
+
+size_t FragmentListOITBin::Parameters::getMemoryBudget() const
+{
+    return _impl->memoryBudget;
+}
+
+void FragmentListOITBin::Parameters::setOpaqueDepthTest(const bool enable)
+{
+    _impl->opaqueDepthTest = enable;
+}
+
+bool FragmentListOITBin::Parameters::getOpaqueDepthTest() const
+{
+    return _impl->opaqueDepthTest;
+}
+
+void FragmentListOITBin::Parameters::enableDeferredShading(
+    const std::string& shadingSource, const float minTransmittance)
+{
+    if (shadingSource.empty())
+        throw std::runtime_error("Empty deferred shading source");
+    if (minTransmittance < 0 || minTransmittance >= 1)
+        throw std::runtime_error("Invalid minimum transmittance");
+    _impl->deferredShadingSource = shadingSource;
+    _impl->minTransmittance = minTransmittance;
+}
+
+void FragmentListOITBin::Parameters::disableDeferredShading()
+{
+    _impl->deferredShadingSource.clear();
+    _impl->minTransmittance = 0;
+}
+
+bool FragmentListOITBin::Parameters::isDeferredShadingEnabled() const
+{
+    return !_impl->deferredShadingSource.empty();
+}
+
+void FragmentListOITBin::Parameters::enablePartialSort(const float threshold)
+{
+    if (threshold <= 0 || threshold > 1)
+        throw std::runtime_error("Invalid partial sort threshold value");
+    _impl->partialSortThreshold = threshold;
+}
+
+void FragmentListOITBin::Parameters::disablePartialSort()
+{
+    _impl->partialSortThreshold = 0;
+}
+
+bool FragmentListOITBin::Parameters::isPartialSortEnabled() const
+{
+    return _impl->partialSortThreshold != 0;
+}
+
+void FragmentListOITBin::Parameters::enableObjectIDs()
+{
+    _impl->objectIDs = true;
+}
+
+void FragmentListOITBin::Parameters::disableObjectIDs()
+{
+    _impl->objectIDs = false;
+}
+
+bool FragmentListOITBin::Parameters::areObjectIDsEnabled() const
+{
+    return _impl->objectIDs;
+}
+
 bool FragmentListOITBin::Parameters::update(const Parameters& other)
 {
     if (!BaseRenderBin::Parameters::update(other))
@@ -195,12 +617,28 @@ bool FragmentListOITBin::Parameters::update(const Parameters& other)
         other._impl->alphaCutOffThreshold != 0)
         return false;
 
+    if (_impl->alphaCutOffEncoding != other._impl->alphaCutOffEncoding ||
+        _impl->fragmentStorage != other._impl->fragmentStorage ||
+        _impl->fragmentBufferType != other._impl->fragmentBufferType ||
+        _impl->fragmentEncoding != other._impl->fragmentEncoding ||
+        _impl->kBufferSize != other._impl->kBufferSize ||
+        _impl->sortingNetworkMaxSize != other._impl->sortingNetworkMaxSize ||
+        _impl->listResolve != other._impl->listResolve ||
+        _impl->memoryBudget != other._impl->memoryBudget ||
+        _impl->opaqueDepthTest != other._impl->opaqueDepthTest ||
+        _impl->deferredShadingSource != other._impl->deferredShadingSource ||
+        isPartialSortEnabled() != other.isPartialSortEnabled() ||
+        _impl->objectIDs != other._impl->objectIDs)
+        return false;
+
     /* There's no need to lock the mutex on this object because this function
        is only used on the internal copy of the parameters which is not
        accesible to the user. We lock the mutex on the parameter only. */
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(other._impl->mutex);
     _impl->captureCallbacks = other._impl->captureCallbacks;
     _impl->alphaCutOffThreshold = other._impl->alphaCutOffThreshold;
+    _impl->minTransmittance = other._impl->minTransmittance;
+    _impl->partialSortThreshold = other._impl->partialSortThreshold;
 
     return true;
 }
@@ -213,17 +651,114 @@ class FragmentListOITBin::_Impl::Context
 {
 public:
     friend class FragmentData;
+    friend class FragmentReadback;
 
     /*--- Public constructor ---*/
 
     Context(osg::State* state, const ParametersPtr& parameters)
-        : _parameters(*parameters)
+        : _contextID(state->getContextID())
+        , _parameters(*parameters)
         , _camera(0)
+        , _maxWidth(0)
+        , _maxHeight(0)
+        , _maxScreenWidth(0)
+        , _maxScreenHeight(0)
+        , _maxFragmentCapacity(std::numeric_limits<size_t>::max())
+        , _copyOpaqueDepth(false)
         , _atomicBuffer(0)
+        , _lowUsageReadbacks(0)
+        , _passes(0)
         , _savedStackPosition(0)
         , _oldPrevious(0)
         , _gpuTimer(state)
+        , _computeResolve(false)
+        , _deferredShading(false)
+        , _shaderStorage(false)
+        , _objectIDs(false)
+    {
+        /* This buffer is never bound as an atomic counter buffer, its
+           target is irrelevant because it's only used as the destination of
+           buffer copies. */
+        osg::UIntArray* slots = new osg::UIntArray(MAX_PENDING_READBACKS);
+        _counterReadback = new osg::AtomicCounterBufferObject();
+        _counterReadback->addBufferData(slots);
+
+        if (_parameters.getFragmentEncoding() == Parameters::COMPACT_RECORDS &&
+            _parameters.getFragmentStorage() == Parameters::LINKED_LISTS)
+        {
+            std::cerr << "osgTransparency: compact fragment records are not "
+                         "supported with linked list storage, using full "
+                         "records" << std::endl;
+        }
+
+        if (_parameters.getFragmentBufferType() ==
+            Parameters::SHADER_STORAGE_BUFFER)
+        {
+            const unsigned int contextID = state->getContextID();
+            if (_useKBuffer())
+                std::cerr << "osgTransparency: shader storage fragment "
+                             "buffers are not supported with K-buffer "
+                             "storage, using a texture buffer" << std::endl;
+            else if (!osg::isGLExtensionOrVersionSupported(
+                         contextID, "GL_ARB_shader_storage_buffer_object",
+                         4.3f))
+                std::cerr << "osgTransparency: shader storage buffers not "
+                             "supported, using a texture buffer for the "
+                             "fragments" << std::endl;
+            else
+                _shaderStorage = true;
+        }
+
+        if (_parameters.isDeferredShadingEnabled())
+        {
+            _deferredShading = !_useKBuffer();
+            if (!_deferredShading)
+                std::cerr << "osgTransparency: deferred shading is not "
+                             "supported with K-buffer storage" << std::endl;
+        }
+
+        if (_parameters.areObjectIDsEnabled())
+        {
+            _objectIDs = !_useKBuffer();
+            if (!_objectIDs)
+                std::cerr << "osgTransparency: object IDs are not supported "
+                             "with K-buffer storage" << std::endl;
+        }
+
+        if (_parameters.getListResolve() == Parameters::COMPUTE_BINNING &&
+            _deferredShading)
+        {
+            std::cerr << "osgTransparency: deferred shading is not "
+                         "supported by the compute resolve, using stencil "
+                         "batches to resolve the fragment lists" << std::endl;
+        }
+        else if (_parameters.getListResolve() ==
+                     Parameters::COMPUTE_BINNING &&
+                 !_useKBuffer())
+        {
+            const unsigned int contextID = state->getContextID();
+            _computeResolve =
+                osg::isGLExtensionOrVersionSupported(contextID,
+                                                     "GL_ARB_compute_shader",
+                                                     4.3f);
+            if (!_computeResolve)
+                std::cerr << "osgTransparency: compute shaders not supported, "
+                             "using stencil batches to resolve the fragment "
+                             "lists" << std::endl;
+        }
+    }
+
+    /* A Context is destroyed when the camera cache evicts it or when it's
+       replaced after a parameter change, without the OpenGL context being
+       current. The fences of the pending readbacks are deleted by OSG
+       later on (they are leaked in older versions of OSG). */
+    ~Context()
     {
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+        auto objectManager = osg::get<SyncObjectManager>(_contextID);
+        for (const auto& pending : _pendingReadbacks)
+            objectManager->scheduleSyncForDeletion(pending.fence);
+#endif
     }
 
     /*--- Public member functions ---*/
@@ -233,26 +768,22 @@ public:
     {
         _testAndInit(bin, renderInfo);
 
-        _preDraw(renderInfo, previous);
-        _captureFragments(bin, renderInfo, previous);
-
-        const unsigned int contextID = renderInfo.getState()->getContextID();
-        const CaptureCallback& callback =
-            /* The _parameters object is completely internal, there's no
-               need to lock it to access the callback map. */
-            _parameters._impl->captureCallbacks[contextID];
-
-        if (!callback.empty() &&
-            !callback(FragmentData(renderInfo.getState(), this)))
+        /* The tiles are captured and composited one after another reusing
+           the same buffers. */
+        _passes = 0;
+        for (size_t i = 0; i != _tiles.size(); ++i)
         {
-            /* Return to previous framebuffer */
-            osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
-            ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
-            return;
+            _setTile(*bin, _tiles[i]);
+            _drawTile(bin, renderInfo, previous);
         }
-
-        _sortAndDisplay(renderInfo);
-        _postDraw(renderInfo, previous);
+        /* Checked once all the tiles have been issued, otherwise a frame
+           could be considered complete with only some of its tiles. */
+        if (GPU_TIMING)
+        {
+            _gpuTimer.checkQueries();
+            _gpuTimer.reportCompleted(std::cout);
+        }
+        _updateFrameStats(*renderInfo.getState());
     }
 
     bool updateParameters(const ParametersPtr& parameters)
@@ -260,18 +791,69 @@ public:
         return _parameters.update(*parameters);
     }
 
+    FragmentBufferStats getFragmentBufferStats() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+        return _stats;
+    }
+
+    FrameStats getFrameStats() const
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+        return _frameStats;
+    }
+
+    /* GPU memory used by the per pixel buffers and the fragment buffer */
+    size_t getMemoryUsage() const
+    {
+        if (!_fragments)
+            return 0;
+        return _pixelBufferBytes(size_t(_maxWidth) * _maxHeight) +
+               _fragmentBufferBytes(_getFragmentCapacity());
+    }
+
 private:
     /*--- Private member varibles ---*/
 
+    const unsigned int _contextID;
     Parameters _parameters;
 
     osg::Camera* _camera;
+    /* Size of the per pixel buffers, which is the tile size when the
+       viewport is split in tiles. */
     unsigned int _maxWidth;
     unsigned int _maxHeight;
+    /* Largest viewport size supported by the current buffers. */
+    unsigned int _maxScreenWidth;
+    unsigned int _maxScreenHeight;
+
+    /* Tile in viewport coordinates (lower left corner is 0, 0) */
+    struct Tile
+    {
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+        unsigned int height;
+    };
+    std::vector<Tile> _tiles;
+    /* Projection used to render the current tile, null if the viewport is
+       not split. */
+    osg::ref_ptr<osg::RefMatrix> _tileProjection;
+    /* Area of the camera viewport covered by the current tile. */
+    osg::ref_ptr<osg::Viewport> _tileViewport;
+    /* The fragment buffer capacity allowed by the memory budget. */
+    size_t _maxFragmentCapacity;
 
     osg::ref_ptr<osg::Geometry> _quad;
 
     osg::ref_ptr<osg::FrameBufferObject> _auxiliaryBuffer;
+    /* Copy of the opaque depth buffer of the camera framebuffer for the
+       opaque depth test. It's created in the first frame because its format
+       must match the format of the camera depth buffer. */
+    osg::ref_ptr<osg::RenderBuffer> _opaqueDepth;
+    /* False if the camera depth buffer can't be copied, in which case
+       _opaqueDepth is cleared to the far plane instead. */
+    bool _copyOpaqueDepth;
 
     osg::ref_ptr<osg::TextureRectangle> _fragmentLists;
     osg::ref_ptr<osg::TextureRectangle> _fragmentCounts;
@@ -288,23 +870,89 @@ private:
        same pixel from different fragments. */
     osg::ref_ptr<osg::TextureRectangle> _depthTranspBuffer;
 
+    /* Per block partial sums of the fragment counts, only used with
+       PREFIX_SUM_ARRAYS storage. The last element holds the total number of
+       fragments after the block sums are scanned. */
+    osg::ref_ptr<TextureBuffer> _blockSums;
+
+    /* Index of the previous page of each page, only used with PAGED_LISTS
+       storage. */
+    osg::ref_ptr<TextureBuffer> _pageLinks;
+    /* Colors or shading inputs of split records, 0 otherwise. */
+    osg::ref_ptr<TextureBuffer> _fragmentColors;
+    /* Object ID of each fragment if object IDs are enabled, 0 otherwise. */
+    osg::ref_ptr<TextureBuffer> _fragmentObjectIDs;
+
+    /* Per pixel tail accumulators of the K-buffer, only used with K_BUFFER
+       storage. */
+    osg::ref_ptr<TextureBuffer> _tailAccumulators;
+
+    /* Number of pixels in each fragment count range of the sort and display
+       batches. It's updated during the capture and used to skip the empty
+       batches without reading it back. Not used with K_BUFFER storage.
+       With the compute list resolve the buffer also holds the work lists
+       and dispatch commands, see bin_pixels.comp. */
+    osg::ref_ptr<TextureBuffer> _countHistogram;
+
+    /* Premultiplied colors of the lists resolved by compute shaders. */
+    osg::ref_ptr<osg::TextureRectangle> _resolvedColors;
+
     osg::ref_ptr<osg::Uniform> _minTransparency;
     osg::ref_ptr<osg::Uniform> _fragmentCountRange;
     osg::ref_ptr<osg::Uniform> _lowerLeftCorner;
+    osg::ref_ptr<osg::Uniform> _viewportSize;
+    osg::ref_ptr<osg::Uniform> _fragmentCapacity;
+    osg::ref_ptr<osg::Uniform> _bufferWidth;
     osg::ref_ptr<osg::Viewport> _viewport;
 
     ProgramMap _extraShaders;
 
+    ProgramMap _countFragmentsPrograms;
+    ProgramMap _insertDepthsPrograms;
     ProgramMap _saveFragmentsPrograms;
 
+    osg::ref_ptr<osg::StateSet> _countFragmentsStateSet;
+    osg::ref_ptr<osg::StateSet> _insertDepthsStateSet;
+    osg::ref_ptr<osg::StateSet> _compositeKBufferStateSet;
+    /* Scan blocks, scan block sums and add block offsets */
+    osg::ref_ptr<osg::StateSet> _prefixSumStateSets[3];
     osg::ref_ptr<osg::StateSet> _saveFragmentsStateSet;
-    osg::ref_ptr<osg::StateSet> _fragmentCountFilterStateSet;
+    osg::ref_ptr<osg::StateSet>
+        _fragmentCountFilterStateSets[MAX_FRAGMENT_COUNT_INTERVALS];
     osg::ref_ptr<osg::StateSet>
         _sortAndDisplayFragmentsStateSet[MAX_FRAGMENT_COUNT_INTERVALS];
+    /* Bin pixels and build commands */
+    osg::ref_ptr<osg::StateSet> _binPixelsStateSets[2];
+    osg::ref_ptr<osg::StateSet>
+        _resolveListsStateSets[MAX_FRAGMENT_COUNT_INTERVALS];
+    osg::ref_ptr<osg::StateSet> _displayResolvedStateSet;
 
     osg::ref_ptr<osg::BufferObject> _atomicBuffer;
     GLint _previousFBO;
 
+    /* Asynchronous readback of the atomic counter. Each pending readback
+       copies the counter into a slot of _counterReadback and the result is
+       read when the fence is signalled, usually a frame later. The fences
+       still pending when the context is destroyed are scheduled for
+       deletion in the destructor. */
+    struct Readback
+    {
+        GLsync fence;
+        size_t slot;
+        unsigned int frame;
+        size_t capacity;
+    };
+    osg::ref_ptr<osg::BufferObject> _counterReadback;
+    std::deque<Readback> _pendingReadbacks;
+    unsigned int _lowUsageReadbacks;
+
+    mutable OpenThreads::Mutex _statsMutex;
+    FragmentBufferStats _stats;
+    FrameStats _frameStats;
+    FrameStatsTracker _frameStatsTracker;
+    /* Geometry passes rendered in the current frame by all tiles */
+    unsigned int _passes;
+
     unsigned int _savedStackPosition;
     osgUtil::RenderLeaf* _oldPrevious;
 #ifndef NDEBUG
@@ -313,8 +961,206 @@ private:
 
     GPUTimer _gpuTimer;
 
+    bool _computeResolve;
+    /* Whether fragments store shading inputs and are shaded in the sort and
+       display pass. */
+    bool _deferredShading;
+    osg::ref_ptr<osg::Uniform> _minTransmittance;
+    /* Whether the fragment buffer is accessed as a shader storage buffer
+       instead of a buffer texture. */
+    bool _shaderStorage;
+    osg::ref_ptr<osg::Uniform> _maxOpacity;
+    /* Whether the object ID of each fragment is stored for picking. */
+    bool _objectIDs;
+
     /*--- Private member functions ---*/
 
+    void _drawTile(FragmentListOITBin* bin, osg::RenderInfo& renderInfo,
+                   osgUtil::RenderLeaf*& previous)
+    {
+        _preDraw(renderInfo, previous);
+        if (_usePrefixSum())
+        {
+            _countFragments(bin, renderInfo, previous);
+            _computeFragmentOffsets(renderInfo);
+        }
+        if (_useKBuffer())
+            _insertKBufferDepths(bin, renderInfo, previous);
+        _captureFragments(bin, renderInfo, previous);
+        if (_useAdaptiveCapacity())
+            _requestCounterReadback(*renderInfo.getState());
+
+        const unsigned int contextID = renderInfo.getState()->getContextID();
+        const CaptureCallback& callback =
+            /* The _parameters object is completely internal, there's no
+               need to lock it to access the callback map. */
+            _parameters._impl->captureCallbacks[contextID];
+
+        if (!callback.empty() &&
+            !callback(FragmentData(renderInfo.getState(), this)))
+        {
+            /* Return to previous framebuffer */
+            osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+            ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
+            return;
+        }
+
+        if (_useKBuffer())
+            _compositeKBuffer(renderInfo);
+        else if (_computeResolve)
+            _resolveWithCompute(renderInfo);
+        else
+            _sortAndDisplay(renderInfo);
+        _postDraw(renderInfo, previous);
+    }
+
+    void _updateFrameStats(const osg::State& state)
+    {
+        FrameStats stats;
+        if (!_frameStatsTracker.update(state.getFrameStamp()->getFrameNumber(),
+                                       _passes, GPU_TIMING ? &_gpuTimer : 0,
+                                       stats))
+            return;
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+        _frameStats = stats;
+    }
+
+    void _setTile(const FragmentListOITBin& bin, const Tile& tile)
+    {
+        const osg::Viewport* viewport = _camera->getViewport();
+        _viewport->width() = tile.width;
+        _viewport->height() = tile.height;
+        _viewportSize->set(int(tile.width), int(tile.height));
+        _tileViewport->setViewport(viewport->x() + tile.x,
+                                   viewport->y() + tile.y, tile.width,
+                                   tile.height);
+        _lowerLeftCorner->set(osg::Vec2(_tileViewport->x(),
+                                        _tileViewport->y()));
+
+        _tileProjection = 0;
+        osg::RefMatrix* projection = findProjection(bin);
+        if (_tiles.size() == 1 || !projection)
+            return;
+
+        /* Scaling and translating the normalized device coordinates of
+           the tile area to [-1, 1]. */
+        const double width = viewport->width();
+        const double height = viewport->height();
+        const double scaleX = width / tile.width;
+        const double scaleY = height / tile.height;
+        const double centerX = (2 * tile.x + tile.width) / width - 1;
+        const double centerY = (2 * tile.y + tile.height) / height - 1;
+        _tileProjection =
+            new osg::RefMatrix(*projection *
+                               osg::Matrix::translate(-centerX, -centerY, 0) *
+                               osg::Matrix::scale(scaleX, scaleY, 1));
+    }
+
+    /* Bytes of GPU memory used by the buffers whose size depends on the
+       number of pixels, including the small ones of fixed size. */
+    size_t _pixelBufferBytes(const size_t pixels) const
+    {
+        /* List heads and fragment counts */
+        size_t words = 2 * pixels;
+        if (_parameters.isAlphaCutOffEnabled())
+            words += pixels;
+        if (_useKBuffer())
+            words += TAIL_WORDS * pixels;
+        else if (_computeResolve)
+            /* Pixel bins header, work list entry and resolved color */
+            words += PIXEL_BINS_HEADER_WORDS + 2 * pixels;
+        else
+            words += MAX_FRAGMENT_COUNT_INTERVALS;
+        if (_usePrefixSum())
+            /* Block sums plus the total */
+            words +=
+                (pixels + PREFIX_SUM_BLOCK_SIZE - 1) / PREFIX_SUM_BLOCK_SIZE +
+                1;
+        size_t bytes = words * sizeof(GLuint);
+        if (_parameters.getOpaqueDepthTest())
+            /* The format of the depth renderbuffer is chosen from the camera
+               framebuffer, this is the largest one. */
+            bytes += pixels * 8;
+        return bytes;
+    }
+
+    /* Bytes of GPU memory used by the buffers whose size depends on the
+       fragment capacity. */
+    size_t _fragmentBufferBytes(const size_t capacity) const
+    {
+        size_t words = capacity * _fragmentWords();
+        if (_usePages())
+            words += capacity / FRAGMENTS_PER_PAGE;
+        return words * sizeof(GLuint);
+    }
+
+    /* The largest fragment capacity that fits in the given number of
+       bytes. */
+    size_t _fragmentCapacityForBytes(const size_t bytes) const
+    {
+        if (!_usePages())
+            return bytes / (_fragmentWords() * sizeof(GLuint));
+        /* Each page takes its records plus its link */
+        const size_t pageBytes =
+            (FRAGMENTS_PER_PAGE * _fragmentWords() + 1) * sizeof(GLuint);
+        return bytes / pageBytes * FRAGMENTS_PER_PAGE;
+    }
+
+    /* Chooses the size of the per pixel buffers to fit the memory budget.
+       The viewport is split in the smallest number of tiles for which the
+       per pixel buffers and the initial fragment buffer fit. */
+    void _chooseTileSize(const unsigned int width, const unsigned int height)
+    {
+        _maxWidth = width;
+        _maxHeight = height;
+        _maxFragmentCapacity = std::numeric_limits<size_t>::max();
+
+        const size_t budget = _parameters.getMemoryBudget();
+        if (budget == 0)
+            return;
+
+        const size_t fragmentsPerPixel = _useKBuffer()
+                                             ? _parameters.getKBufferSize()
+                                             : MEAN_FRAGMENTS_PER_PIXEL;
+        unsigned int tiles = 1;
+        for (;;)
+        {
+            const size_t pixels = size_t(_maxWidth) * _maxHeight;
+            const size_t bytes =
+                _pixelBufferBytes(pixels) +
+                _fragmentBufferBytes(pixels * fragmentsPerPixel);
+            if (bytes <= budget || pixels == 1)
+                break;
+            ++tiles;
+            /* Keeping the tiles as square as possible */
+            const unsigned int columns = std::max(
+                1u, (unsigned int)std::round(
+                        std::sqrt(tiles * double(width) / height)));
+            const unsigned int rows = (tiles + columns - 1) / columns;
+            _maxWidth = (width + columns - 1) / columns;
+            _maxHeight = (height + rows - 1) / rows;
+        }
+
+        const size_t pixelBytes =
+            _pixelBufferBytes(size_t(_maxWidth) * _maxHeight);
+        _maxFragmentCapacity = _fragmentCapacityForBytes(
+            budget > pixelBytes ? budget - pixelBytes : 0);
+    }
+
+    void _updateTiles(const unsigned int width, const unsigned int height)
+    {
+        _tiles.clear();
+        for (unsigned int y = 0; y < height; y += _maxHeight)
+        {
+            for (unsigned int x = 0; x < width; x += _maxWidth)
+            {
+                const Tile tile = {x, y, std::min(_maxWidth, width - x),
+                                   std::min(_maxHeight, height - y)};
+                _tiles.push_back(tile);
+            }
+        }
+    }
+
     void _preDraw(osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous)
     {
         osg::State& state = *renderInfo.getState();
@@ -329,25 +1175,7 @@ private:
         _oldState = new osg::StateSet;
         state.captureCurrentState(*_oldState);
 #endif
-        /* Resetting atomic counter.
-           Maybe calling dirty on the underlying UIntArray is enough but
-           this method is used instead because it seems less expensive. */
-        osg::GLBufferObject* buffer =
-            _atomicBuffer->getGLBufferObject(state.getContextID());
-        if (buffer)
-        {
-            /* The atomic buffer has already been allocated so probably
-               it has also been used and the initial buffer data
-               changed. */
-            buffer->bindBuffer();
-            int flags = (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
-                         GL_MAP_UNSYNCHRONIZED_BIT);
-            GLuint* ptr = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0,
-                                                    sizeof(GLuint), flags);
-            *ptr = 0;
-            glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
-            buffer->unbindBuffer();
-        }
+        _setAtomicCounter(state, 0);
 
         /* The scissor setup is needed for OSG cameras whose viewport is not
            at (0, 0) */
@@ -368,7 +1196,8 @@ private:
         }
         _auxiliaryBuffer->apply(state);
         /* Clear head pointer buffer to undefined. */
-        GLuint colorui[] = {0xFFFFFFFF, 0, 0, 0};
+        GLuint colorui[] = {_usePages() ? EMPTY_PAGED_LIST : 0xFFFFFFFF, 0, 0,
+                            0};
         glClearBufferuiv(GL_COLOR, 0, colorui);
         /* Clear fragment count to 0. */
         colorui[0] = 0;
@@ -378,14 +1207,626 @@ private:
         {
             /* Clearing the depth to the minimum encoded value and the
                transparency to the maximum. */
-            colorui[0] = 0xFF000000;
+            colorui[0] = _transparencyBits() == 8 ? 0xFF000000 : 0xFFFF0000;
             glClearBufferuiv(GL_COLOR, 2, colorui);
         }
+
+        if (_parameters.getOpaqueDepthTest())
+            _setupOpaqueDepth(state);
+
+        if (_useKBuffer())
+        {
+            /* Clearing the depths to the maximum value and the colors to
+               transparent black. */
+            const GLuint empty[] = {0xFFFFFFFF, 0};
+            _clearTextureBuffer(state, *_fragments, GL_RG32UI, GL_RG_INTEGER,
+                                empty);
+            _clearTextureBuffer(state, *_tailAccumulators, GL_R32UI,
+                                GL_RED_INTEGER, empty + 1);
+        }
+        else
+        {
+            /* Clearing the histogram and the work list cursors */
+            const GLuint zero = 0;
+            _clearTextureBuffer(state, *_countHistogram, GL_R32UI,
+                                GL_RED_INTEGER, &zero,
+                                MAX_FRAGMENT_COUNT_INTERVALS * 2 *
+                                    sizeof(GLuint));
+        }
         if (GPU_TIMING)
             _gpuTimer.stop();
         checkGLErrors("After pre-draw");
     }
 
+    /* Creates the renderbuffer for the opaque depth test with the same format
+       as the depth buffer of the current framebuffer. */
+    void _createOpaqueDepthBuffer(osg::GLExtensions* ext)
+    {
+        const GLenum depth = _previousFBO == 0 ? GL_DEPTH
+                                               : GL_DEPTH_ATTACHMENT_EXT;
+        const GLenum stencil = _previousFBO == 0 ? GL_STENCIL
+                                                 : GL_STENCIL_ATTACHMENT_EXT;
+        GLint type = GL_NONE;
+        ext->glGetFramebufferAttachmentParameteriv(
+            GL_FRAMEBUFFER_EXT, depth,
+            GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE_EXT, &type);
+        GLint depthBits = 0, stencilBits = 0, componentType = GL_NONE;
+        if (type != GL_NONE)
+        {
+            ext->glGetFramebufferAttachmentParameteriv(
+                GL_FRAMEBUFFER_EXT, depth,
+                GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+            ext->glGetFramebufferAttachmentParameteriv(
+                GL_FRAMEBUFFER_EXT, depth,
+                GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+            ext->glGetFramebufferAttachmentParameteriv(
+                GL_FRAMEBUFFER_EXT, stencil,
+                GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+        }
+        GLint samples = 0;
+        glGetIntegerv(GL_SAMPLES, &samples);
+
+        GLenum format = GL_NONE;
+        if (componentType == GL_FLOAT && depthBits == 32)
+            format = stencilBits ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+        else if (depthBits == 24)
+            format = stencilBits ? GL_DEPTH24_STENCIL8_EXT
+                                 : GL_DEPTH_COMPONENT24;
+        else if (depthBits == 32 && !stencilBits)
+            format = GL_DEPTH_COMPONENT32;
+        else if (depthBits == 16 && !stencilBits)
+            format = GL_DEPTH_COMPONENT16;
+
+        _copyOpaqueDepth = format != GL_NONE && samples == 0;
+        if (!_copyOpaqueDepth)
+        {
+            std::cerr << "osgTransparency: the camera depth buffer can't be "
+                         "copied for the opaque depth test, occluded "
+                         "fragments won't be discarded"
+                      << std::endl;
+            format = GL_DEPTH_COMPONENT24;
+        }
+
+        _opaqueDepth = new osg::RenderBuffer(_maxWidth, _maxHeight, format);
+        const bool packed = format == GL_DEPTH32F_STENCIL8 ||
+                            format == GL_DEPTH24_STENCIL8_EXT;
+        _auxiliaryBuffer->setAttachment(
+            packed ? osg::Camera::PACKED_DEPTH_STENCIL_BUFFER
+                   : osg::Camera::DEPTH_BUFFER,
+            osg::FrameBufferAttachment(_opaqueDepth.get()));
+    }
+
+    /* Copies the area of the current tile from the depth buffer of the
+       camera framebuffer to the depth buffer of the capture passes.
+       The auxiliary framebuffer must be bound. */
+    void _setupOpaqueDepth(osg::State& state)
+    {
+        osg::GLExtensions* ext =
+            osg::GLExtensions::Get(state.getContextID(), true);
+        if (!_opaqueDepth)
+        {
+            ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
+            _createOpaqueDepthBuffer(ext);
+            _auxiliaryBuffer->apply(state);
+        }
+
+        /* Both the clear and the blit are affected by the depth mask, which
+           is restored afterwards to keep the OSG state tracking valid. */
+        GLboolean depthMask;
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+        glDepthMask(GL_TRUE);
+        if (_copyOpaqueDepth)
+        {
+            ext->glBindFramebuffer(GL_READ_FRAMEBUFFER_EXT, _previousFBO);
+            const GLint x = _tileViewport->x();
+            const GLint y = _tileViewport->y();
+            const GLint width = _tileViewport->width();
+            const GLint height = _tileViewport->height();
+            ext->glBlitFramebuffer(x, y, x + width, y + height, 0, 0, width,
+                                   height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            _auxiliaryBuffer->apply(state,
+                                    osg::FrameBufferObject::READ_FRAMEBUFFER);
+        }
+        else
+        {
+            const GLfloat farPlane = 1;
+            glClearBufferfv(GL_DEPTH, 0, &farPlane);
+        }
+        glDepthMask(depthMask);
+        checkGLErrors("After opaque depth copy");
+    }
+
+    /* Depth test of the passes that render the transparent geometry. */
+    void _setupCaptureDepthTest(Modes& modes, Attributes& attributes)
+    {
+        using namespace keywords;
+        if (!_parameters.getOpaqueDepthTest())
+        {
+            modes[GL_DEPTH] = OFF;
+            return;
+        }
+        /* Read-only test against the copy of the opaque depth buffer. The
+           same test must be applied to all the capture passes, otherwise
+           the fragment counts and the stored fragments won't match. */
+        modes[GL_DEPTH_TEST] = ON_OVERRIDE;
+        attributes[new osg::Depth(osg::Depth::LESS, 0, 1, false)] =
+            ON_OVERRIDE;
+    }
+
+    void _setAtomicCounter(osg::State& state, const GLuint value)
+    {
+        /* Maybe calling dirty on the underlying UIntArray is enough but
+           this method is used instead because it seems less expensive. */
+        osg::GLBufferObject* buffer =
+            _atomicBuffer->getGLBufferObject(state.getContextID());
+        if (buffer)
+        {
+            /* The atomic buffer has already been allocated so probably
+               it has also been used and the initial buffer data
+               changed. */
+            buffer->bindBuffer();
+            int flags = (GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                         GL_MAP_UNSYNCHRONIZED_BIT);
+            GLuint* ptr = (GLuint*)glMapBufferRange(GL_ATOMIC_COUNTER_BUFFER, 0,
+                                                    sizeof(GLuint), flags);
+            *ptr = value;
+            glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+            buffer->unbindBuffer();
+        }
+        else
+        {
+            osg::UIntArray* data =
+                static_cast<osg::UIntArray*>(_atomicBuffer->getBufferData(0));
+            if ((*data)[0] != value)
+            {
+                (*data)[0] = value;
+                data->dirty();
+            }
+        }
+    }
+
+    bool _usePrefixSum() const
+    {
+        return _parameters.getFragmentStorage() ==
+               Parameters::PREFIX_SUM_ARRAYS;
+    }
+
+    bool _usePages() const
+    {
+        return _parameters.getFragmentStorage() == Parameters::PAGED_LISTS;
+    }
+
+    bool _useKBuffer() const
+    {
+        return _parameters.getFragmentStorage() == Parameters::K_BUFFER;
+    }
+
+    /* Whether the fragment buffer is allocated with the atomic counter and
+       resized depending on the counter readbacks. */
+    bool _useAdaptiveCapacity() const
+    {
+        return _parameters.getFragmentStorage() == Parameters::LINKED_LISTS ||
+               _usePages();
+    }
+
+    /* Clears the first size bytes of the buffer of a texture or the whole
+       buffer if size is 0. */
+    void _clearTextureBuffer(osg::State& state, TextureBuffer& texture,
+                             const GLenum format, const GLenum sourceFormat,
+                             const GLuint* value, const size_t size = 0)
+    {
+        const unsigned int contextID = state.getContextID();
+        if (!texture.getGLBufferObject(contextID))
+            /* Applying the texture to create the buffer object */
+            state.applyTextureAttribute(_parameters.reservedTextureUnits,
+                                        &texture);
+
+        osg::GLBufferObject* buffer = texture.getGLBufferObject(contextID);
+        buffer->bindBuffer();
+        if (size)
+            glClearBufferSubData(GL_TEXTURE_BUFFER, format, 0, size,
+                                 sourceFormat, GL_UNSIGNED_INT, value);
+        else
+            glClearBufferData(GL_TEXTURE_BUFFER, format, sourceFormat,
+                              GL_UNSIGNED_INT, value);
+        buffer->unbindBuffer();
+    }
+
+    /* Number of upper bits of the alpha cut-off buffer with the
+       transparency. */
+    unsigned int _transparencyBits() const
+    {
+        return _parameters.getAlphaCutOffEncoding() ==
+                       Parameters::TRANSPARENCY_16_BITS
+                   ? 16
+                   : 8;
+    }
+
+    /* Compact records drop the next pointer, so they can only be used when
+       the storage layout doesn't need it. Split records drop it under the
+       same condition. */
+    bool _useCompactRecords() const
+    {
+        return _parameters.getFragmentEncoding() !=
+                   Parameters::FULL_RECORDS &&
+               _parameters.getFragmentStorage() != Parameters::LINKED_LISTS;
+    }
+
+    bool _useSplitRecords() const
+    {
+        return _parameters.getFragmentEncoding() ==
+                   Parameters::SPLIT_RECORDS &&
+               !_useKBuffer();
+    }
+
+    /* Number of 32-bit words per fragment record in the fragment buffer.
+       K-buffer records always use the compact layout. Deferred shading adds
+       the packed normal. Split records only keep the next index and the
+       depth in the fragment buffer. */
+    unsigned int _recordSize() const
+    {
+        if (_useKBuffer())
+            return 2;
+        const unsigned int next = _useCompactRecords() ? 0 : 1;
+        if (_useSplitRecords())
+            return next + 1;
+        return next + 2 + (_deferredShading ? 1 : 0);
+    }
+
+    /* Number of 32-bit words per fragment in the color buffer of split
+       records, 0 otherwise. */
+    unsigned int _colorRecordSize() const
+    {
+        if (!_useSplitRecords())
+            return 0;
+        return _deferredShading ? 2 : 1;
+    }
+
+    /* Total number of 32-bit words per fragment. */
+    unsigned int _fragmentWords() const
+    {
+        return _recordSize() + _colorRecordSize() + (_objectIDs ? 1 : 0);
+    }
+
+    /* Extension directives needed by the storage defines. They must
+       go right after #version. */
+    std::string _storageExtensions() const
+    {
+        if (_shaderStorage)
+            return "#extension GL_ARB_shader_storage_buffer_object : require\n";
+        return "";
+    }
+
+    std::string _storageDefines() const
+    {
+        std::string defines;
+        if (_useCompactRecords())
+            defines = "#define COMPACT_RECORDS\n#define DEPTH_WORD 0\n";
+        else
+            defines = "#define DEPTH_WORD 1\n";
+        if (_useSplitRecords())
+            defines += "#define SPLIT_RECORDS\n#define COLOR_WORD 0\n"
+                       "#define COLOR_RECORD_SIZE " +
+                       boost::lexical_cast<std::string>(_colorRecordSize()) +
+                       "\n";
+        else
+            defines += "#define COLOR_WORD (DEPTH_WORD + 1)\n";
+        defines += "#define RECORD_SIZE " +
+                   boost::lexical_cast<std::string>(_recordSize()) + "\n";
+        if (_deferredShading)
+            defines += "#define DEFERRED_SHADING\n"
+                       "#define NORMAL_WORD (COLOR_WORD + 1)\n";
+        if (_objectIDs)
+            defines += "#define OBJECT_IDS\n";
+        if (_shaderStorage)
+            defines += "#define SHADER_STORAGE_FRAGMENTS\n"
+                       "#define FRAGMENT_STORAGE_BINDING " +
+                       boost::lexical_cast<std::string>(
+                           FragmentData::FRAGMENT_STORAGE_BINDING) +
+                       "\n";
+
+        if (_usePrefixSum())
+            defines += "#define PREFIX_SUM_ARRAYS\n";
+        else if (_useKBuffer())
+            defines += "#define K_BUFFER_SIZE " +
+                       boost::lexical_cast<std::string>(
+                           _parameters.getKBufferSize()) +
+                       "\n";
+        else if (_usePages())
+            defines += "#define PAGED_LISTS\n#define FRAGMENTS_PER_PAGE " +
+                       boost::lexical_cast<std::string>(FRAGMENTS_PER_PAGE) +
+                       "u\n#define PAGE_FILL_BITS " +
+                       boost::lexical_cast<std::string>(PAGE_FILL_BITS) +
+                       "u\n";
+        return defines;
+    }
+
+    /* Number of fragments allocated for each increment of the atomic
+       counter. */
+    unsigned int _fragmentsPerAllocation() const
+    {
+        return _usePages() ? FRAGMENTS_PER_PAGE : 1;
+    }
+
+    void _countFragments(FragmentListOITBin* bin, osg::RenderInfo& renderInfo,
+                         osgUtil::RenderLeaf*& previous)
+    {
+        osg::State& state = *renderInfo.getState();
+        const unsigned int frame = state.getFrameStamp()->getFrameNumber();
+
+        if (GPU_TIMING)
+            _gpuTimer.start("count", frame);
+
+        glDrawBuffer(GL_NONE);
+
+        bin->render(renderInfo, previous, _countFragmentsStateSet.get(),
+                    _countFragmentsPrograms, _tileProjection.get());
+        ++_passes;
+
+        if (GPU_TIMING)
+            _gpuTimer.stop();
+        checkGLErrors("After fragment count");
+    }
+
+    /* Computes the exclusive prefix sum of the fragment counts into the
+       list head texture, resizes the fragment buffer if needed and resets
+       the fragment counts for the capture pass. */
+    void _computeFragmentOffsets(osg::RenderInfo& renderInfo)
+    {
+        osg::State& state = *renderInfo.getState();
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+        const unsigned int frame = state.getFrameStamp()->getFrameNumber();
+
+        if (GPU_TIMING)
+            _gpuTimer.start("prefix_sum", frame);
+
+        const unsigned int pixels =
+            (unsigned int)(_viewport->width() * _viewport->height());
+        const unsigned int blocks =
+            (pixels + PREFIX_SUM_BLOCK_SIZE - 1) / PREFIX_SUM_BLOCK_SIZE;
+        const unsigned int blockGroups =
+            std::min(blocks, MAX_COMPUTE_WORK_GROUPS);
+        const unsigned int groups[3] = {blockGroups, 1, blockGroups};
+
+        for (size_t i = 0; i != 3; ++i)
+        {
+            ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            state.apply(_prefixSumStateSets[i].get());
+            ext->glDispatchCompute(groups[i], 1, 1);
+        }
+        ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                             GL_BUFFER_UPDATE_BARRIER_BIT |
+                             GL_FRAMEBUFFER_BARRIER_BIT);
+        checkGLErrors("After prefix sum");
+
+        /* Reading back the total number of fragments. This stalls until the
+           count pass has finished, but it's the price to pay for allocating
+           exactly what's needed. */
+        GLuint total = 0;
+        osg::GLBufferObject* buffer = _blockSums->getGLBufferObject(contextID);
+        buffer->bindBuffer();
+        glGetBufferSubData(GL_TEXTURE_BUFFER, blocks * sizeof(GLuint),
+                           sizeof(GLuint), &total);
+        buffer->unbindBuffer();
+
+        /* In this mode the buffer is resized before the fragments are
+           stored, so overflows only happen if the memory budget doesn't
+           allow the total. The capture shader excludes the fragments
+           dropped from the per pixel counts. */
+        _updateFragmentCapacity(state, total, frame,
+                                std::numeric_limits<size_t>::max());
+
+        /* The atomic counter is not used by the capture shader in this mode,
+           but FragmentData::getNumFragments relies on it. */
+        _setAtomicCounter(state, total);
+
+        /* Clearing the fragment counts, they are used to assign the slots
+           inside each pixel array during the capture. */
+        _auxiliaryBuffer->apply(state);
+        GLuint colorui[] = {0, 0, 0, 0};
+        glClearBufferuiv(GL_COLOR, 1, colorui);
+
+        if (GPU_TIMING)
+            _gpuTimer.stop();
+        checkGLErrors("After fragment offsets");
+    }
+
+    /* Maximum number of fragment records that the shaders can address. */
+    size_t _fragmentBufferLimit() const
+    {
+        GLint texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        size_t limit = size_t(texels) / _recordSize();
+        if (_shaderStorage)
+        {
+            GLint64 bytes = 0;
+            glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &bytes);
+            limit = size_t(bytes) / (_recordSize() * sizeof(GLuint));
+        }
+        /* The colors of split records and the object IDs are always in
+           buffer textures */
+        if (_useSplitRecords())
+            limit = std::min(limit, size_t(texels) / _colorRecordSize());
+        if (_objectIDs)
+            limit = std::min(limit, size_t(texels));
+        return limit;
+    }
+
+    size_t _getFragmentCapacity() const
+    {
+        return _fragments->getTextureWidth() / _recordSize();
+    }
+
+    void _setFragmentCapacity(osg::State& state, size_t capacity)
+    {
+        capacity = std::min(capacity, _maxFragmentCapacity);
+        if (capacity == _getFragmentCapacity())
+            return;
+
+        resizeTextureBuffer(*_fragments, capacity * _recordSize(), state);
+        if (_useSplitRecords())
+            resizeTextureBuffer(*_fragmentColors,
+                                capacity * _colorRecordSize(), state);
+        if (_objectIDs)
+            resizeTextureBuffer(*_fragmentObjectIDs, capacity, state);
+        if (_usePages())
+            resizeTextureBuffer(*_pageLinks, capacity / FRAGMENTS_PER_PAGE,
+                                state);
+        _fragmentCapacity->set((unsigned int)capacity);
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+        _stats.capacity = capacity;
+        ++_stats.resizeCount;
+    }
+
+    /* Updates the statistics with the fragment count of a frame and applies
+       the resizing policy.
+       @param capacity The capacity that the fragment buffer had when the
+              fragments were captured. */
+    void _updateFragmentCapacity(osg::State& state, const size_t fragments,
+                                 const unsigned int frame,
+                                 const size_t capacity)
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+            _stats.lastFragmentCount = fragments;
+            _stats.lastFrame = frame;
+            if (fragments > capacity)
+            {
+                ++_stats.overflowCount;
+                _stats.lastOverflowFrame = frame;
+            }
+        }
+        if (fragments > capacity)
+        {
+            std::cerr << "osgTransparency: fragment buffer overflow in frame "
+                      << frame << ", " << fragments << " fragments for a "
+                      << "capacity of " << capacity << std::endl;
+        }
+
+        const size_t current = _getFragmentCapacity();
+        if (fragments > current * GROW_THRESHOLD)
+        {
+            _lowUsageReadbacks = 0;
+            _setFragmentCapacity(state, size_t(fragments * RESIZE_FACTOR));
+        }
+        else if (fragments < current * SHRINK_THRESHOLD &&
+                 current > MIN_FRAGMENT_CAPACITY)
+        {
+            if (++_lowUsageReadbacks >= SHRINK_DELAY)
+            {
+                _lowUsageReadbacks = 0;
+                _setFragmentCapacity(
+                    state, std::max(MIN_FRAGMENT_CAPACITY,
+                                    size_t(fragments * RESIZE_FACTOR)));
+            }
+        }
+        else
+            _lowUsageReadbacks = 0;
+    }
+
+    void _requestCounterReadback(osg::State& state)
+    {
+        const unsigned int contextID = state.getContextID();
+        osg::GLBufferObject* counter =
+            _atomicBuffer->getGLBufferObject(contextID);
+        if (!counter || _pendingReadbacks.size() == MAX_PENDING_READBACKS)
+            return;
+
+        osg::GLBufferObject* readback =
+            _counterReadback->getOrCreateGLBufferObject(contextID);
+        if (readback->isDirty())
+            readback->compileBuffer();
+
+        /* Readbacks complete in order, so the slots can be used in a round
+           robin fashion. */
+        const size_t slot =
+            _pendingReadbacks.empty()
+                ? 0
+                : (_pendingReadbacks.back().slot + 1) % MAX_PENDING_READBACKS;
+
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+        ext->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        ext->glBindBuffer(GL_COPY_READ_BUFFER, counter->getGLObjectID());
+        ext->glBindBuffer(GL_COPY_WRITE_BUFFER, readback->getGLObjectID());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                            slot * sizeof(GLuint), sizeof(GLuint));
+        ext->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        ext->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        Readback pending;
+        pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pending.slot = slot;
+        pending.frame = state.getFrameStamp()->getFrameNumber();
+        pending.capacity = _getFragmentCapacity();
+        _pendingReadbacks.push_back(pending);
+        checkGLErrors("After counter readback request");
+    }
+
+    /* Processes the readbacks that have completed without blocking. */
+    void _checkCounterReadbacks(osg::State& state)
+    {
+        const unsigned int contextID = state.getContextID();
+        while (!_pendingReadbacks.empty())
+        {
+            const Readback& pending = _pendingReadbacks.front();
+            const GLenum status = glClientWaitSync(pending.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED &&
+                status != GL_CONDITION_SATISFIED)
+                return;
+            glDeleteSync(pending.fence);
+
+            GLuint fragments = 0;
+            osg::GLBufferObject* readback =
+                _counterReadback->getGLBufferObject(contextID);
+            readback->bindBuffer();
+            glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER,
+                               pending.slot * sizeof(GLuint), sizeof(GLuint),
+                               &fragments);
+            readback->unbindBuffer();
+
+            const Readback result = pending;
+            _pendingReadbacks.pop_front();
+            _updateFragmentCapacity(state,
+                                    size_t(fragments) *
+                                        _fragmentsPerAllocation(),
+                                    result.frame, result.capacity);
+        }
+    }
+
+    void _discardCounterReadbacks()
+    {
+        for (const auto& pending : _pendingReadbacks)
+            glDeleteSync(pending.fence);
+        _pendingReadbacks.clear();
+    }
+
+    void _insertKBufferDepths(FragmentListOITBin* bin,
+                              osg::RenderInfo& renderInfo,
+                              osgUtil::RenderLeaf*& previous)
+    {
+        osg::State& state = *renderInfo.getState();
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+        const unsigned int frame = state.getFrameStamp()->getFrameNumber();
+
+        if (GPU_TIMING)
+            _gpuTimer.start("insert_depths", frame);
+
+        glDrawBuffer(GL_NONE);
+
+        bin->render(renderInfo, previous, _insertDepthsStateSet.get(),
+                    _insertDepthsPrograms, _tileProjection.get());
+        ++_passes;
+        /* The color pass needs the final depths of each pixel. */
+        ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        if (GPU_TIMING)
+            _gpuTimer.stop();
+        checkGLErrors("After K-buffer depth insertion");
+    }
+
     void _captureFragments(FragmentListOITBin* bin, osg::RenderInfo& renderInfo,
                            osgUtil::RenderLeaf*& previous)
     {
@@ -398,7 +1839,16 @@ private:
         glDrawBuffer(GL_NONE);
 
         bin->render(renderInfo, previous, _saveFragmentsStateSet.get(),
-                    _saveFragmentsPrograms);
+                    _saveFragmentsPrograms, _tileProjection.get());
+        ++_passes;
+        if (_shaderStorage)
+        {
+            /* The other buffers are read with texture fetches, which
+               are synchronized by the resolve passes. */
+            osg::GLExtensions* ext =
+                osg::GLExtensions::Get(state.getContextID(), true);
+            ext->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
 
         if (GPU_TIMING)
             _gpuTimer.stop();
@@ -411,15 +1861,12 @@ private:
         const unsigned int contextID = state.getContextID();
         osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
         const unsigned int frame = state.getFrameStamp()->getFrameNumber();
-        if (GPU_TIMING)
-            _gpuTimer.start("sort_and_display", frame);
-
         /* Display the sorted and composited per pixel list in batches
            depending on their fragment counts.
            The destination buffer must have a stencil buffer. */
         ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
-        glScissor(_camera->getViewport()->x(), _camera->getViewport()->y(),
-                  _viewport->width(), _viewport->height());
+        glScissor(_tileViewport->x(), _tileViewport->y(),
+                  _tileViewport->width(), _tileViewport->height());
 
         /* The following code only draws quads, so the projection and
            modelview matrices are reset. */
@@ -430,25 +1877,126 @@ private:
         for (unsigned int i = 8; i < MAX_FRAGMENTS_PER_LIST;
              rangeStart = i + 1, i <<= 1, ++index)
         {
+            /* Each batch is timed on its own to compare the sorting
+               algorithms of the different list lengths. */
+            if (GPU_TIMING)
+                _gpuTimer.start("sort_and_display_" +
+                                    boost::lexical_cast<std::string>(i),
+                                frame);
+
+            /* Selecting which pixels will be rendered in this batch. Each
+               batch marks its pixels with a different stencil value, so
+               the stencil only needs to be cleared once. The quads of the
+               batches without pixels are collapsed by the vertex shader
+               using the count histogram. */
+            _fragmentCountRange->set(rangeStart, i);
+            state.apply(_fragmentCountFilterStateSets[index].get());
             if (index == 0)
+            {
                 /* This is needed for the first list */
                 ext->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
-
-            /* Selecting which pixels will be rendered in this batch*/
-            _fragmentCountRange->set(rangeStart, i);
-            state.apply(_fragmentCountFilterStateSet);
-            glClearStencil(0x00);
-            glClear(GL_STENCIL_BUFFER_BIT);
+                glClearStencil(0x00);
+                glClear(GL_STENCIL_BUFFER_BIT);
+            }
             _quad->draw(renderInfo);
             checkGLErrors("After stencil pass");
 
             state.apply(_sortAndDisplayFragmentsStateSet[index].get());
             _quad->draw(renderInfo);
 
+            if (GPU_TIMING)
+                _gpuTimer.stop();
             checkGLErrors("After sort & composite batch");
         }
+    }
+
+    void _resolveWithCompute(osg::RenderInfo& renderInfo)
+    {
+        osg::State& state = *renderInfo.getState();
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+        const unsigned int frame = state.getFrameStamp()->getFrameNumber();
+
         if (GPU_TIMING)
+            _gpuTimer.start("bin_pixels", frame);
+
+        ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                             GL_TEXTURE_FETCH_BARRIER_BIT);
+        state.apply(_binPixelsStateSets[0].get());
+        ext->glDispatchCompute((_viewport->width() + 15) / 16,
+                               (_viewport->height() + 15) / 16, 1);
+        ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        state.apply(_binPixelsStateSets[1].get());
+        ext->glDispatchCompute(1, 1, 1);
+        ext->glMemoryBarrier(GL_COMMAND_BARRIER_BIT |
+                             GL_TEXTURE_FETCH_BARRIER_BIT);
+        checkGLErrors("After pixel binning");
+
+        if (GPU_TIMING)
+        {
             _gpuTimer.stop();
+            _gpuTimer.start("resolve", frame);
+        }
+
+        /* One indirect dispatch per fragment count range. The number of
+           work groups of each one was computed by the binning pass, so
+           the empty ranges cost nothing. */
+        osg::GLBufferObject* bins =
+            _countHistogram->getGLBufferObject(contextID);
+        ext->glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, bins->getGLObjectID());
+        for (size_t i = 0; i != MAX_FRAGMENT_COUNT_INTERVALS; ++i)
+        {
+            state.apply(_resolveListsStateSets[i].get());
+            glDispatchComputeIndirect(DISPATCH_COMMANDS_OFFSET +
+                                      i * 3 * sizeof(GLuint));
+        }
+        ext->glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+        ext->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        checkGLErrors("After list resolve");
+
+        if (GPU_TIMING)
+        {
+            _gpuTimer.stop();
+            _gpuTimer.start("display", frame);
+        }
+
+        ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
+        glScissor(_tileViewport->x(), _tileViewport->y(),
+                  _tileViewport->width(), _tileViewport->height());
+        state.applyProjectionMatrix(0);
+        state.applyModelViewMatrix(0);
+        state.apply(_displayResolvedStateSet.get());
+        _quad->draw(renderInfo);
+
+        if (GPU_TIMING)
+            _gpuTimer.stop();
+        checkGLErrors("After resolved list display");
+    }
+
+    void _compositeKBuffer(osg::RenderInfo& renderInfo)
+    {
+        osg::State& state = *renderInfo.getState();
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+        const unsigned int frame = state.getFrameStamp()->getFrameNumber();
+        if (GPU_TIMING)
+            _gpuTimer.start("composite", frame);
+
+        /* The fragments of each pixel are already sorted, so all pixels
+           can be composited in a single pass. */
+        ext->glBindFramebuffer(GL_FRAMEBUFFER_EXT, _previousFBO);
+        glScissor(_tileViewport->x(), _tileViewport->y(),
+                  _tileViewport->width(), _tileViewport->height());
+        ext->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        state.applyProjectionMatrix(0);
+        state.applyModelViewMatrix(0);
+        state.apply(_compositeKBufferStateSet.get());
+        _quad->draw(renderInfo);
+
+        if (GPU_TIMING)
+            _gpuTimer.stop();
+        checkGLErrors("After K-buffer composite");
     }
 
     void _postDraw(osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous)
@@ -465,23 +2013,20 @@ private:
         assert(*currentState == *_oldState);
 #endif
         checkGLErrors("After post-draw");
-        if (GPU_TIMING)
-        {
-            _gpuTimer.checkQueries();
-            _gpuTimer.reportCompleted(std::cout);
-        }
     }
 
     bool _valid(osg::Camera* camera)
     {
         unsigned int width = (unsigned int)camera->getViewport()->width();
         unsigned int height = (unsigned int)camera->getViewport()->height();
-        return _camera == camera && _maxWidth >= width && _maxHeight >= height;
+        return _camera == camera && _maxScreenWidth >= width &&
+               _maxScreenHeight >= height;
     }
 
     void _createBuffersAndTextures()
     {
         _auxiliaryBuffer = new osg::FrameBufferObject();
+        _opaqueDepth = 0;
 
         _fragmentLists =
             createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight,
@@ -492,10 +2037,85 @@ private:
                                                  GL_R32UI, GL_RED_INTEGER);
 
         _fragments = new TextureBuffer();
-        _fragments->setTextureWidth(_maxWidth * _maxHeight * 3 *
-                                    MEAN_FRAGMENTS_PER_PIXEL);
+        /* In prefix sum mode the buffer is resized as needed every frame,
+           so the initial size is just a guess. */
+        const unsigned int fragmentsPerPixel =
+            _usePrefixSum() ? 1 : _useKBuffer() ? _parameters.getKBufferSize()
+                                                : MEAN_FRAGMENTS_PER_PIXEL;
+        _fragments->setTextureWidth(
+            std::min(size_t(_maxWidth) * _maxHeight * fragmentsPerPixel,
+                     _maxFragmentCapacity) *
+            _recordSize());
         _fragments->setInternalFormat(GL_R32UI);
         _fragments->setSubloadCallback(new SubloadCallback());
+        if (_shaderStorage)
+            _fragments->bindToShaderStorage(
+                FragmentData::FRAGMENT_STORAGE_BINDING);
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+            _stats.capacity = _getFragmentCapacity();
+        }
+
+        if (_useKBuffer())
+        {
+            _tailAccumulators = new TextureBuffer();
+            _tailAccumulators->setTextureWidth(_maxWidth * _maxHeight *
+                                               TAIL_WORDS);
+            _tailAccumulators->setInternalFormat(GL_R32UI);
+            _tailAccumulators->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (!_useKBuffer())
+        {
+            _countHistogram = new TextureBuffer();
+            _countHistogram->setTextureWidth(
+                _computeResolve
+                    ? PIXEL_BINS_HEADER_WORDS + _maxWidth * _maxHeight
+                    : MAX_FRAGMENT_COUNT_INTERVALS);
+            _countHistogram->setInternalFormat(GL_R32UI);
+            _countHistogram->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (_useSplitRecords())
+        {
+            _fragmentColors = new TextureBuffer();
+            _fragmentColors->setTextureWidth(_getFragmentCapacity() *
+                                             _colorRecordSize());
+            _fragmentColors->setInternalFormat(GL_R32UI);
+            _fragmentColors->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (_objectIDs)
+        {
+            _fragmentObjectIDs = new TextureBuffer();
+            _fragmentObjectIDs->setTextureWidth(_getFragmentCapacity());
+            _fragmentObjectIDs->setInternalFormat(GL_R32UI);
+            _fragmentObjectIDs->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (_usePages())
+        {
+            _pageLinks = new TextureBuffer();
+            _pageLinks->setTextureWidth(_getFragmentCapacity() /
+                                        FRAGMENTS_PER_PAGE);
+            _pageLinks->setInternalFormat(GL_R32UI);
+            _pageLinks->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (_usePrefixSum())
+        {
+            _blockSums = new TextureBuffer();
+            const unsigned int blocks =
+                (_maxWidth * _maxHeight + PREFIX_SUM_BLOCK_SIZE - 1) /
+                PREFIX_SUM_BLOCK_SIZE;
+            _blockSums->setTextureWidth(blocks + 1);
+            _blockSums->setInternalFormat(GL_R32UI);
+            _blockSums->setSubloadCallback(new SubloadCallback());
+        }
+
+        if (_computeResolve)
+            _resolvedColors =
+                createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight);
 
         if (_parameters.isAlphaCutOffEnabled())
         {
@@ -508,8 +2128,26 @@ private:
     void _createStateSets()
     {
         _viewport = new osg::Viewport(0, 0, 0, 0);
+        _tileViewport = new osg::Viewport(0, 0, 0, 0);
         _lowerLeftCorner = new osg::Uniform("corner", osg::Vec2(0, 0));
+        _bufferWidth = new osg::Uniform("bufferWidth", _maxWidth);
+        _viewportSize = new osg::Uniform("size", 0, 0);
         _createFragmentCollectionStateSet();
+        if (_usePrefixSum())
+        {
+            _createFragmentCountStateSet();
+            _createPrefixSumStateSets();
+        }
+        if (_useKBuffer())
+        {
+            _createKBufferStateSets();
+            return;
+        }
+        if (_computeResolve)
+        {
+            _createComputeResolveStateSets();
+            return;
+        }
         _createFragmentCountFilteringState();
         _createSortAndDisplayStateSets();
     }
@@ -524,7 +2162,7 @@ private:
 
         _saveFragmentsStateSet = new osg::StateSet();
         modes[GL_CULL_FACE] = OFF_OVERRIDE;
-        modes[GL_DEPTH] = OFF;
+        _setupCaptureDepthTest(modes, attributes);
         attributes[_viewport] = ON_OVERRIDE;
         osg::UIntArray* atomic = new osg::UIntArray();
         atomic->push_back(0);
@@ -544,8 +2182,15 @@ private:
         ++texUnit;
         ++imgUnit;
 
-        _fragments->bindToImageUnit(imgUnit, osg::Texture::WRITE_ONLY);
+        /* The K-buffer depths are updated with atomic operations */
+        _fragments->bindToImageUnit(imgUnit, _useKBuffer()
+                                                 ? osg::Texture::READ_WRITE
+                                                 : osg::Texture::WRITE_ONLY);
         uniforms.insert(new osg::Uniform("fragmentBuffer", imgUnit));
+        _fragmentCapacity =
+            new osg::Uniform("fragmentCapacity",
+                             (unsigned int)_getFragmentCapacity());
+        uniforms.insert(_fragmentCapacity);
         _saveFragmentsStateSet->setTextureAttribute(texUnit, _fragments);
         ++texUnit;
         ++imgUnit;
@@ -556,6 +2201,62 @@ private:
         ++texUnit;
         ++imgUnit;
 
+        if (_useKBuffer())
+        {
+            _tailAccumulators->bindToImageUnit(TAIL_IMAGE_UNIT,
+                                               osg::Texture::READ_WRITE);
+            uniforms.insert(new osg::Uniform("tailBuffer", TAIL_IMAGE_UNIT));
+            uniforms.insert(_bufferWidth);
+            _saveFragmentsStateSet->setTextureAttribute(texUnit,
+                                                        _tailAccumulators);
+            ++texUnit;
+        }
+
+        if (!_useKBuffer())
+        {
+            _countHistogram->bindToImageUnit(COUNT_HISTOGRAM_IMAGE_UNIT,
+                                             osg::Texture::READ_WRITE);
+            uniforms.insert(new osg::Uniform("countHistogram",
+                                             COUNT_HISTOGRAM_IMAGE_UNIT));
+            _saveFragmentsStateSet->setTextureAttribute(texUnit,
+                                                        _countHistogram);
+            ++texUnit;
+        }
+
+        if (_usePages())
+        {
+            _pageLinks->bindToImageUnit(PAGE_LINKS_IMAGE_UNIT,
+                                        osg::Texture::WRITE_ONLY);
+            uniforms.insert(
+                new osg::Uniform("pageLinks", PAGE_LINKS_IMAGE_UNIT));
+            _saveFragmentsStateSet->setTextureAttribute(texUnit, _pageLinks);
+            ++texUnit;
+        }
+
+        if (_useSplitRecords())
+        {
+            const int unit = _usePages() ? SPLIT_COLORS_PAGED_IMAGE_UNIT
+                                         : SPLIT_COLORS_IMAGE_UNIT;
+            _fragmentColors->bindToImageUnit(unit, osg::Texture::WRITE_ONLY);
+            uniforms.insert(new osg::Uniform("fragmentColors", unit));
+            _saveFragmentsStateSet->setTextureAttribute(texUnit,
+                                                        _fragmentColors);
+            ++texUnit;
+        }
+
+        if (_objectIDs)
+        {
+            _fragmentObjectIDs->bindToImageUnit(OBJECT_IDS_IMAGE_UNIT,
+                                                osg::Texture::WRITE_ONLY);
+            uniforms.insert(
+                new osg::Uniform("objectIDs", OBJECT_IDS_IMAGE_UNIT));
+            /* Default for the drawables without an object ID */
+            uniforms.insert(new osg::Uniform("objectID", 0u));
+            _saveFragmentsStateSet->setTextureAttribute(texUnit,
+                                                        _fragmentObjectIDs);
+            ++texUnit;
+        }
+
         if (_parameters.isAlphaCutOffEnabled())
         {
             _minTransparency = new osg::Uniform("minTransparency", 0.f);
@@ -575,37 +2276,157 @@ private:
         /* The shaders are setup later inside _updatePrograms. */
     }
 
-    void _createFragmentCountFilteringState()
+    void _createFragmentCountStateSet()
     {
         using namespace keywords;
         Modes modes;
         Attributes attributes;
         Uniforms uniforms;
+
+        /* This state set must be created after the fragment collection one
+           because the image unit of each texture is set there. */
+        _countFragmentsStateSet = new osg::StateSet();
+        modes[GL_CULL_FACE] = OFF_OVERRIDE;
+        _setupCaptureDepthTest(modes, attributes);
+        attributes[_viewport] = ON_OVERRIDE;
+        uniforms.insert(new osg::Uniform("fragmentCounts", 0));
+        _countFragmentsStateSet->setTextureAttribute(
+            _parameters.reservedTextureUnits, _fragmentCounts);
+        setupStateSet(_countFragmentsStateSet, modes, attributes, uniforms);
+
+        /* The shaders are setup later inside _updatePrograms. */
+    }
+
+    void _createPrefixSumStateSets()
+    {
         std::map<std::string, std::string> vars;
 
+        _blockSums->bindToImageUnit(PREFIX_SUM_BLOCK_SUMS_IMAGE_UNIT,
+                                    osg::Texture::READ_WRITE);
+
+        const char* stages[] = {"SCAN_BLOCKS", "SCAN_BLOCK_SUMS",
+                                "ADD_BLOCK_OFFSETS"};
+        for (size_t i = 0; i != 3; ++i)
+        {
+            osg::StateSet* stateSet = new osg::StateSet();
+            _prefixSumStateSets[i] = stateSet;
+
+            /* The texture units are irrelevant, the textures only need to be
+               applied to get their images bound. */
+            int texUnit = _parameters.reservedTextureUnits;
+            stateSet->setTextureAttribute(texUnit++, _fragmentCounts);
+            stateSet->setTextureAttribute(texUnit++, _fragmentLists);
+            stateSet->setTextureAttribute(texUnit++, _blockSums);
+            stateSet->addUniform(new osg::Uniform("fragmentCounts", 0));
+            stateSet->addUniform(new osg::Uniform("listHead", 2));
+            stateSet->addUniform(
+                new osg::Uniform("blockSums",
+                                 PREFIX_SUM_BLOCK_SUMS_IMAGE_UNIT));
+            stateSet->addUniform(_viewportSize);
+
+            vars["DEFINES"] = std::string("#define ") + stages[i] + "\n";
+            const std::string code =
+                "//prefix_sum.comp\n" +
+                readSourceAndReplaceVariables("fragment_list/prefix_sum.comp",
+                                              vars);
+            osg::Program* program = new osg::Program();
+            program->addShader(new osg::Shader(osg::Shader::COMPUTE, code));
+            stateSet->setAttributeAndModes(program);
+        }
+    }
+
+    void _createKBufferStateSets()
+    {
+        using namespace keywords;
+        Modes modes;
+        Attributes attributes;
+        Uniforms uniforms;
+        std::map<std::string, std::string> vars;
+
+        /* This state set must be created after the fragment collection one
+           because the image unit of each texture is set there. */
+        _insertDepthsStateSet = new osg::StateSet();
+        modes[GL_CULL_FACE] = OFF_OVERRIDE;
+        _setupCaptureDepthTest(modes, attributes);
+        attributes[_viewport] = ON_OVERRIDE;
+        /* Image unit assigned in _createFragmentCollectionStateSet */
+        uniforms.insert(new osg::Uniform("fragmentBuffer", 1));
+        uniforms.insert(_bufferWidth);
+        _insertDepthsStateSet->setTextureAttribute(
+            _parameters.reservedTextureUnits, _fragments);
+        setupStateSet(_insertDepthsStateSet, modes, attributes, uniforms);
+        /* The shaders are setup later inside _updatePrograms. */
+
+        modes.clear();
+        attributes.clear();
+        uniforms.clear();
         osg::StateSet* stateSet = new osg::StateSet();
-        _fragmentCountFilterStateSet = stateSet;
+        _compositeKBufferStateSet = stateSet;
+        modes[GL_CULL_FACE] = OFF_OVERRIDE;
+        modes[GL_BLEND] = ON;
+        attributes[new osg::Depth(osg::Depth::ALWAYS, 0, 0, false)];
+        attributes[new osg::BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA)] = ON;
+        attributes[new osg::BlendEquation(FUNC_ADD)] = ON;
+        attributes[_tileViewport] = ON_OVERRIDE;
+        uniforms.insert(_lowerLeftCorner);
+        uniforms.insert(_bufferWidth);
+        setupStateSet(stateSet, modes, attributes, uniforms);
+
+        vars["DEFINES"] = _storageDefines();
+        const std::string code =
+            "//kbuffer_composite.frag\n" +
+            readSourceAndReplaceVariables(
+                "fragment_list/kbuffer_composite.frag", vars);
+        addProgram(stateSet, _vertex_shaders = strings(BYPASS_VERT_SHADER),
+                   _fragment_shaders = strings(code));
+        setupTexture("fragmentBuffer", 0, *stateSet, _fragments);
+        setupTexture("tailBuffer", 1, *stateSet, _tailAccumulators);
+    }
+
+    void _createFragmentCountFilteringState()
+    {
+        using namespace keywords;
+        Modes modes;
+        Attributes attributes;
+        Uniforms uniforms;
+        std::map<std::string, std::string> vars;
+
         modes[GL_CULL_FACE] = OFF_OVERRIDE;
         modes[GL_DEPTH] = OFF;
         attributes[new osg::ColorMask(false, false, false, false)] = ON;
-        attributes[_camera->getViewport()] = ON_OVERRIDE;
+        attributes[_tileViewport] = ON_OVERRIDE;
         _fragmentCountRange = new osg::Uniform("fragmentCountRange", 0u, 0u);
         uniforms.insert(_fragmentCountRange);
         uniforms.insert(_lowerLeftCorner);
-        osg::Stencil* stencil = new osg::Stencil;
-        stencil->setFunction(osg::Stencil::ALWAYS, 1, 0);
-        stencil->setOperation(osg::Stencil::KEEP, osg::Stencil::KEEP,
-                              osg::Stencil::REPLACE);
-        attributes[stencil] = ON;
-        setupStateSet(stateSet, modes, attributes, uniforms);
-        std::string code =
+        const std::string vertexCode =
+            "//count_range_quad.vert\n" +
+            readSourceAndReplaceVariables("fragment_list/count_range_quad.vert",
+                                          vars);
+        const std::string code =
             "//fragment_count_filtering.frag\n" +
             readSourceAndReplaceVariables(
                 "fragment_list/fragment_count_filtering.frag", vars);
 
-        addProgram(stateSet, _vertex_shaders = strings(BYPASS_VERT_SHADER),
-                   _fragment_shaders = strings(code));
-        setupTexture("fragmentCounts", 0, *stateSet, _fragmentCounts);
+        size_t index = 0;
+        for (unsigned int i = 8; i < MAX_FRAGMENTS_PER_LIST; i <<= 1, ++index)
+        {
+            osg::StateSet* stateSet = new osg::StateSet();
+            _fragmentCountFilterStateSets[index] = stateSet;
+
+            /* The pixels of the batch are marked with its index + 1 */
+            osg::Stencil* stencil = new osg::Stencil;
+            stencil->setFunction(osg::Stencil::ALWAYS, index + 1, 0xFF);
+            stencil->setOperation(osg::Stencil::KEEP, osg::Stencil::KEEP,
+                                  osg::Stencil::REPLACE);
+            setupStateSet(stateSet, modes, attributes, uniforms);
+            stateSet->setAttributeAndModes(stencil, ON);
+            stateSet->addUniform(new osg::Uniform("countRange", int(index)));
+
+            addProgram(stateSet, _vertex_shaders = strings(vertexCode),
+                       _fragment_shaders = strings(code));
+            setupTexture("fragmentCounts", 0, *stateSet, _fragmentCounts);
+            setupTexture("countHistogram", 1, *stateSet, _countHistogram);
+        }
     }
 
     void _createSortAndDisplayStateSets()
@@ -624,12 +2445,27 @@ private:
         attributes[new osg::Depth(osg::Depth::ALWAYS, 0, 0, false)];
         attributes[new osg::BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA)] = ON;
         attributes[new osg::BlendEquation(FUNC_ADD)] = ON;
-        attributes[_camera->getViewport()] = ON_OVERRIDE;
-        osg::Stencil* stencil = new osg::Stencil;
-        stencil->setFunction(osg::Stencil::NOTEQUAL, 0, 0xFF);
-        stencil->setWriteMask(0);
-        attributes[stencil] = ON;
+        attributes[_tileViewport] = ON_OVERRIDE;
         uniforms.insert(_lowerLeftCorner);
+        if (_deferredShading)
+        {
+            _minTransmittance = new osg::Uniform("minTransmittance", 0.f);
+            uniforms.insert(_minTransmittance);
+        }
+        if (_parameters.isPartialSortEnabled())
+        {
+            _maxOpacity = new osg::Uniform("maxOpacity", 1.f);
+            uniforms.insert(_maxOpacity);
+        }
+
+        vars["EXTENSIONS"] = _storageExtensions();
+        vars["DEFINES"] = _storageDefines();
+        if (_parameters.isPartialSortEnabled())
+            vars["DEFINES"] += "#define EARLY_TERMINATION\n";
+        const std::string vertexCode =
+            "//count_range_quad.vert\n" +
+            readSourceAndReplaceVariables("fragment_list/count_range_quad.vert",
+                                          vars);
 
         size_t index = 0;
         for (unsigned int i = 8; i < MAX_FRAGMENTS_PER_LIST; i <<= 1, ++index)
@@ -637,19 +2473,152 @@ private:
             osg::StateSet* stateSet = new osg::StateSet();
             _sortAndDisplayFragmentsStateSet[index] = stateSet;
 
+            /* Only the pixels marked by the filtering pass of this batch
+               are processed */
+            osg::Stencil* stencil = new osg::Stencil;
+            stencil->setFunction(osg::Stencil::EQUAL, index + 1, 0xFF);
+            stencil->setWriteMask(0);
             setupStateSet(stateSet, modes, attributes, uniforms);
+            stateSet->setAttributeAndModes(stencil, ON);
+            stateSet->addUniform(new osg::Uniform("countRange", int(index)));
             vars["MAX_FRAGMENTS_PER_LIST"] =
                 boost::lexical_cast<std::string>(i);
+            if (i <= _parameters.getSortingNetworkMaxSize())
+                vars["SORTING_NETWORK"] =
+                    "#define USE_SORTING_NETWORK\n" +
+                    createSortingNetworkShader(createSortingNetwork(i),
+                                               "sortingNetwork");
+            else
+                vars["SORTING_NETWORK"] = "";
             const std::string code =
                 "//sort_and_display.frag\n" +
                 readSourceAndReplaceVariables(
                     "fragment_list/sort_and_display.frag", vars);
-            addProgram(stateSet, _vertex_shaders = strings(BYPASS_VERT_SHADER),
-                       _fragment_shaders = strings(code));
+            if (_deferredShading)
+                addProgram(stateSet, _vertex_shaders = strings(vertexCode),
+                           _fragment_shaders = strings(
+                               code, _parameters._impl->deferredShadingSource));
+            else
+                addProgram(stateSet, _vertex_shaders = strings(vertexCode),
+                           _fragment_shaders = strings(code));
+
+            setupTexture("listHead", 0, *stateSet, _fragmentLists);
+            setupTexture("fragmentBuffer", 1, *stateSet, _fragments);
+            if (_usePrefixSum())
+                setupTexture("fragmentCounts", 2, *stateSet, _fragmentCounts);
+            if (_usePages())
+                setupTexture("pageLinks", 3, *stateSet, _pageLinks);
+            setupTexture("countHistogram", 4, *stateSet, _countHistogram);
+            if (_useSplitRecords())
+                setupTexture("fragmentColors", 5, *stateSet, _fragmentColors);
+        }
+    }
+
+    void _createComputeResolveStateSets()
+    {
+        using namespace keywords;
+        Modes modes;
+        Attributes attributes;
+        Uniforms uniforms;
+        std::map<std::string, std::string> vars;
+
+        /* The pixel bins buffer image unit is set in the fragment
+           collection state set. */
+        vars["COUNT_RANGES"] =
+            boost::lexical_cast<std::string>(MAX_FRAGMENT_COUNT_INTERVALS);
+        vars["MAX_THREAD_LIST_LENGTH"] =
+            boost::lexical_cast<std::string>(MAX_THREAD_LIST_LENGTH);
+        vars["PIXELS_PER_GROUP"] =
+            boost::lexical_cast<std::string>(RESOLVE_PIXELS_PER_GROUP);
+
+        const char* stages[] = {"BIN_PIXELS", "BUILD_COMMANDS"};
+        for (size_t i = 0; i != 2; ++i)
+        {
+            osg::StateSet* stateSet = new osg::StateSet();
+            _binPixelsStateSets[i] = stateSet;
+
+            setupTexture("fragmentCounts", 0, *stateSet, _fragmentCounts);
+            stateSet->setTextureAttribute(1, _countHistogram);
+            stateSet->addUniform(
+                new osg::Uniform("pixelBins", COUNT_HISTOGRAM_IMAGE_UNIT));
+            stateSet->addUniform(_viewportSize);
+
+            vars["DEFINES"] = std::string("#define ") + stages[i] + "\n";
+            const std::string code =
+                "//bin_pixels.comp\n" +
+                readSourceAndReplaceVariables("fragment_list/bin_pixels.comp",
+                                              vars);
+            osg::Program* program = new osg::Program();
+            program->addShader(new osg::Shader(osg::Shader::COMPUTE, code));
+            stateSet->setAttributeAndModes(program);
+        }
+
+        _resolvedColors->bindToImageUnit(RESOLVED_COLORS_IMAGE_UNIT,
+                                         osg::Texture::WRITE_ONLY);
+        size_t index = 0;
+        for (unsigned int i = 8; i <= MAX_FRAGMENTS_PER_LIST; i <<= 1, ++index)
+        {
+            osg::StateSet* stateSet = new osg::StateSet();
+            _resolveListsStateSets[index] = stateSet;
+
+            std::string defines = _storageDefines();
+            vars["SORTING_NETWORK"] = "";
+            if (i <= MAX_THREAD_LIST_LENGTH)
+            {
+                defines += "#define THREAD_PER_LIST\n";
+                if (i <= _parameters.getSortingNetworkMaxSize())
+                    vars["SORTING_NETWORK"] =
+                        "#define USE_SORTING_NETWORK\n" +
+                        createSortingNetworkShader(createSortingNetwork(i),
+                                                   "sortingNetwork");
+            }
+            vars["DEFINES"] = defines;
+            vars["COUNT_RANGE"] = boost::lexical_cast<std::string>(index);
+            vars["MAX_FRAGMENTS_PER_LIST"] =
+                boost::lexical_cast<std::string>(i);
+            const std::string code =
+                "//resolve_lists.comp\n" +
+                readSourceAndReplaceVariables(
+                    "fragment_list/resolve_lists.comp", vars);
+            osg::Program* program = new osg::Program();
+            program->addShader(new osg::Shader(osg::Shader::COMPUTE, code));
+            stateSet->setAttributeAndModes(program);
 
             setupTexture("listHead", 0, *stateSet, _fragmentLists);
             setupTexture("fragmentBuffer", 1, *stateSet, _fragments);
+            setupTexture("fragmentCounts", 2, *stateSet, _fragmentCounts);
+            if (_usePages())
+                setupTexture("pageLinks", 3, *stateSet, _pageLinks);
+            setupTexture("pixelBins", 4, *stateSet, _countHistogram);
+            stateSet->setTextureAttribute(5, _resolvedColors);
+            if (_useSplitRecords())
+                setupTexture("fragmentColors", 6, *stateSet, _fragmentColors);
+            stateSet->addUniform(
+                new osg::Uniform("resolvedColors", RESOLVED_COLORS_IMAGE_UNIT));
         }
+
+        _displayResolvedStateSet = new osg::StateSet();
+        modes[GL_CULL_FACE] = OFF_OVERRIDE;
+        modes[GL_BLEND] = ON;
+        modes[GL_STENCIL_TEST] = OFF;
+        attributes[new osg::Depth(osg::Depth::ALWAYS, 0, 0, false)];
+        attributes[new osg::BlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA)] = ON;
+        attributes[new osg::BlendEquation(FUNC_ADD)] = ON;
+        attributes[_tileViewport] = ON_OVERRIDE;
+        uniforms.insert(_lowerLeftCorner);
+        setupStateSet(_displayResolvedStateSet, modes, attributes, uniforms);
+        vars.clear();
+        const std::string code =
+            "//display_resolved.frag\n" +
+            readSourceAndReplaceVariables("fragment_list/display_resolved.frag",
+                                          vars);
+        addProgram(_displayResolvedStateSet,
+                   _vertex_shaders = strings(BYPASS_VERT_SHADER),
+                   _fragment_shaders = strings(code));
+        setupTexture("fragmentCounts", 0, *_displayResolvedStateSet,
+                     _fragmentCounts);
+        setupTexture("resolvedColors", 1, *_displayResolvedStateSet,
+                     _resolvedColors);
     }
 
     void _updatePrograms(const ProgramMap& extraShaders)
@@ -660,16 +2629,55 @@ private:
         std::map<std::string, std::string> vars;
         vars.clear();
 
+        std::string defines;
         if (_parameters.isAlphaCutOffEnabled())
-            vars["DEFINES"] = "#define USE_ALPHA_CUTOFF\n";
-
-        code =
-            "//save_fragments.frag\n" +
-            readSourceAndReplaceVariables("fragment_list/save_fragments.frag",
-                                          vars);
+            defines += "#define USE_ALPHA_CUTOFF\n#define TRANSPARENCY_BITS " +
+                       boost::lexical_cast<std::string>(_transparencyBits()) +
+                       "\n";
+        defines += _storageDefines();
+        /* Fragments rejected by this predicate are neither counted nor
+           stored. The count and save passes must agree on it, otherwise a
+           stored fragment that wasn't counted overflows its pixel range. */
+        defines += "#define REJECT_FRAGMENT(depth) ((depth) > 1.0)\n";
+        vars["EXTENSIONS"] = _storageExtensions();
+        vars["DEFINES"] = defines;
+        vars["COUNT_RANGES"] =
+            boost::lexical_cast<std::string>(MAX_FRAGMENT_COUNT_INTERVALS);
+        /* The opaque depth test must be done before any image is written. */
+        if (_parameters.getOpaqueDepthTest())
+            vars["EARLY_FRAGMENT_TESTS"] = "layout(early_fragment_tests) in;";
+
+        if (_useKBuffer())
+        {
+            code = "//kbuffer_depths.frag\n" +
+                   readSourceAndReplaceVariables(
+                       "fragment_list/kbuffer_depths.frag", vars);
+            addPrograms(extraShaders, &_insertDepthsPrograms,
+                        _vertex_shaders = strings(sm("shadeVertex();")),
+                        _fragment_shaders = strings(code));
+            code = "//kbuffer_colors.frag\n" +
+                   readSourceAndReplaceVariables(
+                       "fragment_list/kbuffer_colors.frag", vars);
+        }
+        else
+        {
+            code = "//save_fragments.frag\n" +
+                   readSourceAndReplaceVariables(
+                       "fragment_list/save_fragments.frag", vars);
+        }
         addPrograms(extraShaders, &_saveFragmentsPrograms,
                     _vertex_shaders = strings(sm("shadeVertex();")),
                     _fragment_shaders = strings(code));
+
+        if (_usePrefixSum())
+        {
+            code = "//count_fragments.frag\n" +
+                   readSourceAndReplaceVariables(
+                       "fragment_list/count_fragments.frag", vars);
+            addPrograms(extraShaders, &_countFragmentsPrograms,
+                        _vertex_shaders = strings(sm("shadeVertex();")),
+                        _fragment_shaders = strings(code));
+        }
     }
 
     void _testAndInit(FragmentListOITBin* bin, osg::RenderInfo& renderInfo)
@@ -678,23 +2686,31 @@ private:
         osg::Viewport* viewport = camera->getViewport();
         if (!_valid(camera))
         {
+            _discardCounterReadbacks();
+            _lowUsageReadbacks = 0;
             _camera = camera;
-            _maxWidth = (unsigned int)viewport->width();
-            _maxHeight = (unsigned int)viewport->height();
+            _maxScreenWidth = (unsigned int)viewport->width();
+            _maxScreenHeight = (unsigned int)viewport->height();
             osg::Vec2d maxViewport;
             if (_camera->getUserValue("max_viewport_hint", maxViewport))
             {
-                _maxWidth = std::max(_maxWidth, (unsigned int)maxViewport.x());
-                _maxHeight =
-                    std::max(_maxHeight, (unsigned int)maxViewport.y());
+                _maxScreenWidth =
+                    std::max(_maxScreenWidth, (unsigned int)maxViewport.x());
+                _maxScreenHeight =
+                    std::max(_maxScreenHeight, (unsigned int)maxViewport.y());
             }
+            _chooseTileSize(_maxScreenWidth, _maxScreenHeight);
+            /* The K-buffer size is fixed by the tile size. */
+            const size_t limit = _fragmentBufferLimit();
+            if (!_useKBuffer() && limit)
+                _maxFragmentCapacity = std::min(_maxFragmentCapacity, limit);
 
             _createBuffersAndTextures();
             _createStateSets();
             _quad = createQuad();
         }
-        _viewport->width() = viewport->width();
-        _viewport->height() = viewport->height();
+        _updateTiles((unsigned int)viewport->width(),
+                     (unsigned int)viewport->height());
 
         ProgramMap newShaders;
         updateProgramMap(*bin->_extraShaders, _extraShaders, newShaders);
@@ -702,10 +2718,15 @@ private:
         if (!newShaders.empty())
             _updatePrograms(newShaders);
 
-        _lowerLeftCorner->set(osg::Vec2(viewport->x(), viewport->y()));
+        _checkCounterReadbacks(*renderInfo.getState());
+
         if (_parameters.isAlphaCutOffEnabled())
             _minTransparency->set(
                 std::max(0.f, 1 - _parameters._impl->alphaCutOffThreshold));
+        if (_deferredShading)
+            _minTransmittance->set(_parameters._impl->minTransmittance);
+        if (_maxOpacity)
+            _maxOpacity->set(_parameters._impl->partialSortThreshold);
     }
 };
 
@@ -714,25 +2735,102 @@ private:
 */
 
 FragmentListOITBin::_Impl::Context& FragmentListOITBin::_Impl::getContext(
-    osg::State* state, const ParametersPtr& parameters)
+    osg::State* state, osg::Camera* camera, const ParametersPtr& parameters)
 {
     /* Multiple draw threads might be trying to create their own
        alpha-blending context */
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_contextMapMutex);
-    ContextPtr& context = s_contextMap[state];
-
-    if (!context)
+    ContextMap::iterator entry = s_contextMap.find(state);
+    if (entry == s_contextMap.end())
+    {
         state->addObserver(&s_stateObserver);
+        entry =
+            s_contextMap.insert(std::make_pair(state, ContextCache())).first;
+    }
+    ContextCache& contexts = entry->second;
 
+    ContextPtr context = contexts.find(camera);
     if (!context || !context->updateParameters(parameters))
+    {
         context.reset(new Context(state, parameters));
+        contexts.insert(camera, context);
+    }
+    else
+    {
+        /* The fragment buffer may have grown in the previous frame */
+        contexts.shrink();
+    }
 
     return *context;
 }
 
+bool FragmentListOITBin::_Impl::getFragmentBufferStats(
+    const osg::State* state, FragmentBufferStats& stats)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_contextMapMutex);
+    ContextMap::const_iterator entry = s_contextMap.find(state);
+    if (entry == s_contextMap.end() || !entry->second.mostRecent())
+        return false;
+    stats = entry->second.mostRecent()->getFragmentBufferStats();
+    return true;
+}
+
+bool FragmentListOITBin::_Impl::getFrameStats(const osg::State* state,
+                                              FrameStats& stats)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_contextMapMutex);
+    ContextMap::const_iterator entry = s_contextMap.find(state);
+    if (entry == s_contextMap.end() || !entry->second.mostRecent())
+        return false;
+    stats = entry->second.mostRecent()->getFrameStats();
+    return true;
+}
+
 /*
   FragmentData
 */
+namespace
+{
+/* Appends the fragments of the pixels picked to a list reading them from
+   the mapped fragment buffers. */
+struct FragmentPicker
+{
+    const uint32_t* records;
+    unsigned int recordSize;
+    unsigned int depthWord;
+    /* Only used with split records. */
+    const uint32_t* colors;
+    unsigned int colorRecordSize;
+    const uint32_t* objectIDs;
+    FragmentData::PickedFragments* fragments;
+
+    void add(const unsigned int x, const unsigned int y,
+             const size_t index) const
+    {
+        const uint32_t* record = records + index * recordSize;
+        FragmentData::PickedFragment fragment;
+        fragment.x = x;
+        fragment.y = y;
+        fragment.objectID = objectIDs[index];
+        std::memcpy(&fragment.depth, record + depthWord, sizeof(float));
+        /* The alpha is in the upper 8 bits of the color word, also with
+           deferred shading. */
+        const uint32_t color = colors ? colors[index * colorRecordSize]
+                                      : record[depthWord + 1];
+        fragment.alpha = (color >> 24) / 255.f;
+        fragments->push_back(fragment);
+    }
+};
+
+bool isNearer(const FragmentData::PickedFragment& a,
+              const FragmentData::PickedFragment& b)
+{
+    return a.depth < b.depth;
+}
+}
+
+const unsigned int FragmentData::FRAGMENT_STORAGE_BINDING;
+
 FragmentData::FragmentData(osg::State* state, void* data)
     : _state(state)
     , _data(data)
@@ -761,11 +2859,213 @@ TextureBuffer* FragmentData::getFragments() const
     return static_cast<FragmentListOITBin::_Impl::Context*>(_data)->_fragments;
 }
 
+osg::GLBufferObject* FragmentData::getFragmentBufferObject() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_fragments->getGLBufferObject(_state->getContextID());
+}
+
+FragmentListOITBin::Parameters::FragmentBufferType FragmentData::
+    getFragmentBufferType() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+                   ->_shaderStorage
+               ? FragmentListOITBin::Parameters::SHADER_STORAGE_BUFFER
+               : FragmentListOITBin::Parameters::TEXTURE_BUFFER;
+}
+
+TextureBuffer* FragmentData::getPageLinks() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)->_pageLinks;
+}
+
+unsigned int FragmentData::getFragmentsPerPage() const
+{
+    return FRAGMENTS_PER_PAGE;
+}
+
+FragmentListOITBin::Parameters::FragmentStorage FragmentData::
+    getFragmentStorage() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_parameters.getFragmentStorage();
+}
+
+unsigned int FragmentData::getRecordSize() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_recordSize();
+}
+
+TextureBuffer* FragmentData::getFragmentColors() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_fragmentColors;
+}
+
+unsigned int FragmentData::getColorRecordSize() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_colorRecordSize();
+}
+
+bool FragmentData::isDeferredShading() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_deferredShading;
+}
+
+TextureBuffer* FragmentData::getObjectIDs() const
+{
+    return static_cast<FragmentListOITBin::_Impl::Context*>(_data)
+        ->_fragmentObjectIDs;
+}
+
+FragmentData::PickedFragments FragmentData::pick(const unsigned int x,
+                                                 const unsigned int y) const
+{
+    return pick(x, y, 1, 1);
+}
+
+FragmentData::PickedFragments FragmentData::pick(
+    const unsigned int x, const unsigned int y, const unsigned int width,
+    const unsigned int height) const
+{
+    const FragmentListOITBin::_Impl::Context& context =
+        *static_cast<FragmentListOITBin::_Impl::Context*>(_data);
+    if (!context._objectIDs)
+        throw std::runtime_error("Object IDs are not enabled");
+
+    PickedFragments picked;
+
+    /* Clipping the rectangle to the tile captured, whose lower left corner
+       is the origin of the per pixel textures. */
+    const osg::Viewport& viewport = *context._camera->getViewport();
+    const osg::Viewport& tile = *context._tileViewport;
+    const long tileX = long(tile.x() - viewport.x());
+    const long tileY = long(tile.y() - viewport.y());
+    const long minX = std::max(long(x), tileX);
+    const long minY = std::max(long(y), tileY);
+    const long maxX =
+        std::min(long(x) + long(width), tileX + long(tile.width()));
+    const long maxY =
+        std::min(long(y) + long(height), tileY + long(tile.height()));
+    if (minX >= maxX || minY >= maxY)
+        return picked;
+
+    const size_t numFragments = getNumFragments();
+    if (numFragments == 0)
+        return picked;
+
+    osg::State& state = *_state;
+    osg::GLExtensions* ext = osg::GLExtensions::Get(state.getContextID(), true);
+    ext->glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT |
+                         GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    const size_t pixels = size_t(context._maxWidth) * context._maxHeight;
+    std::vector<uint32_t> counts(pixels);
+    std::vector<uint32_t> heads(pixels);
+    glPixelStorei(GL_PACK_ALIGNMENT, sizeof(int));
+    context._fragmentCounts->apply(state);
+    glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                  counts.data());
+    context._fragmentLists->apply(state);
+    glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                  heads.data());
+
+    const unsigned int recordSize = context._recordSize();
+    const unsigned int colorRecordSize = context._colorRecordSize();
+    const size_t numPages =
+        context._usePages() ? numFragments / FRAGMENTS_PER_PAGE : 0;
+    const TextureBufferMapping records(context._fragments,
+                                       numFragments * recordSize, state);
+    const TextureBufferMapping colors(context._fragmentColors,
+                                      numFragments * colorRecordSize, state);
+    const TextureBufferMapping objectIDs(context._fragmentObjectIDs,
+                                         numFragments, state);
+    const TextureBufferMapping pageLinks(context._pageLinks, numPages, state);
+    if (!records.get() || !objectIDs.get() ||
+        (colorRecordSize && !colors.get()) || (numPages && !pageLinks.get()))
+        throw std::runtime_error("Could not map the fragment buffers");
+
+    FragmentPicker picker;
+    picker.records = records.get();
+    picker.recordSize = recordSize;
+    picker.depthWord = context._useCompactRecords() ? 0 : 1;
+    picker.colors = colors.get();
+    picker.colorRecordSize = colorRecordSize;
+    picker.objectIDs = objectIDs.get();
+    picker.fragments = &picked;
+
+    const FragmentListOITBin::Parameters::FragmentStorage storage =
+        context._parameters.getFragmentStorage();
+    for (long py = minY; py != maxY; ++py)
+    {
+        for (long px = minX; px != maxX; ++px)
+        {
+            const size_t pixel =
+                size_t(py - tileY) * context._maxWidth + (px - tileX);
+            const uint32_t count = counts[pixel];
+            const uint32_t head = heads[pixel];
+            if (count == 0)
+                continue;
+
+            switch (storage)
+            {
+            case FragmentListOITBin::Parameters::LINKED_LISTS:
+                /* The count bounds the walk in case a list has been
+                   corrupted by an overflow. */
+                for (size_t i = head, n = 0; i < numFragments && n < count;
+                     i = picker.records[i * recordSize], ++n)
+                {
+                    picker.add(px, py, i);
+                }
+                break;
+            case FragmentListOITBin::Parameters::PREFIX_SUM_ARRAYS:
+                for (size_t i = head;
+                     i < std::min(size_t(head) + count, numFragments); ++i)
+                {
+                    picker.add(px, py, i);
+                }
+                break;
+            case FragmentListOITBin::Parameters::PAGED_LISTS:
+            {
+                /* Only the last page allocated can be partially filled */
+                size_t page = head >> PAGE_FILL_BITS;
+                size_t fill = head & ((1u << PAGE_FILL_BITS) - 1);
+                while (page < numPages)
+                {
+                    const size_t first = page * FRAGMENTS_PER_PAGE;
+                    const size_t last =
+                        first + std::min(fill, size_t(FRAGMENTS_PER_PAGE));
+                    for (size_t i = first; i != last; ++i)
+                        picker.add(px, py, i);
+                    page = pageLinks.get()[page];
+                    fill = FRAGMENTS_PER_PAGE;
+                }
+                break;
+            }
+            case FragmentListOITBin::Parameters::K_BUFFER:
+                /* Object IDs are not stored with the K-buffer */
+                break;
+            }
+        }
+    }
+
+    std::stable_sort(picked.begin(), picked.end(), isNearer);
+    return picked;
+}
+
 size_t FragmentData::getNumFragments() const
 {
+    const FragmentListOITBin::_Impl::Context* context =
+        static_cast<FragmentListOITBin::_Impl::Context*>(_data);
+    if (context->_useKBuffer())
+        /* All the records of the K-buffer are in use */
+        return context->_getFragmentCapacity();
+
     unsigned int contextID = _state->getContextID();
-    osg::ref_ptr<osg::BufferObject>& buffer =
-        static_cast<FragmentListOITBin::_Impl::Context*>(_data)->_atomicBuffer;
+    const osg::ref_ptr<osg::BufferObject>& buffer = context->_atomicBuffer;
     osg::GLBufferObject* glBuffer = buffer->getGLBufferObject(contextID);
 
     osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
@@ -776,7 +3076,8 @@ size_t FragmentData::getNumFragments() const
     glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &size);
     glBuffer->unbindBuffer();
 
-    return size;
+    return std::min(size_t(size) * context->_fragmentsPerAllocation(),
+                    context->_getFragmentCapacity());
 }
 
 /*
@@ -803,107 +3104,523 @@ void FragmentListOITBin::drawImplementation(osg::RenderInfo& renderInfo,
 {
     osg::State* state = renderInfo.getState();
     _Impl::Context& context =
-        _Impl::getContext(state,
+        _Impl::getContext(state, renderInfo.getCurrentCamera(),
                           boost::static_pointer_cast<Parameters>(_parameters));
     context.draw(this, renderInfo, previous);
 }
 
+bool FragmentListOITBin::getFragmentBufferStats(const osg::State* state,
+                                                FragmentBufferStats& stats)
+{
+    return _Impl::getFragmentBufferStats(state, stats);
+}
+
+bool FragmentListOITBin::getFrameStats(const osg::State* state,
+                                       FrameStats& stats)
+{
+    return _Impl::getFrameStats(state, stats);
+}
+
+void FragmentListOITBin::setObjectID(osg::StateSet& stateSet,
+                                     const unsigned int id)
+{
+    stateSet.getOrCreateUniform("objectID", osg::Uniform::UNSIGNED_INT)
+        ->set(id);
+}
+
 /*
-  Free fucntions
+  FragmentReadback
 */
-bool extractFragmentStatistics(const FragmentData& fragmentData)
+class FragmentReadback::_Impl : public OpenThreads::Thread
 {
-    osg::State& state = fragmentData.getState();
-    osg::TextureRectangle& counts = *fragmentData.getCounts();
+public:
+    _Impl(const Consumer& consumer, const bool fragments,
+          const size_t ringSize)
+        : _consumer(consumer)
+        , _readFragments(fragments)
+        , _slots(ringSize)
+        , _next(0)
+        , _skippedFrames(0)
+        , _done(false)
+    {
+        if (ringSize < 2)
+            throw std::runtime_error("Invalid readback ring size");
+        start();
+    }
 
-    unsigned int contextID = state.getContextID();
-    osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
-    ext->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    ~_Impl()
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _done = true;
+            _condition.signal();
+        }
+        join();
+        /* Fences of pending readbacks are leaked, there's no guarantee
+           that the OpenGL context is current at this point. The buffer
+           objects are released by OSG. */
+    }
 
-    counts.apply(state);
-    size_t numFragments = fragmentData.getNumFragments();
+    void capture(const FragmentData& data)
+    {
+        osg::State& state = data.getState();
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
 
-    GLint width;
-    GLint height;
-    glPixelStorei(GL_PACK_ALIGNMENT, sizeof(int));
-    glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &width);
-    glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT,
-                             &height);
-    unsigned int* data = new unsigned int[width * height];
+        _processSlots(state);
 
-    glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
-                  data);
+        Slot& slot = _slots[_next];
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if (slot.status != Slot::FREE)
+            {
+                ++_skippedFrames;
+                return;
+            }
+        }
 
-    std::map<unsigned int, unsigned int> histogram;
-    for (int i = 0; i != height; ++i)
+        const FragmentListOITBin::_Impl::Context& context =
+            *static_cast<FragmentListOITBin::_Impl::Context*>(data._data);
+
+        Frame& frame = slot.frame;
+        frame.frameNumber = state.getFrameStamp()->getFrameNumber();
+        frame.width = context._maxWidth;
+        frame.height = context._maxHeight;
+        frame.storage = context._parameters.getFragmentStorage();
+        frame.recordSize = context._recordSize();
+        frame.deferredShading = context._deferredShading;
+        frame.splitRecords = context._useSplitRecords();
+        frame.fragmentsPerPage = FRAGMENTS_PER_PAGE;
+        slot.capacity = context._getFragmentCapacity();
+        slot.fragmentsPerAllocation =
+            context._useKBuffer() ? 0 : context._fragmentsPerAllocation();
+
+        /* Buffer layout: counter, counts, heads, fragments and page
+           links. */
+        const size_t textureSize =
+            size_t(frame.width) * frame.height * sizeof(GLuint);
+        const size_t countsOffset = 4 * sizeof(GLuint);
+        const size_t headsOffset = countsOffset + textureSize;
+        const size_t fragmentsOffset = headsOffset + textureSize;
+        const size_t fragmentsSize =
+            slot.capacity * frame.recordSize * sizeof(GLuint);
+        const size_t pageLinksOffset = fragmentsOffset + fragmentsSize;
+        const size_t pageLinksSize =
+            context._usePages()
+                ? slot.capacity / FRAGMENTS_PER_PAGE * sizeof(GLuint)
+                : 0;
+        slot.size = _readFragments ? pageLinksOffset + pageLinksSize
+                                   : headsOffset;
+
+        if (!slot.buffer || slot.buffer->getDataSize() < slot.size)
+        {
+            slot.buffer = new osg::PixelDataBufferObject();
+            slot.buffer->setDataSize(slot.size);
+            slot.buffer->setUsage(GL_STREAM_READ);
+        }
+        slot.buffer->compileBuffer(state);
+        const GLuint id =
+            slot.buffer->getGLBufferObject(contextID)->getGLObjectID();
+
+        ext->glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT |
+                             GL_BUFFER_UPDATE_BARRIER_BIT |
+                             GL_PIXEL_BUFFER_BARRIER_BIT);
+
+        ext->glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        if (slot.fragmentsPerAllocation)
+        {
+            osg::GLBufferObject* counter =
+                context._atomicBuffer->getGLBufferObject(contextID);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, counter->getGLObjectID());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                                0, sizeof(GLuint));
+        }
+        if (_readFragments)
+        {
+            osg::GLBufferObject* fragments =
+                context._fragments->getGLBufferObject(contextID);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER,
+                              fragments->getGLObjectID());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                                fragmentsOffset, fragmentsSize);
+        }
+        if (_readFragments && pageLinksSize)
+        {
+            osg::GLBufferObject* links =
+                context._pageLinks->getGLBufferObject(contextID);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, links->getGLObjectID());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0,
+                                pageLinksOffset, pageLinksSize);
+        }
+        ext->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        ext->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, id);
+        glPixelStorei(GL_PACK_ALIGNMENT, sizeof(int));
+        context._fragmentCounts->apply(state);
+        glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                      (void*)countsOffset);
+        if (_readFragments)
+        {
+            context._fragmentLists->apply(state);
+            glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER,
+                          GL_UNSIGNED_INT, (void*)headsOffset);
+        }
+        ext->glBindBuffer(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            slot.status = Slot::PENDING;
+        }
+        _pending.push_back(&slot);
+        _next = (_next + 1) % _slots.size();
+        checkGLErrors("After fragment readback request");
+    }
+
+    size_t getSkippedFrames() const
     {
-        for (int j = 0; j != width; ++j)
-            ++histogram[data[i * width + j]];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        return _skippedFrames;
     }
 
-    std::cout << state.getFrameStamp()->getFrameNumber() << " fragment_counts ";
-    for (const auto& i : histogram)
-        std::cout << i.first << ' ' << i.second << ' ';
-    std::cout << "total " << numFragments << std::endl;
+    virtual void run()
+    {
+        while (true)
+        {
+            Slot* slot = 0;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                while (_mapped.empty() && !_done)
+                    _condition.wait(&_mutex);
+                if (_done)
+                    return;
+                slot = _mapped.front();
+                _mapped.pop_front();
+            }
+            try
+            {
+                _consumer(slot->frame);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "osgTransparency: exception in fragment readback "
+                             "consumer: "
+                          << e.what() << std::endl;
+            }
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            slot->status = Slot::CONSUMED;
+        }
+    }
 
-    delete[] data;
-    return true;
+private:
+    struct Slot
+    {
+        enum Status
+        {
+            FREE,
+            /* Waiting for the GPU copy to complete */
+            PENDING,
+            /* Mapped and queued or being processed by the worker thread */
+            MAPPED,
+            /* Processed, waiting to be unmapped */
+            CONSUMED
+        };
+
+        Slot()
+            : status(FREE)
+            , fence(0)
+            , capacity(0)
+            , fragmentsPerAllocation(0)
+            , size(0)
+        {
+        }
+
+        /* The worker thread changes it from MAPPED to CONSUMED, so every
+           read and write is done with the mutex locked. */
+        Status status;
+        GLsync fence;
+        osg::ref_ptr<osg::PixelDataBufferObject> buffer;
+        Frame frame;
+        size_t capacity;
+        /* 0 for the K-buffer, where all records are in use. */
+        unsigned int fragmentsPerAllocation;
+        size_t size;
+    };
+
+    const Consumer _consumer;
+    const bool _readFragments;
+    std::vector<Slot> _slots;
+    size_t _next;
+    /* Slots in PENDING state in request order */
+    std::deque<Slot*> _pending;
+
+    mutable OpenThreads::Mutex _mutex;
+    OpenThreads::Condition _condition;
+    std::deque<Slot*> _mapped;
+    size_t _skippedFrames;
+    bool _done;
+
+    void _processSlots(osg::State& state)
+    {
+        const unsigned int contextID = state.getContextID();
+        osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
+
+        for (auto& slot : _slots)
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                if (slot.status != Slot::CONSUMED)
+                    continue;
+                slot.status = Slot::FREE;
+            }
+            osg::GLBufferObject* buffer =
+                slot.buffer->getGLBufferObject(contextID);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, buffer->getGLObjectID());
+            ext->glUnmapBuffer(GL_COPY_READ_BUFFER);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+
+        /* The copies complete in order */
+        while (!_pending.empty())
+        {
+            Slot& slot = *_pending.front();
+            const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED &&
+                status != GL_CONDITION_SATISFIED)
+                return;
+            glDeleteSync(slot.fence);
+            _pending.pop_front();
+
+            osg::GLBufferObject* buffer =
+                slot.buffer->getGLBufferObject(contextID);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, buffer->getGLObjectID());
+            const uint32_t* data = (const uint32_t*)ext->glMapBufferRange(
+                GL_COPY_READ_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+            ext->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            if (!data)
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+                slot.status = Slot::FREE;
+                continue;
+            }
+
+            Frame& frame = slot.frame;
+            const size_t pixels = size_t(frame.width) * frame.height;
+            frame.counts = data + 4;
+            frame.numFragments =
+                slot.fragmentsPerAllocation
+                    ? std::min(size_t(data[0]) * slot.fragmentsPerAllocation,
+                               slot.capacity)
+                    : slot.capacity;
+            frame.heads = _readFragments ? frame.counts + pixels : 0;
+            frame.fragments = _readFragments ? frame.heads + pixels : 0;
+            frame.pageLinks = 0;
+            frame.numPages = 0;
+            if (frame.storage == FragmentListOITBin::Parameters::PAGED_LISTS)
+            {
+                frame.numPages = frame.numFragments / FRAGMENTS_PER_PAGE;
+                if (_readFragments)
+                    frame.pageLinks =
+                        frame.fragments + slot.capacity * frame.recordSize;
+            }
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            slot.status = Slot::MAPPED;
+            _mapped.push_back(&slot);
+            _condition.signal();
+        }
+    }
+};
+
+FragmentReadback::FragmentReadback(const Consumer& consumer,
+                                   const bool fragments, const size_t ringSize)
+    : _impl(new _Impl(consumer, fragments, ringSize))
+{
 }
 
-void writeTextures(const std::string& filename,
-                   const FragmentData& fragmentData)
+FragmentReadback::~FragmentReadback()
 {
-    osg::State& state = fragmentData.getState();
-    osg::TextureRectangle& counts = *fragmentData.getCounts();
-    osg::TextureRectangle& heads = *fragmentData.getHeads();
-    TextureBuffer& fragments = *fragmentData.getFragments();
+}
+
+bool FragmentReadback::operator()(const FragmentData& data) const
+{
+    _impl->capture(data);
+    return true;
+}
 
-    std::ofstream out(filename, std::ios::binary);
-    if (!out)
-        throw std::runtime_error("Could not open file for writing: " +
-                                 filename);
+size_t FragmentReadback::getSkippedFrames() const
+{
+    return _impl->getSkippedFrames();
+}
 
+/*
+  Free fucntions
+*/
+namespace
+{
+/* Reads back the data of a capture synchronously into the given arrays. */
+FragmentReadback::Frame readFrame(const FragmentData& fragmentData,
+                                  const bool readFragments,
+                                  std::vector<uint32_t>& counts,
+                                  std::vector<uint32_t>& heads,
+                                  std::vector<uint32_t>& fragments,
+                                  std::vector<uint32_t>& pageLinks)
+{
+    osg::State& state = fragmentData.getState();
     const unsigned int contextID = state.getContextID();
     osg::GLExtensions* ext = osg::GLExtensions::Get(contextID, true);
-    ext->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
-
-    counts.apply(state);
-
+    ext->glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT |
+                         GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    FragmentReadback::Frame frame;
+    frame.frameNumber = state.getFrameStamp()->getFrameNumber();
+    frame.storage = fragmentData.getFragmentStorage();
+    frame.recordSize = fragmentData.getRecordSize();
+    frame.deferredShading = fragmentData.isDeferredShading();
+    frame.splitRecords = fragmentData.getColorRecordSize() != 0;
+    frame.fragmentsPerPage = fragmentData.getFragmentsPerPage();
+    frame.numFragments = fragmentData.getNumFragments();
+    frame.numPages =
+        frame.storage == FragmentListOITBin::Parameters::PAGED_LISTS
+            ? frame.numFragments / frame.fragmentsPerPage
+            : 0;
+
+    fragmentData.getCounts()->apply(state);
     GLint width;
     GLint height;
     glPixelStorei(GL_PACK_ALIGNMENT, sizeof(int));
     glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_WIDTH, &width);
     glGetTexLevelParameteriv(GL_TEXTURE_RECTANGLE, 0, GL_TEXTURE_HEIGHT,
                              &height);
-    out.write((char*)&width, sizeof(GLint));
-    out.write((char*)&height, sizeof(GLint));
+    frame.width = width;
+    frame.height = height;
 
-    uint32_t* data = new uint32_t[width * height];
-    size_t size = sizeof(uint32_t) * width * height;
+    counts.resize(size_t(width) * height);
     glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
-                  data);
-    uint32_t numFrags = 0;
-    for (int i = 0; i != width * height; ++i)
-        numFrags += data[i];
-    out.write((char*)&numFrags, sizeof(uint32_t));
-
-    out.write((char*)data, size);
-
-    heads.apply(state);
-    glPixelStorei(GL_PACK_ALIGNMENT, sizeof(int));
+                  counts.data());
+    frame.counts = counts.data();
+    frame.heads = 0;
+    frame.fragments = 0;
+    frame.pageLinks = 0;
+    if (!readFragments)
+        return frame;
+
+    heads.resize(counts.size());
+    fragmentData.getHeads()->apply(state);
     glGetTexImage(GL_TEXTURE_RECTANGLE, 0, GL_RED_INTEGER, GL_UNSIGNED_INT,
-                  data);
-    out.write((char*)data, size);
-    delete[] data;
+                  heads.data());
+    frame.heads = heads.data();
 
-    data = new uint32_t[numFrags * 3];
-    osg::GLBufferObject* buffer = fragments.getGLBufferObject(contextID);
+    fragments.resize(frame.numFragments * frame.recordSize);
+    osg::GLBufferObject* buffer =
+        fragmentData.getFragments()->getGLBufferObject(contextID);
     buffer->bindBuffer();
-    size = numFrags * 3 * sizeof(uint32_t);
-    glGetBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    glGetBufferSubData(GL_TEXTURE_BUFFER, 0,
+                       fragments.size() * sizeof(uint32_t), fragments.data());
     buffer->unbindBuffer();
-    out.write((char*)data, size);
-    delete[] data;
+    frame.fragments = fragments.data();
+
+    if (frame.numPages)
+    {
+        pageLinks.resize(frame.numPages);
+        buffer = fragmentData.getPageLinks()->getGLBufferObject(contextID);
+        buffer->bindBuffer();
+        glGetBufferSubData(GL_TEXTURE_BUFFER, 0,
+                           pageLinks.size() * sizeof(uint32_t),
+                           pageLinks.data());
+        buffer->unbindBuffer();
+        frame.pageLinks = pageLinks.data();
+    }
+    return frame;
+}
+
+/* Fills in the header of a dump with the layout of a frame. */
+FragmentDump::Header makeHeader(const FragmentReadback::Frame& frame)
+{
+    if (!frame.heads || !frame.fragments ||
+        (frame.numPages && !frame.pageLinks))
+        throw std::runtime_error("Fragments not available in frame");
+    /* Dumps only know about interleaved color records */
+    if (frame.deferredShading)
+        throw std::runtime_error(
+            "Deferred shading fragments can't be dumped or composited");
+    if (frame.splitRecords)
+        throw std::runtime_error(
+            "Split fragment records can't be dumped or composited");
+
+    FragmentDump::Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.width = frame.width;
+    header.height = frame.height;
+    header.storage = frame.storage;
+    header.recordSize = frame.recordSize;
+    header.fragmentsPerPage = frame.fragmentsPerPage;
+    header.pageFillBits = PAGE_FILL_BITS;
+    if (frame.storage == FragmentListOITBin::Parameters::K_BUFFER)
+        header.kBufferSize =
+            frame.numFragments / (size_t(frame.width) * frame.height);
+    header.frameNumber = frame.frameNumber;
+    /* With prefix sum storage there may be unused records in the fragment
+       buffer, so the sum of the counts can't be used to know how many
+       records must be written. */
+    header.numFragments = frame.numFragments;
+    header.numPages = frame.numPages;
+    return header;
+}
+}
+
+bool extractFragmentStatistics(const FragmentData& fragmentData)
+{
+    std::vector<uint32_t> counts, heads, fragments, pageLinks;
+    printFragmentStatistics(
+        readFrame(fragmentData, false, counts, heads, fragments, pageLinks));
+    return true;
+}
+
+void printFragmentStatistics(const FragmentReadback::Frame& frame)
+{
+    std::map<unsigned int, unsigned int> histogram;
+    const size_t pixels = size_t(frame.width) * frame.height;
+    for (size_t i = 0; i != pixels; ++i)
+        ++histogram[frame.counts[i]];
+
+    std::cout << frame.frameNumber << " fragment_counts ";
+    for (const auto& i : histogram)
+        std::cout << i.first << ' ' << i.second << ' ';
+    std::cout << "total " << frame.numFragments << std::endl;
+}
+
+void writeTextures(const std::string& filename,
+                   const FragmentData& fragmentData)
+{
+    std::vector<uint32_t> counts, heads, fragments, pageLinks;
+    writeFrame(filename, readFrame(fragmentData, true, counts, heads,
+                                   fragments, pageLinks));
+}
+
+void writeFrame(const std::string& filename,
+                const FragmentReadback::Frame& frame)
+{
+    FragmentDump::write(filename, makeHeader(frame), frame.counts,
+                        frame.heads, frame.fragments, frame.pageLinks);
+}
+
+osg::ref_ptr<osg::Image> compositeFragments(const FragmentData& fragmentData,
+                                            FragmentCompositor& compositor)
+{
+    std::vector<uint32_t> counts, heads, fragments, pageLinks;
+    return compositeFrame(readFrame(fragmentData, true, counts, heads,
+                                    fragments, pageLinks),
+                          compositor);
+}
+
+osg::ref_ptr<osg::Image> compositeFrame(const FragmentReadback::Frame& frame,
+                                        FragmentCompositor& compositor)
+{
+    const FragmentDump dump(makeHeader(frame), frame.counts, frame.heads,
+                            frame.fragments, frame.pageLinks);
+    return compositor.composite(dump);
 }
 }
 }
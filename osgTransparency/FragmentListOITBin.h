@@ -31,9 +31,16 @@
 #include "BaseRenderBin.h"
 
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <stdint.h>
+#include <vector>
 
 namespace osg
 {
+class GLBufferObject;
+class Image;
+class StateSet;
 class TextureRectangle;
 }
 
@@ -42,6 +49,7 @@ namespace bbp
 namespace osgTransparency
 {
 class TextureBuffer;
+class FragmentCompositor;
 class FragmentData;
 
 /**
@@ -65,6 +73,117 @@ public:
 
     struct OSGTRANSPARENCY_API Parameters : public BaseRenderBin::Parameters
     {
+        /** Layout used to store the captured fragments in GPU memory. */
+        enum FragmentStorage
+        {
+            /** Per pixel linked lists allocated from a single buffer.
+                The buffer is allocated up front with a size of
+                OSGTRANSPARENCY_FRAGMENTS_PER_PIXEL fragments per pixel. */
+            LINKED_LISTS,
+            /** Per pixel contiguous arrays.
+                The scene is rendered twice, the first pass only counts the
+                fragments per pixel. A prefix sum of the counts gives the
+                offset of each pixel array and the total number of fragments,
+                so the buffer is sized exactly before the second pass stores
+                the fragments. The sorting pass doesn't need to follow list
+                pointers. */
+            PREFIX_SUM_ARRAYS,
+            /** Per pixel linked lists of fixed size pages.
+                Pixels allocate pages of OSGTRANSPARENCY_FRAGMENTS_PER_PAGE
+                fragments (4 by default, 14 at most) from the fragment buffer
+                and fill them locally. This reduces the contention on the
+                global allocation counter and makes the fragments of a pixel
+                contiguous in memory within each page. */
+            PAGED_LISTS,
+            /** Fixed size per pixel arrays with the K nearest fragments.
+                The scene is rendered twice. The first pass inserts the
+                fragment depths in the sorted per pixel arrays and the
+                second one stores the colors of the fragments that made it
+                into the arrays. The fragments behind the K nearest ones are
+                approximated by their alpha weighted average color and
+                their total transmittance. Memory usage is independent of the
+                depth complexity and no sorting is needed.
+                Alpha cut-off is not applied in this mode.
+                @sa setKBufferSize */
+            K_BUFFER
+        };
+
+        /** Encoding of the fragment records. */
+        enum FragmentEncoding
+        {
+            /** 3 words per fragment: next index, depth as a float and RGBA8
+                color. */
+            FULL_RECORDS,
+            /** 2 words per fragment: depth as a float and RGBA8 color.
+                Only available with PREFIX_SUM_ARRAYS and PAGED_LISTS storage
+                because the fragment layout doesn't need next pointers.
+                With LINKED_LISTS storage full records are used instead. */
+            COMPACT_RECORDS,
+            /** The depth, and the next index with LINKED_LISTS storage, are
+                stored in the fragment buffer and the color in a separate
+                buffer texture with the same indexing. The sort only reads
+                the depths and the colors are fetched in depth order for
+                the fragments that are blended, which halves the bandwidth
+                of the sort for deep pixels and pairs well with the partial
+                sort. Not used with K_BUFFER storage.
+                @sa FragmentData::getFragmentColors */
+            SPLIT_RECORDS
+        };
+
+        /** Algorithm used to sort and composite the fragment lists.
+            Not used with K_BUFFER storage. */
+        enum ListResolve
+        {
+            /** Full screen passes that process the pixels in batches
+                depending on their fragment counts. The pixels of each
+                batch are selected with the stencil buffer. */
+            STENCIL_BATCHES,
+            /** Compute shaders that bin the pixels by fragment count into
+                work lists and dispatch one work group per list of pixels
+                with indirect dispatches. Short lists are sorted by a single
+                thread, long lists by a whole work group in shared memory.
+                Requires OpenGL 4.3, STENCIL_BATCHES is used instead if not
+                available. */
+            COMPUTE_BINNING
+        };
+
+        /** How the shaders access the fragment buffer. */
+        enum FragmentBufferType
+        {
+            /** A buffer texture written with imageStore one word at a time.
+                The number of records is limited by
+                GL_MAX_TEXTURE_BUFFER_SIZE. */
+            TEXTURE_BUFFER,
+            /** A shader storage buffer with an array of fragment structs,
+                so each record is written with a single store. The size is
+                limited by GL_MAX_SHADER_STORAGE_BLOCK_SIZE, which is usually
+                much larger than the buffer texture limit. The buffer is
+                bound to the shader storage binding point
+                FragmentData::FRAGMENT_STORAGE_BINDING, which must not be
+                used by the scene. Requires OpenGL 4.3 or
+                GL_ARB_shader_storage_buffer_object, TEXTURE_BUFFER is used
+                instead if not available and with K_BUFFER storage. */
+            SHADER_STORAGE_BUFFER
+        };
+
+        /** Encoding of the per pixel accumulated transparency and maximum
+            depth used by the alpha cut-off. Both values are packed in a
+            single 32-bit word that is updated with atomic operations. */
+        enum AlphaCutOffEncoding
+        {
+            /** 8-bit transparency and 24-bit depth. The transparency
+                update rounds to the nearest unit to converge to 0, which
+                makes it overestimate the opacity on long lists of low
+                alpha fragments. */
+            TRANSPARENCY_8_BITS,
+            /** 16-bit transparency and 16-bit depth. The transparency is
+                rounded up, which is both conservative and accurate enough
+                to discard the long tails of high depth complexity scenes.
+                Fragments closer than 1/65536 in depth to the fragment that
+                crossed the threshold are not discarded. */
+            TRANSPARENCY_16_BITS
+        };
+
         Parameters();
 
         Parameters(const Parameters& other);
@@ -103,6 +222,234 @@ public:
 
         void disableAlphaCutOff();
 
+        /** Choose the encoding of the alpha cut-off buffer.
+
+            The default is TRANSPARENCY_8_BITS.
+
+            @sa AlphaCutOffEncoding
+            @version 0.9.0
+        */
+        void setAlphaCutOffEncoding(AlphaCutOffEncoding encoding);
+
+        /** @version 0.9.0 */
+        AlphaCutOffEncoding getAlphaCutOffEncoding() const;
+
+        /** Choose the fragment storage layout.
+
+            Changing the layout recreates all the GPU resources of the
+            contexts in which the render bin is used.
+
+            @sa FragmentStorage
+            @version 0.9.0
+        */
+        void setFragmentStorage(FragmentStorage storage);
+
+        /** @version 0.9.0 */
+        FragmentStorage getFragmentStorage() const;
+
+        /** Choose how the fragment buffer is accessed by the shaders.
+
+            The default is TEXTURE_BUFFER. Changing the type recreates all
+            the GPU resources of the contexts in which the render bin is
+            used.
+
+            @sa FragmentBufferType
+            @version 0.9.0
+        */
+        void setFragmentBufferType(FragmentBufferType type);
+
+        /** @version 0.9.0 */
+        FragmentBufferType getFragmentBufferType() const;
+
+        /** Choose the fragment record encoding.
+
+            Changing the encoding recreates all the GPU resources of the
+            contexts in which the render bin is used.
+
+            @sa FragmentEncoding
+            @version 0.9.0
+        */
+        void setFragmentEncoding(FragmentEncoding encoding);
+
+        /** @version 0.9.0 */
+        FragmentEncoding getFragmentEncoding() const;
+
+        /** Set the number of fragments per pixel stored exactly with K_BUFFER
+            storage.
+
+            @param size A value in [1, 64]. The default is 8.
+            @version 0.9.0
+        */
+        void setKBufferSize(unsigned int size);
+
+        /** @version 0.9.0 */
+        unsigned int getKBufferSize() const;
+
+        /** Sort short per pixel lists with generated sorting networks.
+
+            The lists are sorted in batches of pixels grouped by fragment
+            count, with a shader specialized for the maximum count of each
+            batch. The batches whose maximum count is less or equal than
+            the given size use an unrolled Batcher odd-even merge sorting
+            network instead of insertion sort or heap sort.
+
+            @param size A value in [0, 128]. 0, the default, disables the
+                   sorting networks.
+            @version 0.9.0
+        */
+        void setSortingNetworkMaxSize(unsigned int size);
+
+        /** @version 0.9.0 */
+        unsigned int getSortingNetworkMaxSize() const;
+
+        /** Choose the algorithm to sort and composite the fragment lists.
+
+            The default is STENCIL_BATCHES. Changing the algorithm recreates
+            all the GPU resources of the contexts in which the render bin is
+            used.
+
+            @sa ListResolve
+            @version 0.9.0
+        */
+        void setListResolve(ListResolve resolve);
+
+        /** @version 0.9.0 */
+        ListResolve getListResolve() const;
+
+        /** Limit the GPU memory used by the buffers of a graphics context.
+
+            When the per pixel buffers and the initial fragment buffer of the
+            whole viewport don't fit in the budget, the viewport is split in
+            tiles that are captured and composited one after another reusing
+            the same buffers. The fragment buffer never grows beyond the
+            budget either. With tiling, the capture callback is called once
+            per tile.
+
+            @param bytes The budget in bytes, at least 16 MiB. 0, the default,
+                   means no limit.
+            @version 0.9.0
+        */
+        void setMemoryBudget(size_t bytes);
+
+        /** @version 0.9.0 */
+        size_t getMemoryBudget() const;
+
+        /** Discard the transparent fragments occluded by the opaque geometry
+            before they are stored.
+
+            The depth buffer of the camera framebuffer is copied at the
+            beginning of the capture and used for a read-only depth test
+            that is done before the fragment shaders run, so occluded
+            fragments don't allocate any storage. The transparent bin must
+            be rendered after the opaque geometry. The depth and stencil
+            formats of the camera framebuffer are matched, but multisampled
+            framebuffers are not supported; if the copy fails a warning is
+            printed and no fragment is discarded.
+
+            @param enable False by default.
+            @version 0.9.0
+        */
+        void setOpaqueDepthTest(bool enable);
+
+        /** @version 0.9.0 */
+        bool getOpaqueDepthTest() const;
+
+        /** Defer the shading of the transparent fragments to the resolve
+            pass.
+
+            Instead of a shaded color, each captured fragment stores its
+            alpha, a 24-bit material ID and its normal packed in 32 bits.
+            The fragment lists are sorted as usual and the fragments are
+            shaded front to back while blending, stopping as soon as the
+            accumulated transmittance falls below the given threshold, so
+            occluded fragments are never shaded.
+
+            In this mode the fragment shaders of the render bin state sets
+            must provide the following functions instead of shadeFragment:
+            @code
+            float fragmentAlpha();
+            vec3 fragmentNormal(); // Eye space, needs not be normalized
+            uint fragmentMaterial(); // Only the lower 24 bits are stored
+            @endcode
+            The shading source is added to the resolve program and must
+            implement:
+            @code
+            vec3 shadeDeferredFragment(vec3 normal, uint material,
+                                       float depth);
+            @endcode
+            which returns the color without alpha premultiplication. The
+            normal is normalized and depth is the value returned by
+            fragmentDepth. Since a single resolve program is used for the
+            whole bin, the material ID is the only way to tell objects apart.
+
+            Deferred shading is not supported with K_BUFFER storage and
+            the COMPUTE_BINNING resolve falls back to stencil batches.
+
+            @param shadingSource GLSL code with shadeDeferredFragment.
+            @param minTransmittance Threshold in [0, 1) below which the
+                   remaining fragments of a list are skipped.
+            @throw std::runtime_error if the source is empty or the
+                   threshold out of range.
+            @version 0.9.0
+        */
+        void enableDeferredShading(const std::string& shadingSource,
+                                   float minTransmittance = 1 / 255.f);
+
+        /** @version 0.9.0 */
+        void disableDeferredShading();
+
+        /** @version 0.9.0 */
+        bool isDeferredShadingEnabled() const;
+
+        /** Stop the sorting of the fragment lists once the accumulated
+            opacity reaches the given threshold.
+
+            The lists that would be sorted with heap sort are turned into a
+            heap from which fragments are extracted and blended front to
+            back, so the cost of deep and nearly opaque pixels depends on the
+            number of fragments that are visible instead of the list length.
+            The short lists sorted by insertion sort or sorting networks just
+            stop blending. The fragments skipped are lost, this is an
+            approximation unless the threshold is 1.
+
+            This complements the alpha cut-off, which discards fragments
+            during the capture using an order independent estimate. Only
+            the stencil batches resolve supports it, the COMPUTE_BINNING
+            resolve and K_BUFFER storage ignore it.
+
+            @param threshold The opacity threshold in (0, 1].
+            @throw std::runtime_error if the threshold is out of range.
+            @version 0.9.0
+        */
+        void enablePartialSort(float threshold);
+
+        /** @version 0.9.0 */
+        void disablePartialSort();
+
+        /** @version 0.9.0 */
+        bool isPartialSortEnabled() const;
+
+        /** Store the object ID of each fragment to allow picking through
+            the transparent geometry with FragmentData::pick.
+
+            The object ID of a fragment is the value of the unsigned int
+            uniform "objectID" when it's rendered, which is set per drawable
+            with FragmentListOITBin::setObjectID. Fragments without it get 0.
+            The IDs are stored in a separate buffer of one word per fragment
+            which is not read by the sort.
+
+            Object IDs are not supported with K_BUFFER storage.
+
+            @version 0.9.0
+        */
+        void enableObjectIDs();
+
+        /** @version 0.9.0 */
+        void disableObjectIDs();
+
+        /** @version 0.9.0 */
+        bool areObjectIDsEnabled() const;
+
         /** @sa BaseRenderBin::Parameters::update */
         virtual bool update(const Parameters& other);
 
@@ -114,6 +461,42 @@ public:
         _Impl* _impl;
     };
 
+    /** Usage statistics of the fragment buffer of a graphics context.
+
+        The fragment buffer starts with a capacity of
+        OSGTRANSPARENCY_FRAGMENTS_PER_PIXEL fragments per pixel and it's
+        grown or shrunk depending on the number of fragments captured in
+        previous frames. With LINKED_LISTS storage the fragment count is read
+        back asynchronously, so the fragments of a frame may not fit in the
+        buffer. In that case the fragments that don't fit are dropped and the
+        event is recorded as an overflow. */
+    struct FragmentBufferStats
+    {
+        FragmentBufferStats()
+            : capacity(0)
+            , lastFragmentCount(0)
+            , lastFrame(0)
+            , overflowCount(0)
+            , lastOverflowFrame(0)
+            , resizeCount(0)
+        {
+        }
+
+        /** Number of fragments that fit in the buffer. */
+        size_t capacity;
+        /** Number of fragments generated in the last frame whose count has
+            been read back. This number can be larger than the capacity. */
+        size_t lastFragmentCount;
+        /** Frame number of lastFragmentCount. */
+        unsigned int lastFrame;
+        /** Number of frames in which fragments were dropped. */
+        size_t overflowCount;
+        /** Frame number of the last overflow. */
+        unsigned int lastOverflowFrame;
+        /** Number of times the fragment buffer has been reallocated. */
+        size_t resizeCount;
+    };
+
     FragmentListOITBin(const Parameters& parameters = Parameters());
 
     FragmentListOITBin(const FragmentListOITBin& renderBin,
@@ -134,6 +517,45 @@ public:
     }
 
     virtual void sort() {}
+    /** Return the fragment buffer statistics of a graphics context.
+
+        Each camera rendered in a context has its own fragment buffer, the
+        statistics returned are the ones of the camera rendered last.
+        This function is thread-safe.
+
+        @param state The state object of the graphics context.
+        @param stats The statistics. Left untouched if the function returns
+               false.
+        @return false if no fragment list render bin has been drawn in the
+                given context yet.
+        @version 0.9.0
+    */
+    static bool getFragmentBufferStats(const osg::State* state,
+                                       FragmentBufferStats& stats);
+
+    /** Return the statistics of the last frame drawn in a graphics context.
+
+        The passes are the geometry passes of all the tiles of the frame.
+        As with getFragmentBufferStats, the statistics returned are the ones
+        of the camera rendered last. This function is thread-safe.
+
+        @param state The state object of the graphics context.
+        @param stats The statistics. Left untouched if the function returns
+               false.
+        @return false if no frame statistics are available yet for the
+                given context.
+        @version 0.9.0
+    */
+    static bool getFrameStats(const osg::State* state, FrameStats& stats);
+
+    /** Set the object ID stored with the fragments of the drawables under
+        a state set.
+
+        @sa Parameters::enableObjectIDs
+        @version 0.9.0
+    */
+    static void setObjectID(osg::StateSet& stateSet, unsigned int id);
+
 protected:
     /*--- Protected member functions ---*/
 
@@ -149,15 +571,149 @@ class OSGTRANSPARENCY_API FragmentData
 {
 public:
     friend class FragmentListOITBin::_Impl;
+    friend class FragmentReadback;
+
+    /** Shader storage binding point of the fragment buffer with
+        FragmentListOITBin::Parameters::SHADER_STORAGE_BUFFER. */
+    static const unsigned int FRAGMENT_STORAGE_BINDING = 0;
 
     osg::State& getState() const;
     osg::TextureRectangle* getCounts() const;
+    /**
+       With FragmentListOITBin::Parameters::LINKED_LISTS storage, this texture
+       contains the index of the first fragment of each pixel list.
+       With PREFIX_SUM_ARRAYS storage, it contains the index of the first
+       fragment of each pixel array instead. The fragments of a pixel are
+       the getCounts() consecutive records starting at that index and their
+       next pointers are not meaningful.
+       With PAGED_LISTS storage, each texel packs the index of the last page
+       allocated for the pixel in the upper bits and the number of fragments
+       stored in that page in the lower 4 bits. The fragments of page p are
+       the records [p * getFragmentsPerPage(), (p + 1) * getFragmentsPerPage()),
+       all pages but the last one allocated are full and the previous page of
+       each page is given by getPageLinks(). The page index 0x0FFFFFFF
+       terminates the list.
+       With K_BUFFER storage this texture is not used. The fragment buffer
+       contains getRecordSize() word records with the depth and the color,
+       K records per pixel sorted by depth and indexed by
+       (y * width + x) * K + i, where width is the width of this texture.
+       Unused records have a depth of 0xFFFFFFFF.
+    */
     osg::TextureRectangle* getHeads() const;
     TextureBuffer* getFragments() const;
+    /** Return the buffer object that stores the fragment records.
+
+        This is the storage of the getFragments() texture. With
+        SHADER_STORAGE_BUFFER access it can hold more records than a buffer
+        texture can address, so it should be used instead of the texture
+        to read the records, e.g. by binding it to a shader storage binding
+        point or copying it.
+        @version 0.9.0
+    */
+    osg::GLBufferObject* getFragmentBufferObject() const;
+    /** Return how the fragment buffer was accessed by the capture, which
+        can differ from the requested type if it was not supported.
+        @version 0.9.0
+    */
+    FragmentListOITBin::Parameters::FragmentBufferType getFragmentBufferType()
+        const;
+    /** Return the page links buffer with PAGED_LISTS storage and 0 otherwise.
+     */
+    TextureBuffer* getPageLinks() const;
+    unsigned int getFragmentsPerPage() const;
+
+    /** Return the storage layout used for the captured fragments. */
+    FragmentListOITBin::Parameters::FragmentStorage getFragmentStorage() const;
+
+    /** Return the number of 32-bit words of each fragment record.
+
+        Records of 3 words contain the next index, the depth and the color.
+        Records of 2 words contain the depth and the color.
+        With deferred shading the color word contains the material ID in
+        the lower 24 bits and the alpha in the upper 8 bits and it's
+        followed by an extra word with the packed normal, so records have
+        4 and 3 words respectively, see isDeferredShading.
+        With split records the fragment buffer only contains the next index,
+        if any, and the depth, so records have 2 or 1 words. The rest of
+        the record is in getFragmentColors().
+    */
+    unsigned int getRecordSize() const;
+
+    /** Return the buffer with the color words of the fragments with
+        FragmentListOITBin::Parameters::SPLIT_RECORDS and 0 otherwise.
+        The record of fragment i starts at i * getColorRecordSize().
+        @version 0.9.0
+    */
+    TextureBuffer* getFragmentColors() const;
+
+    /** Return the number of 32-bit words of each color record of split
+        records (2 with deferred shading, 1 otherwise) and 0 otherwise.
+        @version 0.9.0
+    */
+    unsigned int getColorRecordSize() const;
+
+    /** Return true if the records contain the shading inputs of deferred
+        shading instead of colors.
+        @version 0.9.0
+    */
+    bool isDeferredShading() const;
+
+    /** Return the buffer with the object ID of each fragment, indexed like
+        the fragment records, if object IDs are enabled and 0 otherwise.
+        @sa FragmentListOITBin::Parameters::enableObjectIDs
+        @version 0.9.0
+    */
+    TextureBuffer* getObjectIDs() const;
+
+    /** A fragment returned by pick. */
+    struct PickedFragment
+    {
+        /** Pixel coordinates relative to the camera viewport. */
+        unsigned int x;
+        unsigned int y;
+        unsigned int objectID;
+        float depth;
+        /** The alpha with the 8-bit precision it's stored with. */
+        float alpha;
+    };
+    typedef std::vector<PickedFragment> PickedFragments;
+
+    /** Return the fragments captured at a pixel sorted by depth, nearest
+        first.
+        @sa pick(unsigned int, unsigned int, unsigned int, unsigned int)
+        @version 0.9.0
+    */
+    PickedFragments pick(unsigned int x, unsigned int y) const;
+
+    /**
+       Return the fragments captured inside a rectangle sorted by depth,
+       nearest first. Fragments of different pixels are merged in a single
+       list, their pixel is given by the x and y fields.
+
+       The coordinates are relative to the lower left corner of the camera
+       viewport. When the viewport is captured in several tiles because of
+       the memory budget only the pixels of the current tile are returned,
+       so the results of all the capture callbacks of the frame have to be
+       merged.
+
+       The fragments are read back synchronously, which stalls the draw
+       thread until the capture is finished. It's meant to be called from
+       the capture callback when the application needs to pick, not every
+       frame. Fragments dropped by the alpha cut-off or a buffer overflow
+       are not returned.
+
+       @throw std::runtime_error if object IDs are not enabled.
+       @version 0.9.0
+    */
+    PickedFragments pick(unsigned int x, unsigned int y, unsigned int width,
+                         unsigned int height) const;
 
     /*
       Return the total number of fragments captured during rendering.
 
+      Fragments dropped due to a fragment buffer overflow are not taken into
+      account, the result is clamped to the buffer capacity.
+
       This function requires a GPU readback which has been measured to take
       in the order of 10ths of us of CPU time in the tested hardware, assuming
       that the operation doesn't have to wait for the fragment capture to be
@@ -175,9 +731,137 @@ private:
     void* _data;
 };
 
+/**
+   Asynchronous readback of the captured fragments.
+
+   An object of this class can be used as a capture callback or be called
+   from one. Each call copies the fragment counts and, if requested, the list
+   heads and the fragment buffer into a buffer object from a ring using only
+   GPU side copies and returns without waiting. In later calls, the copies
+   that the GPU has completed are detected with fences without blocking,
+   their buffers are mapped and handed to a worker thread that invokes the
+   consumer function, usually one or two frames after the capture. Buffers
+   are unmapped and returned to the ring in the first call after the consumer
+   has finished with them. If all the buffers of the ring are in use, the
+   frame is skipped.
+
+   Copying the fragment buffer requires a ring buffer as large as the
+   fragment buffer itself, so it should only be requested for dumps.
+
+   Copies of an object share the same ring and worker thread, which is
+   stopped when the last copy is destroyed. An object must only be used in
+   a single graphics context.
+
+   @version 0.9.0
+*/
+class OSGTRANSPARENCY_API FragmentReadback
+{
+public:
+    /** The data of a captured frame (or tile of a frame). The arrays point
+        to mapped buffers and are only valid during the consumer call. */
+    struct Frame
+    {
+        unsigned int frameNumber;
+        /** Size of the count and head textures */
+        unsigned int width;
+        unsigned int height;
+        FragmentListOITBin::Parameters::FragmentStorage storage;
+        unsigned int recordSize;
+        /** Same as FragmentData::isDeferredShading */
+        bool deferredShading;
+        /** True if the records are split, in which case fragments only
+            contains the depths and next indices, the colors are not read
+            back. */
+        bool splitRecords;
+        unsigned int fragmentsPerPage;
+        /** Same as FragmentData::getNumFragments */
+        size_t numFragments;
+        /** width * height fragment counts */
+        const uint32_t* counts;
+        /** width * height list heads, 0 if fragments are not read back. */
+        const uint32_t* heads;
+        /** numFragments * recordSize words, 0 if fragments are not read
+            back. */
+        const uint32_t* fragments;
+        /** numPages previous page links with PAGED_LISTS storage, 0
+            otherwise or if fragments are not read back. */
+        const uint32_t* pageLinks;
+        size_t numPages;
+    };
+
+    typedef boost::function<void(const Frame& frame)> Consumer;
+
+    /**
+       @param consumer Function called from the worker thread.
+       @param fragments If true, the list heads and the fragment buffer are
+              also read back.
+       @param ringSize Number of buffers in the ring, at least 2.
+    */
+    FragmentReadback(const Consumer& consumer, bool fragments = false,
+                     size_t ringSize = 3);
+
+    ~FragmentReadback();
+
+    /** Request the readback of the fragments of a capture and process the
+        readbacks of previous captures that have completed.
+        @return Always true, so it can be used directly as a CaptureCallback.
+    */
+    bool operator()(const FragmentData& data) const;
+
+    /** Number of frames skipped because the ring was full. */
+    size_t getSkippedFrames() const;
+
+private:
+    class _Impl;
+    boost::shared_ptr<_Impl> _impl;
+};
+
+/**
+   Print the histogram of the per pixel fragment counts and the total number
+   of fragments to the standard output.
+
+   The data is read back synchronously, which stalls the draw thread.
+   Use FragmentReadback with printFragmentStatistics to avoid it.
+*/
 bool extractFragmentStatistics(const FragmentData& data);
 
+/** @sa extractFragmentStatistics
+    @version 0.9.0 */
+void printFragmentStatistics(const FragmentReadback::Frame& frame);
+
+/**
+   Write the fragment counts, list heads and fragments to a dump file that
+   can be read with FragmentDump.
+
+   The data is read back synchronously, which stalls the draw thread.
+   Use FragmentReadback with writeFrame to avoid it.
+*/
 void writeTextures(const std::string& filename, const FragmentData& data);
+
+/** Write a frame read back asynchronously to a dump file that can be read
+    with FragmentDump.
+    @throw std::runtime_error if the frame doesn't include the fragments.
+    @version 0.9.0 */
+void writeFrame(const std::string& filename,
+                const FragmentReadback::Frame& frame);
+
+/**
+   Composite the captured fragments on the CPU with a FragmentCompositor.
+
+   The data is read back synchronously, which stalls the draw thread.
+   Use FragmentReadback with compositeFrame to avoid it.
+   @return The image composited on a transparent black background.
+   @version 0.9.0
+*/
+osg::ref_ptr<osg::Image> compositeFragments(const FragmentData& data,
+                                            FragmentCompositor& compositor);
+
+/** Composite a frame read back asynchronously on the CPU.
+    @return The image composited on a transparent black background.
+    @throw std::runtime_error if the frame doesn't include the fragments.
+    @version 0.9.0 */
+osg::ref_ptr<osg::Image> compositeFrame(const FragmentReadback::Frame& frame,
+                                        FragmentCompositor& compositor);
 }
 }
 
@@ -82,6 +82,12 @@ void MultiLayerDepthPeelingBin::sort()
        from OSG */
 }
 
+bool MultiLayerDepthPeelingBin::getFrameStats(const osg::State* state,
+                                              FrameStats& stats)
+{
+    return multilayer::DepthPeelingBin::getFrameStats(state, stats);
+}
+
 void MultiLayerDepthPeelingBin::drawImplementation(
     osg::RenderInfo& renderInfo, osgUtil::RenderLeaf*& previous)
 {
@@ -67,6 +67,21 @@ public:
 
     virtual void sort();
 
+    /** Return the statistics of the last frame drawn in a graphics context.
+
+        The passes are the peel passes of the frame. When several cameras
+        are rendered in the same context, the statistics returned are the
+        ones of the camera rendered last. This function is thread-safe.
+
+        @param state The state object of the graphics context.
+        @param stats The statistics. Left untouched if the function returns
+               false.
+        @return false if no frame statistics are available yet for the
+                given context.
+        @version 0.9.0
+    */
+    static bool getFrameStats(const osg::State *state, FrameStats &stats);
+
 protected:
     /*--- Protected member functions ---*/
 
@@ -44,6 +44,9 @@ public:
     const QuantileList splitPointQuantiles;
     const bool unprojectDepths;
     const bool alphaAwarePartition;
+    const bool temporalDepthPartition;
+    const bool histogramDepthPartition;
+    const unsigned int depthPartitionTileSize;
 
     /*--- Public constructors/destructor ---*/
 
@@ -51,32 +54,55 @@ public:
        Creates a Parameters object
 
        @param slices Number of depth slices to use for depth peeling. A number
-                  between 1 and 8.
+                  between 1 and 8, or between 1 and 32 in GL3. In GL3 the
+                  number of slices is reduced if the OpenGL context doesn't
+                  have enough draw buffers or texture units, and histogram
+                  depth partitions are used for more than 8 slices.
        @param unprojectDepths Whether use unprojected z values or not.
        @param alphaAwarePartition Adjust the quatiles for the depth partition
                   based on alpha values (This only makes sense if slices >= 2).
        @param superSampling Unimplemented
        @param opacityThreshold The accumulated opacity at a fragment at which
                   fragments behind can be considered completely occluded.
+       @param temporalDepthPartition Use the depth partition of the previous
+                  frame as the initial guess of the current one. The full
+                  search is only done for the pixels for which the guess
+                  fails (GL3 only).
+       @param histogramDepthPartition Compute the depth partition from a
+                  per pixel depth histogram accumulated in a single pass
+                  instead of using the iterative search (GL3 only).
+       @param depthPartitionTileSize Side in pixels of the square screen
+                  tiles for which the split points are computed from the
+                  union of their fragments. Only used by histogram depth
+                  partitions.
 
        Default values for unspecified arguments are
        * opacityThreshold: 0.99
        * splitPointQuantiles: [0.5]
        * unprojectDepths: false
        * alphaAwarePartition: false
+       * temporalDepthPartition: false
+       * histogramDepthPartition: false
+       * depthPartitionTileSize: 1
 
        The following environmental variables are looked up to override
        defaults:
        * OSGTRANSPARENCY_REPROJECT_QUANTILES
        * OSGTRANSPARENCY_ALPHA_AWARE_PARTITION
        * OSGTRANSPARENCY_OPACITY_THRESHOLD
+       * OSGTRANSPARENCY_TEMPORAL_DEPTH_PARTITION
+       * OSGTRANSPARENCY_HISTOGRAM_DEPTH_PARTITION
+       * OSGTRANSPARENCY_DEPTH_PARTITION_TILE_SIZE
        * OSGTRANSPARENCY_SPLIT_QUANTILES: A list of exact quantiles to use
        instead of even spacing.
     */
     Parameters(OptUInt slices = OptUInt(), OptBool unprojectDepths = OptBool(),
                OptBool alphaAwarePartition = OptBool(),
                OptUInt superSampling = 1,
-               OptFloat opacityThreshold = OptFloat());
+               OptFloat opacityThreshold = OptFloat(),
+               OptBool temporalDepthPartition = OptBool(),
+               OptBool histogramDepthPartition = OptBool(),
+               OptUInt depthPartitionTileSize = OptUInt());
 
     /*--- Public member functions ---*/
 
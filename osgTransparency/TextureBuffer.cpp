@@ -96,6 +96,7 @@ public:
 */
 TextureBuffer::TextureBuffer()
     : _textureWidth(0)
+    , _shaderStorageIndex(-1)
 {
 }
 
@@ -104,6 +105,7 @@ TextureBuffer::TextureBuffer(const TextureBuffer& other,
     : osg::Texture(other)
     , _image(copyOp(other._image.get()))
     , _textureWidth(other._textureWidth)
+    , _shaderStorageIndex(other._shaderStorageIndex)
 {
     abort(); // just in case
 }
@@ -155,6 +157,7 @@ void TextureBuffer::apply(osg::State& state) const
         textureObject->bind();
         _textureBufferObject->bindTextureBuffer(state, _internalFormat);
         _bindImageTexture(state, textureObject);
+        _bindShaderStorage(state);
     }
     else if ((_image.valid() && _image->data()) || _subloadCallback.valid())
     {
@@ -190,6 +193,7 @@ void TextureBuffer::apply(osg::State& state) const
         textureObject->bind();
         _textureBufferObject->bindTextureBuffer(state, _internalFormat);
         _bindImageTexture(state, textureObject);
+        _bindShaderStorage(state);
     }
     else
     {
@@ -249,5 +253,18 @@ void TextureBuffer::_bindImageTexture(osg::State& state,
         getTextureParameterDirty(contextID) = false;
     }
 }
+
+void TextureBuffer::_bindShaderStorage(osg::State& state) const
+{
+    if (_shaderStorageIndex < 0)
+        return;
+    /* Bound on every apply, the binding point may have been reused by other
+       state since the last time. */
+    const osg::GLExtensions* extensions = state.get<osg::GLExtensions>();
+    osg::GLBufferObject* buffer =
+        _textureBufferObject->getOrCreateGLBufferObject(state.getContextID());
+    extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, _shaderStorageIndex,
+                                 buffer->getGLObjectID());
+}
 }
 }
@@ -116,6 +116,12 @@ public:
 
     osg::GLBufferObject* getGLBufferObject(unsigned int contextID);
 
+    /** Also bind the buffer object to an indexed shader storage buffer
+        binding point whenever the texture is applied. A negative index
+        disables it, which is the default. */
+    void bindToShaderStorage(int index) { _shaderStorageIndex = index; }
+    int getShaderStorageIndex() const { return _shaderStorageIndex; }
+
 protected:
     /*--- Protected member functions ---*/
     virtual void computeInternalFormat() const;
@@ -138,9 +144,12 @@ private:
 
     mutable GLsizei _textureWidth;
 
+    int _shaderStorageIndex;
+
     /*--- Private member functions ---*/
     void _bindImageTexture(osg::State& state,
                            TextureObject* textureObject) const;
+    void _bindShaderStorage(osg::State& state) const;
 };
 }
 }
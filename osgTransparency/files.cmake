@@ -11,6 +11,8 @@ set(OSGTRANSPARENCY_PUBLIC_HEADERS
   BaseRenderBin.h
   BaseParameters.h
   DepthPeelingBin.h
+  FragmentCompositor.h
+  FragmentDump.h
   FragmentListOITBin.h
   MultiLayerDepthPeelingBin.h
   MultiLayerParameters.h
@@ -24,9 +26,13 @@ set(OSGTRANSPARENCY_HEADERS
   multilayer/DepthPartitioner.h
   multilayer/DepthPeelingBin.h
   multilayer/GL3IterativeDepthPartitioner.h
+  multilayer/HistogramDepthPartitioner.h
   multilayer/IterativeDepthPartitioner.h
+  util/CameraCache.h
+  util/FrameStatsTracker.h
   util/Stats.h
   util/ShapeData.h
+  util/SortingNetwork.h
   util/TextureDebugger.h
   util/constants.h
   util/extensions.h
@@ -43,6 +49,8 @@ set(OSGTRANSPARENCY_SOURCES
   BaseParameters.cpp
   BaseRenderBin.cpp
   DepthPeelingBin.cpp
+  FragmentCompositor.cpp
+  FragmentDump.cpp
   FragmentListOITBin.cpp
   OcclusionQueryGroup.cpp
   MultiLayerDepthPeelingBin.cpp
@@ -52,6 +60,7 @@ set(OSGTRANSPARENCY_SOURCES
   multilayer/Context.cpp
   multilayer/Parameters.cpp
   util/GPUTimer.cpp
+  util/SortingNetwork.cpp
   util/TextureDebugger.cpp
   util/constants.cpp
   util/glerrors.cpp
@@ -68,6 +77,7 @@ list(APPEND OSGTRANSPARENCY_SOURCES
 if(OSG_GL3_AVAILABLE)
   list(APPEND OSGTRANSPARENCY_SOURCES
     multilayer/GL3IterativeDepthPartitioner.cpp
+    multilayer/HistogramDepthPartitioner.cpp
     TextureBuffer.cpp)
 
   list(APPEND OSGTRANSPARENCY_PUBLIC_HEADERS
@@ -30,6 +30,7 @@
 #include "Context.h"
 #ifdef OSG_GL3_AVAILABLE
 #include "GL3IterativeDepthPartitioner.h"
+#include "HistogramDepthPartitioner.h"
 #else
 #include "IterativeDepthPartitioner.h"
 #endif
@@ -53,6 +54,7 @@
 #include <boost/format.hpp>
 #include <boost/lambda/lambda.hpp>
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 
@@ -75,8 +77,17 @@ const bool QUERY_LATENCY =
         : 1;
 const bool USE_GL_ANY_SAMPLES =
     ::getenv("OSGTRANSPARENCY_USE_GL_ANY_SAMPLES") != 0;
+const bool GPU_TIMING = ::getenv("OSGTRANSPARENCY_GPU_TIMING") != 0;
 #ifdef OSG_GL3_AVAILABLE
 const GLenum COLOR_BUFFER_FORMAT = GL_RGBA16F;
+
+DepthPartitioner* _createDepthPartitioner(const Parameters& parameters)
+{
+    if (parameters.histogramDepthPartition ||
+        parameters.getNumSlices() > MAX_ITERATIVE_PARTITION_SLICES)
+        return new HistogramDepthPartitioner(parameters);
+    return new GL3IterativeDepthPartitioner(parameters);
+}
 #endif
 }
 
@@ -94,11 +105,11 @@ Canvas::Canvas(osg::RenderInfo& renderInfo, Context* context)
     , _lastSamplesPassed(0)
     , _timesSamplesRepeated(0)
 #ifdef OSG_GL3_AVAILABLE
-    , _depthPartitioner(
-          new GL3IterativeDepthPartitioner(context->getParameters()))
+    , _depthPartitioner(_createDepthPartitioner(context->getParameters()))
 #else
     , _depthPartitioner(new IterativeDepthPartitioner(context->getParameters()))
 #endif
+    , _gpuTimer(renderInfo.getState())
 
 {
     _camera->addObserver(this);
@@ -136,6 +147,32 @@ Canvas::~Canvas()
 /*
   Member functions
 */
+unsigned int Canvas::getMaxSlices(const Parameters& parameters)
+{
+#ifdef OSG_GL3_AVAILABLE
+    GLint drawBuffers = 0;
+    GLint textureUnits = 0;
+    glGetIntegerv(GL_MAX_DRAW_BUFFERS, &drawBuffers);
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &textureUnits);
+
+    /* Two slices per depth buffer, all written in each peel pass. */
+    unsigned int slices =
+        std::min(drawBuffers, int(MAX_COLOR_BUFFERS)) * 2;
+    /* The peel pass samples the depth buffer array, the front and back
+       color arrays and one partition texture per 4 split points. The user
+       given shaders take the reserved units. */
+    const int partitionUnits =
+        textureUnits - int(parameters.reservedTextureUnits) - 3;
+    if (partitionUnits < 1)
+        return 1;
+    slices = std::min(slices, unsigned(partitionUnits) * 4 + 1);
+    return std::min(slices, MAX_SLICES);
+#else
+    (void)parameters;
+    return MAX_SLICES;
+#endif
+}
+
 bool Canvas::valid(const osg::Camera* camera)
 {
     if (!_camera)
@@ -156,6 +193,24 @@ bool Canvas::valid(const osg::Camera* camera)
     return _camera == camera && width <= _maxWidth && height <= _maxHeight;
 }
 
+size_t Canvas::getMemoryUsage() const
+{
+    if (!_peelFBO.valid())
+        return 0;
+
+    const unsigned int slices = _context->getParameters().getNumSlices();
+    /* Ping-pong RGBA32F depth textures */
+    size_t perPixel = (slices + 1) / 2 * 2 * 16;
+#ifdef OSG_GL3_AVAILABLE
+    /* Front and back RGBA16F color arrays */
+    perPixel += 2 * slices * 8;
+#else
+    /* RGBA32F peel targets and RGBA16F blend targets */
+    perPixel += (slices + 3) / 4 * 2 * 16 + slices * 2 * 8;
+#endif
+    return perPixel * _maxWidth * _maxHeight;
+}
+
 bool Canvas::checkFinished()
 {
     if (!_pass)
@@ -251,7 +306,12 @@ void Canvas::startFrame(MultiLayerDepthPeelingBin* bin,
     if (slices > 1)
     {
         /* Split point calculations */
+        if (GPU_TIMING)
+            _gpuTimer.start("depth_partition",
+                            state.getFrameStamp()->getFrameNumber());
         _depthPartitioner->computeDepthPartition(bin, renderInfo, previous);
+        if (GPU_TIMING)
+            _gpuTimer.stop();
         if (DepthPeelingBin::PROFILE_DEPTH_PARTITION)
             _depthPartitioner->profileDepthPartition(bin, renderInfo, previous);
     }
@@ -306,6 +366,10 @@ void Canvas::startFrame(MultiLayerDepthPeelingBin* bin,
         }
     }
 #endif
+
+    /* The peel and blend passes are timed together until finishFrame */
+    if (GPU_TIMING)
+        _gpuTimer.start("peel", state.getFrameStamp()->getFrameNumber());
 }
 
 void Canvas::peel(MultiLayerDepthPeelingBin* bin, osg::RenderInfo& renderInfo)
@@ -380,18 +444,21 @@ void Canvas::_createBuffersAndTextures()
     _blendBuffers[1] = new osg::FrameBufferObject();
     _auxiliaryBuffer = new osg::FrameBufferObject();
 
-    /* Creating ping-pong depth textures */
-    for (unsigned int i = 0; i < (slices + 1) / 2; ++i)
+#ifdef OSG_GL3_AVAILABLE
+    /* Creating ping-pong depth texture arrays. Each layer is attached to
+       a different draw buffer in the peel passes. */
+    for (unsigned int i = 0; i < 2; ++i)
     {
-        _depthTextures[i][0] =
-            createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight,
-                                                 GL_RGBA32F_ARB);
-        _depthTextures[i][1] =
-            createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight,
-                                                 GL_RGBA32F_ARB);
+        osg::Texture2DArray* depths = new osg::Texture2DArray();
+        depths->setTextureSize(_maxWidth, _maxHeight, (slices + 1) / 2);
+        depths->setInternalFormat(GL_RGBA32F_ARB);
+        depths->setSourceFormat(GL_RGBA);
+        depths->setSourceType(GL_FLOAT);
+        depths->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+        depths->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+        _depthTextures[i] = depths;
     }
 
-#ifdef OSG_GL3_AVAILABLE
     /* Creating one texture array for the front layers of each slice
        and another one for the back layers. */
     for (unsigned int i = 0; i < 2; ++i)
@@ -406,6 +473,17 @@ void Canvas::_createBuffersAndTextures()
             _backColors = colors;
     }
 #else
+    /* Creating ping-pong depth textures */
+    for (unsigned int i = 0; i < (slices + 1) / 2; ++i)
+    {
+        _depthTextures[i][0] =
+            createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight,
+                                                 GL_RGBA32F_ARB);
+        _depthTextures[i][1] =
+            createTexture<osg::TextureRectangle>(_maxWidth, _maxHeight,
+                                                 GL_RGBA32F_ARB);
+    }
+
     const unsigned int numColorTextures = ((slices + 3) / 4) * 2;
     const unsigned int numDepthBuffers = (slices + 1) / 2;
     for (unsigned int i = 0; i < numColorTextures; ++i)
@@ -436,6 +514,17 @@ void Canvas::finishFrame(osg::RenderInfo& renderInfo)
 {
     osg::State& state = *renderInfo.getState();
 
+    if (GPU_TIMING)
+    {
+        _gpuTimer.stop();
+        _gpuTimer.checkQueries();
+        _gpuTimer.reportCompleted(std::cout);
+    }
+    FrameStats stats;
+    if (_frameStatsTracker.update(state.getFrameStamp()->getFrameNumber(),
+                                  _pass, GPU_TIMING ? &_gpuTimer : 0, stats))
+        _context->setFrameStats(stats);
+
 #if !defined OSG_GL3_AVAILABLE && !defined NDEBUG
     if (::getenv("OSGTRANSPARENCY_SHOW_BLEND_TEXTURE"))
     {
@@ -524,8 +613,6 @@ void Canvas::_createPeelStateSet()
     Uniforms uniforms;
 
     const Parameters& parameters = _context->getParameters();
-    const unsigned int slices = parameters.getNumSlices();
-    const unsigned int numDepthBuffers = (slices + 1) / 2;
 
     _peelStateSet = new osg::StateSet;
     modes[GL_DEPTH] = OFF;
@@ -540,11 +627,9 @@ void Canvas::_createPeelStateSet()
        will produce an invalid operation error). */
     int nextIndex = parameters.reservedTextureUnits;
 
-    /* Uniforms for depth buffer textures. */
-    insertTextureArrayUniform(uniforms, "depthBuffers", nextIndex,
-                              numDepthBuffers);
-    nextIndex += numDepthBuffers;
 #ifdef OSG_GL3_AVAILABLE
+    /* Uniform for the depth buffer texture array. */
+    uniforms.insert(new osg::Uniform("depthBuffers", nextIndex++));
     /* Output color uniforms for image units */
 
     /* Uniforms for image and texture units with the slice color buffers. */
@@ -555,6 +640,14 @@ void Canvas::_createPeelStateSet()
     uniforms.insert(new osg::Uniform("frontOutColor", 0));
     uniforms.insert(new osg::Uniform("backOutColor", 1));
 #else
+    const unsigned int slices = parameters.getNumSlices();
+    const unsigned int numDepthBuffers = (slices + 1) / 2;
+
+    /* Uniforms for depth buffer textures. */
+    insertTextureArrayUniform(uniforms, "depthBuffers", nextIndex,
+                              numDepthBuffers);
+    nextIndex += numDepthBuffers;
+
     /* Textures where front and back layers of each slices are blended */
     osg::ref_ptr<osg::TextureRectangle> frontBlendedTextures[8];
     for (unsigned int i = 0; i < slices; ++i)
@@ -687,6 +780,18 @@ void Canvas::_preparePeelFBOAndTextures(osg::RenderInfo& renderInfo)
     const unsigned int numDepthBuffers = (numSlices + 1) / 2;
 
     /* Setting up the peel FBO attachments and texture units for this pass. */
+#ifdef OSG_GL3_AVAILABLE
+    for (unsigned int i = 0; i < numDepthBuffers; ++i)
+    {
+        osg::FrameBufferAttachment depth(_depthTextures[_index].get(), i);
+        _peelFBO->setAttachment(COLOR_BUFFERS[i], depth);
+    }
+    if (_pass != 0)
+    {
+        _peelStateSet->setTextureAttributeAndModes(
+            parameters.reservedTextureUnits, _depthTextures[1 - _index].get());
+    }
+#else
     for (unsigned int i = 0; i < numDepthBuffers; ++i)
     {
         osg::FrameBufferAttachment depth(_depthTextures[i][_index].get());
@@ -698,6 +803,7 @@ void Canvas::_preparePeelFBOAndTextures(osg::RenderInfo& renderInfo)
                 _depthTextures[i][1 - _index].get());
         }
     }
+#endif
     _peelFBO->apply(state);
 
 #ifdef OSG_GL3_AVAILABLE
@@ -853,7 +959,12 @@ void Canvas::_showPeelPassTextures(osg::State& state)
             wname << "output depth texture, pass " << _pass << ", slice" << i;
             depth[_pass * slices + i].setWindowName(wname.str());
             depth[_pass * slices + i].renderTexture(
-                state.getGraphicsContext(), _depthTextures[0][_index].get(),
+                state.getGraphicsContext(),
+#ifdef OSG_GL3_AVAILABLE
+                _depthTextures[_index].get(), i / 2,
+#else
+                _depthTextures[0][_index].get(),
+#endif
                 TextureDebugger::GLSL(i % 2 ? "vec4 transform(vec4 x) {return "
                                               "vec4(-x.r, x.g, 0, 1);}\n"
                                             : "vec4 transform(vec4 x) {return "
@@ -25,6 +25,8 @@
 
 #include "DepthPeelingBin.h"
 
+#include "osgTransparency/util/FrameStatsTracker.h"
+#include "osgTransparency/util/GPUTimer.h"
 #include "osgTransparency/util/constants.h"
 #include "osgTransparency/util/helpers.h"
 
@@ -51,6 +53,16 @@ public:
 
     /*--- Public member functions ---*/
 
+    /**
+       The maximum number of slices supported by the current OpenGL context
+       with the texture unit layout of the given parameters.
+       Must be called with the context current. In GL3 the limit comes from
+       the draw buffers needed for the depth buffers and the texture units
+       needed by the peel pass. Only two image units are needed regardless
+       of the number of slices.
+    */
+    static unsigned int getMaxSlices(const Parameters& parameters);
+
     unsigned int getWidth() const
     {
         return static_cast<unsigned int>(_camera->getViewport()->width());
@@ -71,6 +83,9 @@ public:
 
     bool valid(const osg::Camera* camera);
 
+    /** Approximate GPU memory used by the textures of this canvas */
+    size_t getMemoryUsage() const;
+
     bool checkFinished();
 
     void startFrame(MultiLayerDepthPeelingBin* bin, osg::RenderInfo& renderInfo,
@@ -118,11 +133,13 @@ private:
 
     /* Textures and buffers */
     osg::ref_ptr<osg::FrameBufferObject> _peelFBO;
-    osg::ref_ptr<osg::TextureRectangle> _depthTextures[MAX_DEPTH_BUFFERS][2];
 #ifdef OSG_GL3_AVAILABLE
+    /* Ping-pong depth buffers, one layer per depth buffer */
+    osg::ref_ptr<osg::Texture2DArray> _depthTextures[2];
     osg::ref_ptr<osg::Texture2DArray> _frontColors;
     osg::ref_ptr<osg::Texture2DArray> _backColors;
 #else
+    osg::ref_ptr<osg::TextureRectangle> _depthTextures[MAX_DEPTH_BUFFERS][2];
     osg::ref_ptr<osg::TextureRectangle> _colorTextures[MAX_SLICES];
     osg::ref_ptr<osg::TextureRectangle>
         _targetBlendColorTextures[MAX_SLICES * 2];
@@ -145,6 +162,8 @@ private:
     osg::ref_ptr<osg::Geometry> _quad;
     osg::ref_ptr<DepthPartitioner> _depthPartitioner;
     osg::ref_ptr<OcclusionQueryGroup> _queryGroup;
+    GPUTimer _gpuTimer;
+    FrameStatsTracker _frameStatsTracker;
 
     /*--- Private member functions ---*/
 
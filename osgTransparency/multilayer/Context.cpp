@@ -53,6 +53,7 @@
 
 #include <boost/format.hpp>
 
+#include <iostream>
 #include <map>
 
 #if defined(__APPLE__)
@@ -79,6 +80,8 @@ Context::Context(const Parameters& parameters)
     , _id(0)
     , _savedStackPosition(0)
     , _parameters(parameters)
+    , _limitsChecked(false)
+    , _hasFrameStats(false)
 {
 }
 
@@ -95,7 +98,12 @@ Context::~Context()
 
 bool Context::updateParameters(const Parameters& parameters)
 {
-    return _parameters.update(parameters);
+    if (!_parameters.update(parameters))
+        return false;
+    /* The slices are different, but the rest of attributes can be updated */
+    if (_limitedParameters)
+        _limitedParameters->BaseRenderBin::Parameters::update(parameters);
+    return true;
 }
 
 void Context::startFrame(MultiLayerDepthPeelingBin* bin,
@@ -116,12 +124,17 @@ void Context::startFrame(MultiLayerDepthPeelingBin* bin,
     state.captureCurrentState(*_oldState);
 #endif
 
+    if (!_limitsChecked)
+        _checkContextLimits();
+
     osg::Camera* camera = renderInfo.getCurrentCamera();
+    _canvas = _canvases.find(camera);
     if (_canvas == 0 || !_canvas->valid(camera))
     {
         _id = state.getContextID();
         /* Creating a new canvas for the camera */
         _canvas = new Canvas(renderInfo, this);
+        _canvases.insert(camera, _canvas);
     }
 
     _canvas->startFrame(bin, renderInfo, previous);
@@ -150,6 +163,44 @@ void Context::finishFrame(osg::RenderInfo& renderInfo,
 #endif
 }
 
+bool Context::getFrameStats(FrameStats& stats) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+    if (!_hasFrameStats)
+        return false;
+    stats = _frameStats;
+    return true;
+}
+
+void Context::setFrameStats(const FrameStats& stats)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_statsMutex);
+    _hasFrameStats = true;
+    _frameStats = stats;
+}
+
+void Context::_checkContextLimits()
+{
+    _limitsChecked = true;
+
+    const unsigned int slices = _parameters.getNumSlices();
+    const unsigned int maxSlices = Canvas::getMaxSlices(_parameters);
+    if (slices <= maxSlices)
+        return;
+
+    std::cerr << "osgTransparency: " << slices << " slices are not supported"
+              << " by this OpenGL context, using " << maxSlices << std::endl;
+    _limitedParameters.reset(new Parameters(
+        maxSlices, _parameters.unprojectDepths,
+        _parameters.alphaAwarePartition, _parameters.superSampling,
+        _parameters.opacityThreshold, _parameters.temporalDepthPartition,
+        _parameters.histogramDepthPartition,
+        _parameters.depthPartitionTileSize));
+    _limitedParameters->BaseRenderBin::Parameters::update(_parameters);
+    _limitedParameters->reservedTextureUnits = _parameters.reservedTextureUnits;
+    _limitedParameters->singleQueryPerPass = _parameters.singleQueryPerPass;
+}
+
 void Context::_updateFrameStamp(BaseRenderBin* bin, osg::RenderInfo& renderInfo)
 {
     osgViewer::Renderer* renderer = dynamic_cast<osgViewer::Renderer*>(
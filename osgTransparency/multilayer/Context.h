@@ -26,12 +26,17 @@
 #include "DepthPeelingBin.h"
 
 #include "osgTransparency/MultiLayerParameters.h"
+#include "osgTransparency/util/CameraCache.h"
 #include "osgTransparency/util/constants.h"
 
 #include <osg/FrameBufferObject>
 #include <osg/Texture2DArray>
 #include <osg/TextureRectangle>
 
+#include <OpenThreads/Mutex>
+
+#include <boost/scoped_ptr.hpp>
+
 namespace bbp
 {
 namespace osgTransparency
@@ -55,7 +60,12 @@ public:
 
     /*--- Public member functions ---*/
 
-    const Parameters& getParameters() const { return _parameters; }
+    /** The parameters in use, which may have less slices than the ones
+        requested if the OpenGL context can't handle them. */
+    const Parameters& getParameters() const
+    {
+        return _limitedParameters ? *_limitedParameters : _parameters;
+    }
     /** Returns false if new parameters are incompatible with this context */
     bool updateParameters(const Parameters& parameters);
 
@@ -68,16 +78,29 @@ public:
                      osgUtil::RenderLeaf*& previous);
 
     const osg::FrameStamp* getFrameStamp() { return _frameStamp.get(); }
+
+    /** Thread-safe. Returns false if no frame has been completed yet. */
+    bool getFrameStats(FrameStats& stats) const;
+    /** Called by the canvases to publish the stats of a completed frame */
+    void setFrameStats(const FrameStats& stats);
+
 private:
     /*--- Private member variables ---*/
 
     unsigned int _id;
+    /* Canvas of the camera being rendered */
     osg::ref_ptr<Canvas> _canvas;
+    /* Canvases of the cameras rendered recently */
+    CameraCache<osg::ref_ptr<Canvas>> _canvases;
 
     GLint _previousFBO;
     unsigned int _savedStackPosition;
 
     Parameters _parameters;
+    /* Copy of _parameters with the number of slices reduced to the limits
+       of the OpenGL context. Only created if needed. */
+    boost::scoped_ptr<Parameters> _limitedParameters;
+    bool _limitsChecked;
 
 #ifndef NDEBUG
     osg::ref_ptr<osg::StateSet> _oldState;
@@ -85,6 +108,10 @@ private:
 
     osg::ref_ptr<const osg::FrameStamp> _frameStamp;
 
+    mutable OpenThreads::Mutex _statsMutex;
+    bool _hasFrameStats;
+    FrameStats _frameStats;
+
     /*--- Private member functions ---*/
 
     /**
@@ -97,6 +124,10 @@ private:
        frame.
      */
     void _updateFrameStamp(BaseRenderBin* bin, osg::RenderInfo& renderInfo);
+
+    /** Reduces the number of slices if the context doesn't have enough
+        draw buffers or texture units for them. */
+    void _checkContextLimits();
 };
 }
 }
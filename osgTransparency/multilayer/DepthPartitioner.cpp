@@ -119,6 +119,9 @@ void DepthPartitioner::addDepthPartitionExtraShaders(ProgramMap& programs)
     vars["DEFINES"] = str(format("#define SLICES %1%\n") % slices);
     if (_parameters.alphaAwarePartition && slices > 1)
         vars["DEFINES"] += "#define ADJUST_QUANTILES_WITH_ALPHA\n";
+    if (getTileSize() > 1)
+        vars["DEFINES"] +=
+            str(format("#define PARTITION_TILE_SIZE %1%\n") % getTileSize());
     std::string code = readSourceAndReplaceVariables(
         "multilayer/depth_partition/check_partition.frag", vars);
 
@@ -86,6 +86,12 @@ public:
     virtual osg::ref_ptr<osg::TextureRectangle>*
         getDepthPartitionTextureArray() = 0;
 
+    /**
+       Side in pixels of the square screen tiles that share the same split
+       points. The depth partition textures have one texel per tile.
+    */
+    virtual unsigned int getTileSize() const { return 1; }
+
 protected:
     /*--- Protected member attributes ---*/
 
@@ -104,6 +110,16 @@ protected:
                     queryGroup);
     }
 
+#ifdef OSG_GL3_AVAILABLE
+    void renderBounds(MultiLayerDepthPeelingBin* bin,
+                      osg::RenderInfo& renderInfo, osg::StateSet* baseStateSet,
+                      osg::Program* program, BoundsInstances& instances,
+                      osg::RefMatrix* projection = 0)
+    {
+        bin->renderBounds(renderInfo, baseStateSet, program, instances,
+                          projection);
+    }
+#else
     void renderBounds(MultiLayerDepthPeelingBin* bin,
                       osg::RenderInfo& renderInfo, osg::StateSet* baseStateSet,
                       ProgramMap& programs, BoundShapesStorage& shapes,
@@ -112,6 +128,7 @@ protected:
         bin->renderBounds(renderInfo, baseStateSet, programs, shapes,
                           projection);
     }
+#endif
 };
 }
 }
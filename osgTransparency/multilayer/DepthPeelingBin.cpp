@@ -119,6 +119,16 @@ Context &DepthPeelingBin::getContext(const osg::State &state,
 
     return *context;
 }
+
+bool DepthPeelingBin::getFrameStats(const osg::State *state,
+                                    FrameStats &stats)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_contextMapMutex);
+    ContextMap::const_iterator entry = s_contextMap.find(state);
+    if (entry == s_contextMap.end())
+        return false;
+    return entry->second->getFrameStats(stats);
+}
 }
 }
 }
@@ -32,6 +32,7 @@ namespace osgTransparency
 namespace multilayer
 {
 typedef MultiLayerDepthPeelingBin::Parameters Parameters;
+typedef MultiLayerDepthPeelingBin::FrameStats FrameStats;
 
 class Context;
 
@@ -60,6 +61,8 @@ public:
     static Context &getContext(const osg::State &state,
                                const Parameters &options);
 
+    static bool getFrameStats(const osg::State *state, FrameStats &stats);
+
 private:
     /*--- Private member attributes ---*/
     typedef boost::shared_ptr<Context> ContextPtr;
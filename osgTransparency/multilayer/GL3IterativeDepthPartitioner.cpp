@@ -36,8 +36,13 @@
 #include <osg/FrameBufferObject>
 #include <osg/Geometry>
 #include <osg/TextureRectangle>
+#include <osg/Version>
 #include <osg/io_utils>
 
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+#include <osg/ContextData>
+#endif
+
 #include <boost/format.hpp>
 
 #include <iostream>
@@ -76,6 +81,23 @@ const unsigned int ITERATIONS =
 const bool ACCURATE_PIXEL_MIN_MAX =
     ::getenv("OSGTRANSPARENCY_NO_ACCURATE_MINMAX") == 0;
 const bool HALF_FLOAT_MIN_MAX_TEXTURE = !ACCURATE_PIXEL_MIN_MAX;
+
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+class QueryObjectManager : public osg::GLObjectManager
+{
+public:
+    QueryObjectManager(unsigned int contextID)
+        : osg::GLObjectManager("osgTransparency::QueryObjectManager", contextID)
+    {
+    }
+
+    virtual void deleteGLObject(GLuint handler)
+    {
+        const osg::GLExtensions* ext = osg::GLExtensions::Get(_contextID, true);
+        ext->glDeleteQueries(1, &handler);
+    }
+};
+#endif
 }
 
 /*
@@ -256,9 +278,24 @@ static struct GL3IterativeDepthPartitioner::DebugHelpers
 GL3IterativeDepthPartitioner::GL3IterativeDepthPartitioner(
     const Parameters& parameters)
     : DepthPartitioner(parameters)
+    , _currentHistory(0)
+    , _historyValid(false)
+    , _failuresQuery(0)
+    , _contextID(0)
+    , _bounds(parameters.reservedTextureUnits + 1)
 {
 }
 
+GL3IterativeDepthPartitioner::~GL3IterativeDepthPartitioner()
+{
+/* The query object is leaked in older versions of OSG. */
+#if OSG_VERSION_GREATER_OR_EQUAL(3, 5, 0)
+    if (_failuresQuery != 0)
+        osg::get<QueryObjectManager>(_contextID)
+            ->scheduleGLObjectForDeletion(_failuresQuery);
+#endif
+}
+
 /*
   Member functions
 */
@@ -288,25 +325,41 @@ void GL3IterativeDepthPartitioner::computeDepthPartition(
         }
     }
 
+    osg::Viewport* viewport = renderInfo.getCurrentCamera()->getViewport();
+    _viewport->setViewport(0, 0, viewport->width(), viewport->height());
+    glScissor(0, 0, _viewport->width(), _viewport->height());
+
+    const bool temporal = _parameters.temporalDepthPartition;
+    if (temporal)
+    {
+        _currentHistory = 1 - _currentHistory;
+        _computeTemporalGuess(bin, renderInfo, previous);
+        /* The rest of the passes are skipped by the GPU if the guess was
+           right for all pixels. Otherwise they are restricted to the pixels
+           that failed. */
+        glBeginConditionalRender(_failuresQuery, GL_QUERY_WAIT);
+    }
+
     /* Getting the min and max depths */
     _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER0,
                                     osg::FrameBufferAttachment(
                                         _minMaxTexture.get()));
     _auxiliaryBuffer->apply(state);
 
-    osg::Viewport* viewport = renderInfo.getCurrentCamera()->getViewport();
-    _viewport->setViewport(0, 0, viewport->width(), viewport->height());
-    glScissor(0, 0, _viewport->width(), _viewport->height());
-
     glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
-    glClearColor(-1000000000.0, 0.0, 0.0, 0.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    /* In temporal mode the min/max depths of the pixels to search have been
+       already reset. */
+    if (!temporal)
+    {
+        glClearColor(-1000000000.0, 0.0, 0.0, 0.0);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
     /* Rendering scene */
-    if (!ACCURATE_PIXEL_MIN_MAX)
-        std::cerr << "Warning: approximate min/max depth computation"
-                     " is not available in GL3"
-                  << std::endl;
-    render(bin, renderInfo, previous, _minMax.get(), _minMaxPrograms);
+    if (ACCURATE_PIXEL_MIN_MAX)
+        render(bin, renderInfo, previous, _minMax.get(), _minMaxPrograms);
+    else
+        renderBounds(bin, renderInfo, _minMax.get(),
+                     _minMaxBoundsProgram.get(), _bounds);
     checkGLErrors("after min/max calculation");
 
     debug_helpers.readTexel("min/max", state, _minMaxTexture.get(), 2);
@@ -432,16 +485,7 @@ void GL3IterativeDepthPartitioner::computeDepthPartition(
     }
 
     /* Projecting final approximate quantiles */
-    _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER0,
-                                    osg::FrameBufferAttachment(
-                                        _depthPartitionTexture[0].get()));
-    if (_depthPartitionTexture[1].valid())
-        _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER1,
-                                        osg::FrameBufferAttachment(
-                                            _depthPartitionTexture[1].get()));
-    _auxiliaryBuffer->apply(state);
-    ext->glDrawBuffers(_depthPartitionTexture[1].valid() ? 2 : 1,
-                       &GL_BUFFER_NAMES[0]);
+    _applyPartitionOutputs(state, false);
     state.pushStateSet(_finalProjection.get());
     state.apply();
     state.applyProjectionMatrix(0);
@@ -450,10 +494,151 @@ void GL3IterativeDepthPartitioner::computeDepthPartition(
     state.popStateSet();
     checkGLErrors("after final reprojection");
 
+    if (temporal)
+    {
+        glEndConditionalRender();
+        _historyValid = true;
+    }
+
     debug_helpers.readTexels("final projection", state, _depthPartitionTexture,
                              points > 4 ? 2 : 1, 4);
 }
 
+void GL3IterativeDepthPartitioner::_computeTemporalGuess(
+    MultiLayerDepthPeelingBin* bin, osg::RenderInfo& renderInfo,
+    osgUtil::RenderLeaf*& previous)
+{
+    osg::State& state = *renderInfo.getState();
+    osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+
+    const unsigned int points = _parameters.splitPointQuantiles.size();
+    const unsigned int historyTextures = points / 4 + 1;
+
+    if (_failuresQuery == 0)
+    {
+        _contextID = state.getContextID();
+        ext->glGenQueries(1, &_failuresQuery);
+    }
+
+    _auxiliaryBuffer->apply(state);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+
+    if (!_historyValid)
+    {
+        /* There's no previous partition to start from, so all pixels go
+           through the full search. The history of pixels without fragments
+           is zeroed, a zero bin width rejects it as a guess. */
+        for (unsigned int i = 0; i < historyTextures; ++i)
+            clearTexture(state, _auxiliaryBuffer,
+                         _historyTextures[_currentHistory][i].get());
+        clearTexture(state, _auxiliaryBuffer, _failedPixelsTexture.get(),
+                     osg::Vec4(1, 1, 1, 1));
+    }
+    else
+    {
+        /* Counting the fragments in a bracket of bins around each split
+           point of the previous frame. */
+        for (unsigned int i = 0; i < points; ++i)
+        {
+            clearTexture(state, _auxiliaryBuffer, _countTextures[i].get());
+            _countTextures[i]->bindToImageUnit(i, osg::Texture::READ_WRITE);
+        }
+        const unsigned int leftTextures = (points + 3) / 4;
+        _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER0,
+                                        osg::FrameBufferAttachment(
+                                            _totalCountsTexture.get()));
+        for (unsigned int i = 0; i < leftTextures; ++i)
+            _auxiliaryBuffer->setAttachment(COLOR_BUFFERS[i + 1],
+                                            osg::FrameBufferAttachment(
+                                                _leftAccumTextures[i].get()));
+        _auxiliaryBuffer->apply(state);
+        ext->glDrawBuffers(leftTextures + 1, &GL_BUFFER_NAMES[0]);
+        glClearColor(0.0, 0.0, 0.0, 0.0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        render(bin, renderInfo, previous, _temporalCount[_currentHistory].get(),
+               _temporalCountPrograms);
+        ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        checkGLErrors("after temporal count");
+
+        /* Checking whether the quantiles are still inside the brackets and
+           refining them. */
+        _applyPartitionOutputs(state, true);
+        state.pushStateSet(_temporalResolve[_currentHistory].get());
+        state.apply();
+        state.applyProjectionMatrix(0);
+        state.applyModelViewMatrix(0);
+        _quad->draw(renderInfo);
+        state.popStateSet();
+        checkGLErrors("after temporal resolve");
+
+        debug_helpers.readTexel("temporal failure", state,
+                                _failedPixelsTexture.get(), 1);
+    }
+
+    /* Resetting the min/max depths of the pixels for which the guess
+       failed. The query tells whether there's any. */
+    _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER0,
+                                    osg::FrameBufferAttachment(
+                                        _minMaxTexture.get()));
+    _auxiliaryBuffer->apply(state);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    ext->glBeginQuery(GL_ANY_SAMPLES_PASSED, _failuresQuery);
+    state.pushStateSet(_temporalFailures.get());
+    state.apply();
+    state.applyProjectionMatrix(0);
+    state.applyModelViewMatrix(0);
+    _quad->draw(renderInfo);
+    state.popStateSet();
+    ext->glEndQuery(GL_ANY_SAMPLES_PASSED);
+    checkGLErrors("after temporal failure query");
+
+    previous = 0;
+}
+
+void GL3IterativeDepthPartitioner::_applyPartitionOutputs(
+    osg::State& state, const bool failedPixels)
+{
+    /* The shaders use fixed output locations: 0-1 for the split points,
+       2-3 for the history and 4 for the failed pixels. */
+    GLenum buffers[5] = {GL_BUFFER_NAMES[0], GL_NONE, GL_NONE, GL_NONE,
+                         GL_NONE};
+    GLsizei count = 1;
+    _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER0,
+                                    osg::FrameBufferAttachment(
+                                        _depthPartitionTexture[0].get()));
+    if (_depthPartitionTexture[1].valid())
+    {
+        _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER1,
+                                        osg::FrameBufferAttachment(
+                                            _depthPartitionTexture[1].get()));
+        buffers[1] = GL_BUFFER_NAMES[1];
+        count = 2;
+    }
+    if (_parameters.temporalDepthPartition)
+    {
+        osg::ref_ptr<osg::TextureRectangle>* history =
+            _historyTextures[_currentHistory];
+        for (unsigned int i = 0; i < 2 && history[i].valid(); ++i)
+        {
+            _auxiliaryBuffer->setAttachment(COLOR_BUFFERS[2 + i],
+                                            osg::FrameBufferAttachment(
+                                                history[i].get()));
+            buffers[2 + i] = GL_BUFFER_NAMES[2 + i];
+            count = 3 + i;
+        }
+        if (failedPixels)
+        {
+            _auxiliaryBuffer->setAttachment(osg::Camera::COLOR_BUFFER4,
+                                            osg::FrameBufferAttachment(
+                                                _failedPixelsTexture.get()));
+            buffers[4] = GL_BUFFER_NAMES[4];
+            count = 5;
+        }
+    }
+    _auxiliaryBuffer->apply(state);
+    state.get<osg::GLExtensions>()->glDrawBuffers(count, buffers);
+}
+
 void GL3IterativeDepthPartitioner::createBuffersAndTextures(
     const unsigned int width, const unsigned height)
 {
@@ -504,6 +689,20 @@ void GL3IterativeDepthPartitioner::createBuffersAndTextures(
     if (finalPoints > 4)
         _depthPartitionTexture[1] = createTexture<osg::TextureRectangle>(
             width, height, formats32[(finalPoints - 1) % 4]);
+
+    if (_parameters.temporalDepthPartition)
+    {
+        /* The bin width is stored after the last split point. */
+        for (unsigned int i = 0; i < 2; ++i)
+            for (unsigned int j = 0; j < points / 4 + 1; ++j)
+                _historyTextures[i][j] =
+                    createTexture<osg::TextureRectangle>(width, height,
+                                                         formats32[3]);
+        _failedPixelsTexture =
+            createTexture<osg::TextureRectangle>(width, height, GL_R8,
+                                                 GL_RED);
+        _historyValid = false;
+    }
 }
 
 void GL3IterativeDepthPartitioner::createStateSets()
@@ -524,6 +723,8 @@ void GL3IterativeDepthPartitioner::createStateSets()
     _createCountIterationStateSet(quantiles.size());
     _createFindQuantileIntervalsStateSet(quantiles);
     _createFinalReprojectionStateSet(quantiles.size());
+    if (_parameters.temporalDepthPartition)
+        _createTemporalStateSets(quantiles.size());
 
     _quad = createQuad();
 }
@@ -536,6 +737,8 @@ void GL3IterativeDepthPartitioner::updateShaderPrograms(
     _updateMinMaxCalculationPrograms(extraShaders);
     _updateFirstCountPrograms(extraShaders);
     _updateCountIterationPrograms(extraShaders, quantiles.size());
+    if (_parameters.temporalDepthPartition)
+        _updateTemporalCountPrograms(extraShaders, quantiles.size());
 }
 
 void GL3IterativeDepthPartitioner::_createMinMaxCalculationStateSet()
@@ -551,6 +754,9 @@ void GL3IterativeDepthPartitioner::_createMinMaxCalculationStateSet()
     attributes[_viewport] = ON_OVERRIDE_PROTECTED;
     attributes[new osg::BlendEquation(RGBA_MAX)] = ON_OVERRIDE;
     attributes[new osg::BlendFunc(GL_ONE, GL_ONE)] = ON_OVERRIDE;
+    if (_parameters.temporalDepthPartition)
+        setupTexture("failedPixels", _parameters.reservedTextureUnits,
+                     *_minMax, _failedPixelsTexture.get());
     setupStateSet(_minMax.get(), modes, attributes, uniforms);
 }
 
@@ -560,12 +766,22 @@ void GL3IterativeDepthPartitioner::_updateMinMaxCalculationPrograms(
     std::map<std::string, std::string> vars;
     if (HALF_FLOAT_MIN_MAX_TEXTURE)
         vars["DEFINES"] = "#define HALF_FLOAT_MINMAX\n";
+    if (_parameters.temporalDepthPartition)
+        vars["DEFINES"] += "#define TEMPORAL\n";
     std::string code =
         "//minmax.frag\n" +
         readSourceAndReplaceVariables(SHADER_PATH + "minmax.frag", vars);
     addPrograms(extraShaders, &_minMaxPrograms,
                 _vertex_shaders = strings(sm("trivialShadeVertex();")),
                 _fragment_shaders = strings(code));
+
+    if (!ACCURATE_PIXEL_MIN_MAX)
+    {
+        /* The bounding boxes are drawn without the extra shaders */
+        _minMaxBoundsProgram = addProgramImplementation(
+            strings("bounds.vert", "bounds.frag"), std::vector<std::string>(),
+            strings(code), std::string());
+    }
 }
 
 void GL3IterativeDepthPartitioner::_createFirstCountStateSet()
@@ -597,6 +813,11 @@ void GL3IterativeDepthPartitioner::_createFirstCountStateSet()
         _firstCount->setTextureAttributeAndModes(
             _parameters.reservedTextureUnits + 1 + i, _countTextures[i]);
     }
+    if (_parameters.temporalDepthPartition)
+        setupTexture("failedPixels",
+                     _parameters.reservedTextureUnits + 1 +
+                         _countTextures.size(),
+                     *_firstCount, _failedPixelsTexture.get());
 
     setupStateSet(_firstCount, modes, attributes, uniforms);
 }
@@ -607,6 +828,8 @@ void GL3IterativeDepthPartitioner::_updateFirstCountPrograms(
     std::map<std::string, std::string> vars;
     vars["DEFINES"] +=
         str(format("#define COUNT_TEXTURES %1%\n") % _countTextures.size());
+    if (_parameters.temporalDepthPartition)
+        vars["DEFINES"] += "#define TEMPORAL\n";
 
     std::string code =
         "//first_count.frag\n" +
@@ -713,6 +936,9 @@ void GL3IterativeDepthPartitioner::_createCountIterationStateSet(
         _countIteration->setTextureAttributeAndModes(nextIndex++,
                                                      _countTextures[i]);
     }
+    if (_parameters.temporalDepthPartition)
+        setupTexture("failedPixels", nextIndex++, *_countIteration,
+                     _failedPixelsTexture.get());
 
     /* Uniforms */
     uniforms.insert(_iteration.get());
@@ -727,6 +953,8 @@ void GL3IterativeDepthPartitioner::_updateCountIterationPrograms(
 {
     std::map<std::string, std::string> vars;
     vars["DEFINES"] = str(format("#define POINTS %1%\n") % points);
+    if (_parameters.temporalDepthPartition)
+        vars["DEFINES"] += "#define TEMPORAL\n";
     std::string code1 =
         "//find_interval.frag\n" +
         readSourceAndReplaceVariables(SHADER_PATH + "find_interval.frag", vars);
@@ -813,6 +1041,10 @@ void GL3IterativeDepthPartitioner::_createFinalReprojectionStateSet(
     setupTextureArray("codedPreviousIntervalsTextures", nextIndex,
                       *_finalProjection, numLeftTextures,
                       _codedIntervalsTextures);
+    nextIndex += numLeftTextures;
+    if (_parameters.temporalDepthPartition)
+        setupTexture("failedPixels", nextIndex++, *_finalProjection,
+                     _failedPixelsTexture.get());
     /* Uniforms */
     uniforms.insert(_projection_33);
     uniforms.insert(_projection_34);
@@ -825,6 +1057,8 @@ void GL3IterativeDepthPartitioner::_createFinalReprojectionStateSet(
                           points % ITERATIONS);
     if (!_parameters.unprojectDepths)
         vars["DEFINES"] += "#define PROJECT_Z\n";
+    if (_parameters.temporalDepthPartition)
+        vars["DEFINES"] += "#define TEMPORAL\n";
 
     const std::string code =
         "//final_reprojection.frag\n" +
@@ -835,6 +1069,130 @@ void GL3IterativeDepthPartitioner::_createFinalReprojectionStateSet(
     addProgram(_finalProjection, _vertex_shaders = strings(BYPASS_VERT_SHADER),
                _fragment_shaders = strings(code));
 }
+
+void GL3IterativeDepthPartitioner::_createTemporalStateSets(
+    const unsigned int points)
+{
+    const unsigned int historyTextures = points / 4 + 1;
+    const unsigned int leftTextures = (points + 3) / 4;
+
+    /* Fragment shader code */
+    std::map<std::string, std::string> vars;
+    vars["DEFINES"] = str(format("#define POINTS %1%\n") % points);
+    if (!_parameters.unprojectDepths)
+        vars["DEFINES"] += "#define PROJECT_Z\n";
+    const std::string resolveCode =
+        "//temporal_resolve.frag\n" +
+        readSourceAndReplaceVariables(SHADER_PATH + "temporal_resolve.frag",
+                                      vars);
+
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        /* The state sets that write the history textures i read the
+           other ones. */
+        osg::ref_ptr<osg::TextureRectangle>* history = _historyTextures[1 - i];
+
+        /* State to count the fragments around the previous split points */
+        {
+            Modes modes;
+            Attributes attributes;
+            Uniforms uniforms;
+            _temporalCount[i] = new osg::StateSet;
+            /* Modes */
+            modes[GL_DEPTH] = OFF;
+            modes[GL_CULL_FACE] = OFF_OVERRIDE;
+            /* Attributes */
+            attributes[_viewport] = ON_OVERRIDE_PROTECTED;
+            attributes[new osg::BlendEquation(FUNC_ADD)] = ON_OVERRIDE;
+            attributes[new osg::BlendFunc(GL_ONE, GL_ONE)] = ON_OVERRIDE;
+            /* Textures */
+            int nextIndex = _parameters.reservedTextureUnits;
+            setupTextureArray("historyTextures", nextIndex, *_temporalCount[i],
+                              historyTextures, history);
+            nextIndex += historyTextures;
+            /* Image units for fragment counting, see
+               _createFirstCountStateSet */
+            insertTextureArrayUniform(uniforms, "counts", 0, points);
+            for (unsigned int j = 0; j != points; ++j)
+                _temporalCount[i]->setTextureAttributeAndModes(
+                    nextIndex++, _countTextures[j]);
+            /* Uniforms */
+            uniforms.insert(_projection_33);
+            uniforms.insert(_projection_34);
+            /* Final setup */
+            setupStateSet(_temporalCount[i], modes, attributes, uniforms);
+        }
+
+        /* State to validate and refine the previous split points */
+        {
+            Modes modes;
+            Attributes attributes;
+            Uniforms uniforms;
+            _temporalResolve[i] = new osg::StateSet;
+            /* Modes */
+            modes[GL_DEPTH] = OFF;
+            modes[GL_BLEND] = OFF;
+            /* Attributes */
+            attributes[_viewport] = ON_OVERRIDE_PROTECTED;
+            /* Textures */
+            int nextIndex = 0;
+            setupTextureArray("historyTextures", nextIndex,
+                              *_temporalResolve[i], historyTextures, history);
+            nextIndex += historyTextures;
+            setupTexture("totalCountsTexture", nextIndex++,
+                         *_temporalResolve[i], _totalCountsTexture.get());
+            setupTextureArray("countTextures", nextIndex, *_temporalResolve[i],
+                              points, &_countTextures[0]);
+            nextIndex += points;
+            setupTextureArray("leftAccumTextures", nextIndex,
+                              *_temporalResolve[i], leftTextures,
+                              _leftAccumTextures);
+            /* Uniforms */
+            uniforms.insert(_projection_33);
+            uniforms.insert(_projection_34);
+            uniforms.insert(_quantiles.get());
+            uniforms.insert(_quantiles2.get());
+            /* Final setup */
+            setupStateSet(_temporalResolve[i], modes, attributes, uniforms);
+            addProgram(_temporalResolve[i],
+                       _vertex_shaders = strings(BYPASS_VERT_SHADER),
+                       _fragment_shaders = strings(resolveCode));
+        }
+    }
+
+    /* State to reset the min/max depths of the pixels for which the guess
+       failed while counting them. */
+    Modes modes;
+    Attributes attributes;
+    Uniforms uniforms;
+    _temporalFailures = new osg::StateSet;
+    modes[GL_DEPTH] = OFF;
+    modes[GL_BLEND] = OFF;
+    attributes[_viewport] = ON_OVERRIDE_PROTECTED;
+    setupTexture("failedPixels", 0, *_temporalFailures,
+                 _failedPixelsTexture.get());
+    const std::string code =
+        "//temporal_failures.frag\n" +
+        readSourceAndReplaceVariables(SHADER_PATH + "temporal_failures.frag",
+                                      vars);
+    setupStateSet(_temporalFailures, modes, attributes, uniforms);
+    addProgram(_temporalFailures, _vertex_shaders = strings(BYPASS_VERT_SHADER),
+               _fragment_shaders = strings(code));
+}
+
+void GL3IterativeDepthPartitioner::_updateTemporalCountPrograms(
+    const ProgramMap& extraShaders, const size_t points)
+{
+    std::map<std::string, std::string> vars;
+    vars["DEFINES"] = str(format("#define POINTS %1%\n") % points);
+    std::string code =
+        "//temporal_count.frag\n" +
+        readSourceAndReplaceVariables(SHADER_PATH + "temporal_count.frag",
+                                      vars);
+    addPrograms(extraShaders, &_temporalCountPrograms,
+                _vertex_shaders = strings(sm("trivialShadeVertex();")),
+                _fragment_shaders = strings(code));
+}
 }
 }
 }
@@ -25,6 +25,8 @@
 
 #include "DepthPartitioner.h"
 
+#include "../util/ShapeData.h"
+
 namespace bbp
 {
 namespace osgTransparency
@@ -38,6 +40,8 @@ public:
 
     GL3IterativeDepthPartitioner(const Parameters& parameters);
 
+    ~GL3IterativeDepthPartitioner();
+
     /*--- Public member functions ---*/
 
     void createBuffersAndTextures(unsigned int maxWidth,
@@ -67,6 +71,11 @@ private:
     osg::ref_ptr<osg::StateSet> _countIteration;
     osg::ref_ptr<osg::StateSet> _findQuantileIntervals;
     osg::ref_ptr<osg::StateSet> _finalProjection;
+    /* Temporal depth partition. Indexed by the history texture set that is
+       written. */
+    osg::ref_ptr<osg::StateSet> _temporalCount[2];
+    osg::ref_ptr<osg::StateSet> _temporalResolve[2];
+    osg::ref_ptr<osg::StateSet> _temporalFailures;
 
     osg::ref_ptr<osg::Viewport> _viewport;
 
@@ -82,6 +91,16 @@ private:
 
     osg::ref_ptr<osg::TextureRectangle> _depthPartitionTexture[2];
 
+    /* Two sets of textures used alternately from frame to frame with the
+       unprojected split points followed by the width of the bins in which
+       they were found. */
+    osg::ref_ptr<osg::TextureRectangle> _historyTextures[2][2];
+    osg::ref_ptr<osg::TextureRectangle> _failedPixelsTexture;
+    unsigned int _currentHistory;
+    bool _historyValid;
+    GLuint _failuresQuery;
+    unsigned int _contextID;
+
     osg::ref_ptr<osg::FrameBufferObject> _auxiliaryBuffer;
 
     osg::ref_ptr<osg::Geometry> _quad;
@@ -89,8 +108,12 @@ private:
     ProgramMap _minMaxPrograms;
     ProgramMap _firstCountPrograms;
     ProgramMap _countIterationPrograms;
+    ProgramMap _temporalCountPrograms;
 
-    BoundShapesStorage _shapes;
+    /* Used for the min/max pass when the accurate per pixel min/max is
+       disabled */
+    BoundsInstances _bounds;
+    osg::ref_ptr<osg::Program> _minMaxBoundsProgram;
 
     struct DebugHelpers;
 
@@ -104,11 +127,23 @@ private:
     void _createFindQuantileIntervalsStateSet(
         const std::vector<float>& quantiles);
     void _createFinalReprojectionStateSet(unsigned int points);
+    void _createTemporalStateSets(unsigned int points);
 
     void _updateMinMaxCalculationPrograms(const ProgramMap& extraShaders);
     void _updateFirstCountPrograms(const ProgramMap& extraShaders);
     void _updateCountIterationPrograms(const ProgramMap& extraShaders,
                                        size_t points);
+    void _updateTemporalCountPrograms(const ProgramMap& extraShaders,
+                                      size_t points);
+
+    /* Computes the depth partition from the one of the previous frame and
+       finds out which pixels need the full search. */
+    void _computeTemporalGuess(MultiLayerDepthPeelingBin* bin,
+                               osg::RenderInfo& renderInfo,
+                               osgUtil::RenderLeaf*& previous);
+    /* Attaches the output textures of the depth partition and selects the
+       draw buffers. */
+    void _applyPartitionOutputs(osg::State& state, bool failedPixels);
 };
 }
 }
@@ -0,0 +1,299 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "HistogramDepthPartitioner.h"
+
+#include "../MultiLayerParameters.h"
+#include "../util/constants.h"
+#include "../util/extensions.h"
+#include "../util/glerrors.h"
+#include "../util/helpers.h"
+#include "../util/loaders.h"
+#include "../util/strings_array.h"
+
+#include <osg/FrameBufferObject>
+#include <osg/Geometry>
+#include <osg/TextureRectangle>
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+namespace multilayer
+{
+using boost::str;
+using boost::format;
+using namespace keywords;
+
+/*
+  Static definitions
+*/
+namespace
+{
+const std::string SHADER_PATH = "multilayer/depth_partition/histogram/";
+
+unsigned int _histogramBins()
+{
+    const char* value = ::getenv("OSGTRANSPARENCY_DEPTH_HISTOGRAM_BINS");
+    if (value == 0)
+        return 64;
+    /* An even number of bins, as two bins are packed in each texel. */
+    const long bins = std::max(8l, std::min(256l, strtol(value, 0, 10)));
+    return (unsigned int)bins & ~1u;
+}
+const unsigned int BINS = _histogramBins();
+
+/* The tiles accumulate too many fragments for 16-bit counters */
+unsigned int _histogramLayers(const unsigned int tileSize)
+{
+    return tileSize == 1 ? BINS / 2 : BINS;
+}
+
+std::string _histogramDefines(const unsigned int tileSize)
+{
+    std::string defines = str(format("#define BINS %1%\n") % BINS);
+    if (tileSize == 1)
+        defines += "#define PACKED_BINS\n";
+    else
+        defines += str(format("#define TILE_SIZE %1%\n") % tileSize);
+    return defines;
+}
+}
+
+/*
+  Constructor
+*/
+HistogramDepthPartitioner::HistogramDepthPartitioner(
+    const Parameters& parameters)
+    : DepthPartitioner(parameters)
+    , _histogramCleared(false)
+{
+}
+
+/*
+  Member functions
+*/
+void HistogramDepthPartitioner::computeDepthPartition(
+    MultiLayerDepthPeelingBin* bin, osg::RenderInfo& renderInfo,
+    osgUtil::RenderLeaf*& previous)
+{
+    osg::State& state = *renderInfo.getState();
+    osg::GLExtensions* ext = state.get<osg::GLExtensions>();
+
+    if (_parameters.getNumSlices() < 2)
+        return;
+
+    /* Updating the quantile uniforms */
+    const Parameters::QuantileList& quantiles = _parameters.splitPointQuantiles;
+    for (size_t i = 0; i < quantiles.size(); ++i)
+    {
+        /* OSG doesn't check if the uniform value has changed before dirtying
+           it, so we add that verification here. */
+        float quantile;
+        _quantiles->getElement(i, quantile);
+        if (quantile != quantiles[i])
+        {
+            _quantiles->setElement(i, quantiles[i]);
+            _quantiles2->setElement(i, quantiles[i]);
+        }
+    }
+
+    osg::Viewport* viewport = renderInfo.getCurrentCamera()->getViewport();
+    _viewport->setViewport(0, 0, viewport->width(), viewport->height());
+    const unsigned int tileSize = getTileSize();
+    _tileViewport->setViewport(
+        0, 0, (int(_viewport->width()) + tileSize - 1) / tileSize,
+        (int(_viewport->height()) + tileSize - 1) / tileSize);
+    glScissor(0, 0, _viewport->width(), _viewport->height());
+
+    if (!_histogramCleared)
+    {
+        /* Afterwards, the resolve pass leaves the histogram cleared. */
+        clearTexture(state, _auxiliaryBuffer, _histogramTexture.get());
+        _histogramCleared = true;
+    }
+    _histogramTexture->bindToImageUnit(0, osg::Texture::READ_WRITE, GL_R32UI,
+                                       0, true);
+
+    /* Histogram accumulation.
+       In this pass nothing is really rendered to the framebuffer. */
+    _auxiliaryBuffer->apply(state);
+    glDrawBuffer(GL_NONE);
+    render(bin, renderInfo, previous, _count.get(), _countPrograms);
+    ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    checkGLErrors("after depth histogram count");
+
+    /* Quantile search */
+    const unsigned int textures = (_parameters.getNumSlices() + 2) / 4;
+    for (unsigned int i = 0; i != textures; ++i)
+        _auxiliaryBuffer->setAttachment(COLOR_BUFFERS[i],
+                                        osg::FrameBufferAttachment(
+                                            _depthPartitionTexture[i].get()));
+    _auxiliaryBuffer->apply(state);
+    ext->glDrawBuffers(textures, &GL_BUFFER_NAMES[0]);
+    state.pushStateSet(_resolve.get());
+    state.apply();
+    state.applyProjectionMatrix(0);
+    state.applyModelViewMatrix(0);
+    _quad->draw(renderInfo);
+    state.popStateSet();
+    ext->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    checkGLErrors("after depth histogram resolve");
+}
+
+void HistogramDepthPartitioner::createBuffersAndTextures(
+    const unsigned int width, const unsigned height)
+{
+    _auxiliaryBuffer = new osg::FrameBufferObject();
+
+    const unsigned int points = _parameters.getNumSlices() - 1;
+    const unsigned int tileSize = getTileSize();
+    const unsigned int tilesX = (width + tileSize - 1) / tileSize;
+    const unsigned int tilesY = (height + tileSize - 1) / tileSize;
+
+    _histogramTexture = new osg::Texture2DArray();
+    _histogramTexture->setTextureSize(tilesX, tilesY,
+                                      _histogramLayers(tileSize));
+    _histogramTexture->setInternalFormat(GL_R32UI);
+    _histogramTexture->setSourceFormat(GL_RED_INTEGER);
+    _histogramTexture->setSourceType(GL_UNSIGNED_INT);
+    _histogramCleared = false;
+
+    /* 4 split points per texture, the last one can have less channels */
+    const int formats32[4] = {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F_ARB};
+    const unsigned int textures = (points + 3) / 4;
+    for (unsigned int i = 0; i != textures; ++i)
+    {
+        const int format =
+            i + 1 == textures ? formats32[(points - 1) % 4] : GL_RGBA32F_ARB;
+        _depthPartitionTexture[i] =
+            createTexture<osg::TextureRectangle>(tilesX, tilesY, format);
+    }
+}
+
+void HistogramDepthPartitioner::createStateSets()
+{
+    if (_parameters.getNumSlices() < 2)
+        return;
+
+    _viewport = new osg::Viewport();
+    _tileViewport = new osg::Viewport();
+
+    _createCountStateSet();
+    _createResolveStateSet(_parameters.splitPointQuantiles);
+
+    _quad = createQuad();
+}
+
+void HistogramDepthPartitioner::updateShaderPrograms(
+    const ProgramMap& extraShaders)
+{
+    std::map<std::string, std::string> vars;
+    vars["DEFINES"] = _histogramDefines(getTileSize());
+    std::string code =
+        "//count.frag\n" +
+        readSourceAndReplaceVariables(SHADER_PATH + "count.frag", vars);
+    addPrograms(extraShaders, &_countPrograms,
+                _vertex_shaders = strings(sm("trivialShadeVertex();")),
+                _fragment_shaders = strings(code));
+}
+
+void HistogramDepthPartitioner::_createCountStateSet()
+{
+    Modes modes;
+    Attributes attributes;
+    Uniforms uniforms;
+    _count = new osg::StateSet;
+    /* Modes */
+    modes[GL_DEPTH] = OFF;
+    modes[GL_CULL_FACE] = OFF_OVERRIDE;
+    /* Attributes */
+    attributes[_viewport] = ON_OVERRIDE_PROTECTED;
+    /* The texture binding is only needed to make the image unit binding
+       effective. */
+    _count->setTextureAttributeAndModes(_parameters.reservedTextureUnits,
+                                        _histogramTexture);
+    /* Uniforms */
+    uniforms.insert(new osg::Uniform("histogram", 0));
+    uniforms.insert(_projection_33);
+    uniforms.insert(_projection_34);
+    /* Final setup */
+    setupStateSet(_count, modes, attributes, uniforms);
+}
+
+void HistogramDepthPartitioner::_createResolveStateSet(
+    const std::vector<float>& quantiles)
+{
+    Modes modes;
+    Attributes attributes;
+    Uniforms uniforms;
+
+    _resolve = new osg::StateSet;
+    /* Modes */
+    modes[GL_DEPTH] = OFF;
+    modes[GL_BLEND] = OFF;
+    /* Attributes */
+    attributes[_tileViewport] = ON_OVERRIDE_PROTECTED;
+    /* Textures */
+    _resolve->setTextureAttributeAndModes(0, _histogramTexture);
+    /* Uniforms */
+    uniforms.insert(new osg::Uniform("histogram", 0));
+    uniforms.insert(_projection_33);
+    uniforms.insert(_projection_34);
+    _quantiles = new osg::Uniform();
+    _quantiles->setName("quantiles");
+    _quantiles->setNumElements(quantiles.size());
+    _quantiles->setType(osg::Uniform::FLOAT);
+    for (unsigned int i = 0; i < quantiles.size(); ++i)
+        _quantiles->setElement(i, quantiles[i]);
+    uniforms.insert(_quantiles.get());
+    /* Workaround for uniform array naming in NVidia drivers >= 275 */
+    _quantiles2 = new osg::Uniform();
+    _quantiles2->setName("quantiles[0]");
+    _quantiles2->setNumElements(quantiles.size());
+    _quantiles2->setType(osg::Uniform::FLOAT);
+    for (unsigned int i = 0; i < quantiles.size(); ++i)
+        _quantiles2->setElement(i, quantiles[i]);
+    uniforms.insert(_quantiles2.get());
+
+    /* Fragment shader code */
+    std::map<std::string, std::string> vars;
+    vars["DEFINES"] = str(format("#define POINTS %1%\n") % quantiles.size()) +
+                      _histogramDefines(getTileSize());
+    if (!_parameters.unprojectDepths)
+        vars["DEFINES"] += "#define PROJECT_Z\n";
+    const std::string code =
+        "//resolve.frag\n" +
+        readSourceAndReplaceVariables(SHADER_PATH + "resolve.frag", vars);
+
+    /* Final setup */
+    setupStateSet(_resolve, modes, attributes, uniforms);
+    addProgram(_resolve, _vertex_shaders = strings(BYPASS_VERT_SHADER),
+               _fragment_shaders = strings(code));
+}
+}
+}
+}
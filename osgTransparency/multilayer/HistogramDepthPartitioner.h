@@ -0,0 +1,114 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_MULTILAYER_HISTOGRAMDEPTHPARTITIONER_H
+#define OSGTRANSPARENCY_MULTILAYER_HISTOGRAMDEPTHPARTITIONER_H
+
+#include "DepthPartitioner.h"
+
+#include "osgTransparency/util/constants.h"
+
+#include <osg/Texture2DArray>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+namespace multilayer
+{
+/**
+   Depth partitioner that computes the split points from a per pixel depth
+   histogram accumulated in a single scene pass.
+
+   The histogram bins are evenly spaced in logarithmic depth between the
+   near and far planes, so no previous pass is needed to find the depth
+   range of each pixel. The quantiles are resolved in a full screen pass
+   which also clears the histogram for the next frame.
+
+   With a tile size larger than 1, a single histogram accumulates the
+   fragments of each screen tile and the split points are computed and
+   stored per tile.
+*/
+class HistogramDepthPartitioner : public DepthPartitioner
+{
+public:
+    /*--- Public constructors/destructor ---*/
+
+    HistogramDepthPartitioner(const Parameters& parameters);
+
+    /*--- Public member functions ---*/
+
+    void createBuffersAndTextures(unsigned int maxWidth,
+                                  unsigned int maxHeight) final;
+
+    void createStateSets() final;
+
+    virtual void updateShaderPrograms(const ProgramMap& extraShaders) final;
+
+    void computeDepthPartition(MultiLayerDepthPeelingBin* bin,
+                               osg::RenderInfo& renderInfo,
+                               osgUtil::RenderLeaf*& previous) final;
+
+    osg::ref_ptr<osg::TextureRectangle>* getDepthPartitionTextureArray()
+    {
+        return _depthPartitionTexture;
+    }
+
+    unsigned int getTileSize() const final
+    {
+        return _parameters.depthPartitionTileSize;
+    }
+
+private:
+    /*--- Private member attributes ---*/
+
+    osg::ref_ptr<osg::StateSet> _count;
+    osg::ref_ptr<osg::StateSet> _resolve;
+
+    osg::ref_ptr<osg::Viewport> _viewport;
+    osg::ref_ptr<osg::Viewport> _tileViewport;
+
+    osg::ref_ptr<osg::Uniform> _quantiles;
+    osg::ref_ptr<osg::Uniform> _quantiles2;
+
+    /* Two 16-bit bin counters per layer for per pixel histograms and one
+       32-bit counter per layer for per tile histograms. */
+    osg::ref_ptr<osg::Texture2DArray> _histogramTexture;
+    bool _histogramCleared;
+
+    osg::ref_ptr<osg::TextureRectangle> _depthPartitionTexture[MAX_SLICES / 4];
+
+    osg::ref_ptr<osg::FrameBufferObject> _auxiliaryBuffer;
+
+    osg::ref_ptr<osg::Geometry> _quad;
+
+    ProgramMap _countPrograms;
+
+    /*--- Private member functions ---*/
+
+    void _createCountStateSet();
+    void _createResolveStateSet(const std::vector<float>& quantiles);
+};
+}
+}
+}
+#endif
@@ -23,7 +23,9 @@
 #include <osg/GL>
 
 #include "osgTransparency/MultiLayerParameters.h"
+#include "osgTransparency/util/constants.h"
 
+#include <algorithm>
 #include <iostream>
 
 namespace bbp
@@ -50,7 +52,8 @@ public:
                 float quantile = (float)strtod(value, &endptr);
                 if (endptr != value)
                 {
-                    if (size() != 0 && quantile < operator[](size() - 1))
+                    if ((size() != 0 && quantile < operator[](size() - 1)) ||
+                        size() + 1 >= MAX_SLICES)
                         error = true;
                     else
                     {
@@ -90,13 +93,20 @@ const float s_opacityThreshold =
         ? strtod(::getenv("OSGTRANSPARENCY_OPACITY_THRESHOLD"), 0)
         : 0.99;
 
+const unsigned int s_depthPartitionTileSize =
+    ::getenv("OSGTRANSPARENCY_DEPTH_PARTITION_TILE_SIZE") &&
+            strtol(::getenv("OSGTRANSPARENCY_DEPTH_PARTITION_TILE_SIZE"), 0,
+                   10) > 0
+        ? strtol(::getenv("OSGTRANSPARENCY_DEPTH_PARTITION_TILE_SIZE"), 0, 10)
+        : 1;
+
 /*
   Helper functions
 */
 MultiLayerDepthPeelingBin::Parameters::QuantileList _quantiles(
     unsigned int slices)
 {
-    if (slices > 8 || slices < 1)
+    if (slices > MAX_SLICES || slices < 1)
     {
         std::cerr << "osgTransparency: Unsupported number of slices " << slices
                   << ". Ignoring " << std::endl;
@@ -115,11 +125,11 @@ MultiLayerDepthPeelingBin::Parameters::QuantileList _quantiles(
 /*
   Member functions
 */
-MultiLayerDepthPeelingBin::Parameters::Parameters(OptUInt slices_,
-                                                  OptBool unprojectDepths_,
-                                                  OptBool alphaAwarePartition_,
-                                                  OptUInt superSampling_,
-                                                  OptFloat opacityThreshold_)
+MultiLayerDepthPeelingBin::Parameters::Parameters(
+    OptUInt slices_, OptBool unprojectDepths_, OptBool alphaAwarePartition_,
+    OptUInt superSampling_, OptFloat opacityThreshold_,
+    OptBool temporalDepthPartition_, OptBool histogramDepthPartition_,
+    OptUInt depthPartitionTileSize_)
     : BaseRenderBin::Parameters(superSampling_)
     , opacityThreshold(opacityThreshold_.valid() ? float(opacityThreshold_)
                                                  : s_opacityThreshold)
@@ -132,7 +142,35 @@ MultiLayerDepthPeelingBin::Parameters::Parameters(OptUInt slices_,
           alphaAwarePartition_.valid()
               ? bool(alphaAwarePartition_)
               : ::getenv("OSGTRANSPARENCY_ADJUST_QUANTILES_WITH_ALPHA") != 0)
+    , temporalDepthPartition(
+          temporalDepthPartition_.valid()
+              ? bool(temporalDepthPartition_)
+              : ::getenv("OSGTRANSPARENCY_TEMPORAL_DEPTH_PARTITION") != 0)
+    , histogramDepthPartition(
+          histogramDepthPartition_.valid()
+              ? bool(histogramDepthPartition_)
+              : ::getenv("OSGTRANSPARENCY_HISTOGRAM_DEPTH_PARTITION") != 0)
+    , depthPartitionTileSize(
+          depthPartitionTileSize_.valid()
+              ? std::max(1u, (unsigned int)depthPartitionTileSize_)
+              : s_depthPartitionTileSize)
 {
+#ifdef OSG_GL3_AVAILABLE
+    if (getNumSlices() > MAX_ITERATIVE_PARTITION_SLICES &&
+        !histogramDepthPartition)
+    {
+        std::cerr << "Warning: Using histogram depth partitions, the"
+                     " iterative depth partition supports up to "
+                  << MAX_ITERATIVE_PARTITION_SLICES << " slices" << std::endl;
+    }
+#endif
+    if (depthPartitionTileSize > 1 && !histogramDepthPartition &&
+        getNumSlices() <= MAX_ITERATIVE_PARTITION_SLICES)
+    {
+        std::cerr << "Warning: Depth partition tiles are only supported with"
+                     " histogram depth partitions"
+                  << std::endl;
+    }
 #ifdef OSG_GL3_AVAILABLE
     if (alphaAwarePartition)
     {
@@ -140,6 +178,25 @@ MultiLayerDepthPeelingBin::Parameters::Parameters(OptUInt slices_,
                      " GL3 version of multi-layer depth peeling"
                   << std::endl;
     }
+    if (temporalDepthPartition && histogramDepthPartition)
+    {
+        std::cerr << "Warning: Temporal depth partitions are not supported"
+                     " with histogram depth partitions"
+                  << std::endl;
+    }
+#else
+    if (temporalDepthPartition)
+    {
+        std::cerr << "Warning: Temporal depth partitions are only supported in"
+                     " GL3 version of multi-layer depth peeling"
+                  << std::endl;
+    }
+    if (histogramDepthPartition)
+    {
+        std::cerr << "Warning: Histogram depth partitions are only supported in"
+                     " GL3 version of multi-layer depth peeling"
+                  << std::endl;
+    }
 #endif
 }
 
@@ -151,6 +208,9 @@ bool MultiLayerDepthPeelingBin::Parameters::update(const Parameters &other)
     if (splitPointQuantiles.size() == other.splitPointQuantiles.size() &&
         other.alphaAwarePartition == alphaAwarePartition &&
         other.unprojectDepths == unprojectDepths &&
+        other.temporalDepthPartition == temporalDepthPartition &&
+        other.histogramDepthPartition == histogramDepthPartition &&
+        other.depthPartitionTileSize == depthPartitionTileSize &&
         other.opacityThreshold == opacityThreshold)
     {
         return true;
@@ -0,0 +1,50 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+/* Vertex shader for the instanced bounding boxes drawn by
+   BaseRenderBin::renderBounds.
+   Each instance is a box whose model-view-projection matrix and corners are
+   read from the instance buffer. The vertices of a triangle strip covering
+   the 6 faces of the box are generated from gl_VertexID. */
+
+#define INSTANCE_TEXELS 6
+
+uniform samplerBuffer boundsInstances;
+
+void main()
+{
+    const int bit = 1 << gl_VertexID;
+    const vec3 corner = vec3((0x287a & bit) != 0, (0x02af & bit) != 0,
+                             (0x31e3 & bit) != 0);
+
+    const int first = gl_InstanceID * INSTANCE_TEXELS;
+    const mat4 matrix = mat4(texelFetch(boundsInstances, first),
+                             texelFetch(boundsInstances, first + 1),
+                             texelFetch(boundsInstances, first + 2),
+                             texelFetch(boundsInstances, first + 3));
+    const vec3 lower = texelFetch(boundsInstances, first + 4).xyz;
+    const vec3 upper = texelFetch(boundsInstances, first + 5).xyz;
+
+    gl_Position = matrix * vec4(mix(lower, upper, corner), 1.0);
+}
@@ -0,0 +1,47 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_gpu_shader4 : enable
+
+$EARLY_FRAGMENT_TESTS
+
+$DEFINES
+
+layout(size1x32) restrict uniform uimage2DRect fragmentCounts;
+
+float fragmentDepth();
+
+void main(void)
+{
+    /* Only the fragments that survive the client code in fragmentDepth are
+       counted. Fragments discarded later on by shadeFragment leave unused
+       slots in the per pixel arrays, which is harmless. The same predicate
+       is applied in save_fragments.frag. Using the depth also prevents the
+       call above from being optimized away. */
+    const float depth = fragmentDepth();
+    if (REJECT_FRAGMENT(depth))
+        discard;
+
+    imageAtomicAdd(fragmentCounts, ivec2(gl_FragCoord.xy), 1u);
+}
@@ -0,0 +1,41 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+/* Full screen quad of a sort and display batch.
+   When no pixel has a fragment count in the range of the batch the quad is
+   collapsed to a point, so the batch doesn't rasterize any fragment. */
+
+uniform usamplerBuffer countHistogram;
+/* The index of the fragment count range of this batch */
+uniform int countRange;
+
+in vec4 osg_Vertex;
+
+void main()
+{
+    if (texelFetch(countHistogram, countRange).r == 0u)
+        gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+    else
+        gl_Position = osg_Vertex;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+/* Blends the colors of the lists resolved by resolve_lists.comp. */
+
+uniform usampler2DRect fragmentCounts;
+uniform sampler2DRect resolvedColors;
+/* The lower left corner of the viewport area being composited */
+uniform vec2 corner;
+
+layout(location = 0) out vec4 outColor;
+
+void main(void)
+{
+    const vec2 coord = gl_FragCoord.xy - corner;
+    if (texture(fragmentCounts, coord).r == 0u)
+        discard;
+    outColor = texture(resolvedColors, coord);
+}
@@ -26,7 +26,7 @@
 
 uniform usampler2DRect fragmentCounts;
 uniform uvec2 fragmentCountRange;
-/* The lower left corner of the camera viewport */
+/* The lower left corner of the viewport area being composited */
 uniform vec2 corner;
 
 void main(void)
@@ -0,0 +1,92 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_gpu_shader4 : enable
+
+$EARLY_FRAGMENT_TESTS
+
+$DEFINES
+
+layout(size1x32) restrict uniform uimageBuffer fragmentBuffer;
+layout(size1x32) restrict uniform uimageBuffer tailBuffer;
+layout(size1x32) restrict uniform uimage2DRect fragmentCounts;
+/* Width in pixels of the K-buffer. */
+uniform uint bufferWidth;
+
+/* Fixed point scale of the tail accumulators. */
+#define TAIL_SCALE 65536.0
+/* Maximum optical depth accumulated per fragment. exp2(-8) is already below
+   the precision of the output. */
+#define MAX_OPTICAL_DEPTH 8.0
+
+float fragmentDepth();
+vec4 shadeFragment();
+
+void main(void)
+{
+    /* This has to be done before writing anything, as the client code in
+       fragmentDepth and shadeFragment may discard the fragment. */
+    const float depth = fragmentDepth();
+    /* Color clamping needed to ensure that each channel is within [0, 1]. */
+    const vec4 color = clamp(shadeFragment(), vec4(0.0), vec4(1.0));
+
+    const ivec2 pixel = ivec2(gl_FragCoord.xy);
+    const int pixelIndex = pixel.y * int(bufferWidth) + pixel.x;
+    const int first = pixelIndex * K_BUFFER_SIZE;
+
+    imageAtomicAdd(fragmentCounts, pixel, 1u);
+
+    /* Looking for the slot assigned to this fragment in the previous pass.
+       Fragments with the same depth reserved one slot each, so every
+       fragment claims the first of them whose color is still cleared to
+       0. A fragment with color 0 leaves its slot unclaimed, which is
+       harmless because it's transparent black anyway. If all the slots of
+       this depth are taken the fragment goes to the tail. */
+    const uint idepth = floatBitsToUint(depth);
+    /* Alpha channel goes without premultiplication. */
+    const uint icolor = uint(color[0] * 255) + (uint(color[1] * 255) << 8u) +
+                        (uint(color[2] * 255) << 16u) +
+                        (uint(color[3] * 255) << 24u);
+    for (int i = 0; i < K_BUFFER_SIZE; ++i)
+    {
+        const uint stored = imageLoad(fragmentBuffer, (first + i) * 2).r;
+        if (stored > idepth)
+            break;
+        if (stored == idepth &&
+            imageAtomicCompSwap(fragmentBuffer, (first + i) * 2 + 1, 0u,
+                                icolor) == 0u)
+            return;
+    }
+
+    /* The fragment is behind the K nearest ones. The tail is approximated
+       with the alpha weighted average color and the total transmittance,
+       which is accumulated as optical depth to make it additive. */
+    const int tail = pixelIndex * 5;
+    imageAtomicAdd(tailBuffer, tail, uint(color.r * color.a * TAIL_SCALE));
+    imageAtomicAdd(tailBuffer, tail + 1, uint(color.g * color.a * TAIL_SCALE));
+    imageAtomicAdd(tailBuffer, tail + 2, uint(color.b * color.a * TAIL_SCALE));
+    imageAtomicAdd(tailBuffer, tail + 3, uint(color.a * TAIL_SCALE));
+    const float opticalDepth = min(-log2(1.0 - color.a), MAX_OPTICAL_DEPTH);
+    imageAtomicAdd(tailBuffer, tail + 4, uint(opticalDepth * TAIL_SCALE));
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_gpu_shader4 : enable
+
+$DEFINES
+
+uniform usamplerBuffer fragmentBuffer;
+uniform usamplerBuffer tailBuffer;
+/* Width in pixels of the K-buffer. */
+uniform uint bufferWidth;
+/* The lower left corner of the viewport area being composited */
+uniform vec2 corner;
+
+layout(location = 0) out vec4 outColor;
+
+/* Must match kbuffer_colors.frag */
+#define TAIL_SCALE 65536.0
+
+vec4 unpackColor(uint icolor)
+{
+    const vec4 color = vec4(float(icolor & 0xFFu) / 255.0,
+                            float((icolor & 0xFF00u) >> 8u) / 255.0,
+                            float((icolor & 0xFF0000u) >> 16u) / 255.0,
+                            float((icolor & 0xFF000000u) >> 24u) / 255.0);
+    /* Premultiplying alpha */
+    return vec4(color.rgb * color.a, color.a);
+}
+
+void main(void)
+{
+    const ivec2 pixel = ivec2(gl_FragCoord.xy - corner);
+    const int pixelIndex = pixel.y * int(bufferWidth) + pixel.x;
+    const int first = pixelIndex * K_BUFFER_SIZE;
+
+    /* The K nearest fragments are already sorted. */
+    vec4 color = vec4(0.0);
+    int i = 0;
+    for (; i < K_BUFFER_SIZE; ++i)
+    {
+        const int offset = (first + i) * 2;
+        if (texelFetchBuffer(fragmentBuffer, offset)[0] == 0xFFFFFFFF)
+            break;
+        const uint icolor = texelFetchBuffer(fragmentBuffer, offset + 1)[0];
+        color += unpackColor(icolor) * (1 - color.a);
+    }
+
+    if (i == 0)
+        discard;
+
+    if (i == K_BUFFER_SIZE)
+    {
+        const int tail = pixelIndex * 5;
+        const uint alphaSum = texelFetchBuffer(tailBuffer, tail + 3)[0];
+        if (alphaSum != 0)
+        {
+            const vec3 average =
+                vec3(texelFetchBuffer(tailBuffer, tail)[0],
+                     texelFetchBuffer(tailBuffer, tail + 1)[0],
+                     texelFetchBuffer(tailBuffer, tail + 2)[0]) /
+                float(alphaSum);
+            const float opticalDepth =
+                float(texelFetchBuffer(tailBuffer, tail + 4)[0]) / TAIL_SCALE;
+            const float alpha = 1.0 - exp2(-opticalDepth);
+            color += vec4(average * alpha, alpha) * (1 - color.a);
+        }
+    }
+
+    outColor = color;
+}
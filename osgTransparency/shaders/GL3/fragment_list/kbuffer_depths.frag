@@ -0,0 +1,59 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_gpu_shader4 : enable
+
+$EARLY_FRAGMENT_TESTS
+
+$DEFINES
+
+/* K-buffer records of 2 words, depth and color. Each pixel has
+   K_BUFFER_SIZE consecutive records sorted by depth. */
+layout(size1x32) coherent uniform uimageBuffer fragmentBuffer;
+/* Width in pixels of the K-buffer. */
+uniform uint bufferWidth;
+
+float fragmentDepth();
+
+void main(void)
+{
+    const float depth = fragmentDepth();
+
+    const ivec2 pixel = ivec2(gl_FragCoord.xy);
+    const int first = (pixel.y * int(bufferWidth) + pixel.x) * K_BUFFER_SIZE;
+
+    /* Inserting the depth in the sorted array with a cascade of atomic min
+       operations. The value that is displaced by each min is inserted in the
+       next position. Depths are positive, so they compare like their bit
+       patterns as unsigned integers. */
+    uint value = floatBitsToUint(depth);
+    for (int i = 0; i < K_BUFFER_SIZE; ++i)
+    {
+        const uint old = imageAtomicMin(fragmentBuffer, (first + i) * 2, value);
+        if (old == 0xFFFFFFFF)
+            /* The position was empty */
+            break;
+        value = max(old, value);
+    }
+}
@@ -23,53 +23,171 @@
 #version 420
 
 #extension GL_EXT_gpu_shader4 : enable
+/* Extension directives must precede any other token, so the ones that
+   depend on the defines are substituted here. */
+$EXTENSIONS
+
+$EARLY_FRAGMENT_TESTS
 
 $DEFINES
 
 layout(size1x32) restrict uniform uimage2DRect listHead;
+#ifdef SHADER_STORAGE_FRAGMENTS
+/* The fields follow the word offsets given by DEPTH_WORD, COLOR_WORD and
+   NORMAL_WORD, the std430 stride is RECORD_SIZE words. */
+struct Fragment
+{
+#ifndef COMPACT_RECORDS
+    uint next;
+#endif
+    uint depth;
+#ifndef SPLIT_RECORDS
+    uint color;
+#ifdef DEFERRED_SHADING
+    uint normal;
+#endif
+#endif
+};
+layout(std430, binding = FRAGMENT_STORAGE_BINDING) restrict writeonly buffer
+    FragmentStorage
+{
+    Fragment fragments[];
+};
+#else
 layout(size1x32) restrict uniform uimageBuffer fragmentBuffer;
+#endif
+#ifdef SPLIT_RECORDS
+/* COLOR_RECORD_SIZE words per fragment with the color, or the shading
+   inputs, indexed like fragmentBuffer. */
+layout(size1x32) restrict writeonly uniform uimageBuffer fragmentColors;
+#endif
+#ifdef OBJECT_IDS
+/* The object ID of each fragment for picking, indexed like fragmentBuffer.
+   objectID is set per drawable by the client code. */
+layout(size1x32) restrict writeonly uniform uimageBuffer objectIDs;
+uniform uint objectID;
+#endif
 layout(size1x32) restrict uniform uimage2DRect fragmentCounts;
+/* Number of pixels in each fragment count range */
+layout(size1x32) restrict uniform uimageBuffer countHistogram;
 
 layout(binding = 0) uniform atomic_uint counter;
 
+#ifdef PAGED_LISTS
+layout(size1x32) restrict uniform uimageBuffer pageLinks;
+#define FILL_MASK ((1u << PAGE_FILL_BITS) - 1u)
+#define LOCKED FILL_MASK
+/* The number of attempts to allocate a fragment in a page is bounded to
+   guarantee termination. In practice only a few are needed. */
+#define MAX_ALLOCATION_ATTEMPTS 1024
+#endif
+
 #ifdef USE_ALPHA_CUTOFF
 layout(size1x32) restrict uniform uimage2DRect depthTranspBuffer;
+/* The upper TRANSPARENCY_BITS of depthTranspBuffer hold the transparency
+   accumulated so far and the lower bits the maximum depth seen. */
+#define DEPTH_BITS (32 - TRANSPARENCY_BITS)
+#define DEPTH_MASK ((1u << DEPTH_BITS) - 1u)
+#define MAX_TRANSPARENCY ((1u << TRANSPARENCY_BITS) - 1u)
 #endif
 
 uniform float minTransparency;
+/* Number of fragments that fit in fragmentBuffer */
+uniform uint fragmentCapacity;
+
+const int COUNT_RANGES = $COUNT_RANGES;
 
 float fragmentDepth();
+#ifdef DEFERRED_SHADING
+float fragmentAlpha();
+vec3 fragmentNormal();
+uint fragmentMaterial();
+
+/* Octahedral encoding of a unit vector in two signed 16-bit values. */
+uint packNormal(const vec3 normal)
+{
+    vec2 p = normal.xy / (abs(normal.x) + abs(normal.y) + abs(normal.z));
+    if (normal.z < 0.0)
+        p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0,
+                                     p.y >= 0.0 ? 1.0 : -1.0);
+    return packSnorm2x16(p);
+}
+#else
 vec4 shadeFragment();
+#endif
+
+/* Index of the fragment count range of the sort and display batches for a
+   non zero count. The ranges are [1, 8], [9, 16], [17, 32] ... The last one
+   is unbounded. */
+int countRange(const uint count)
+{
+    return count <= 8u ? 0 : min(findMSB(count - 1u) - 2, COUNT_RANGES - 1);
+}
+
+/* Moves the pixel to a different histogram bin if incrementing its fragment
+   count from the given value crosses a range boundary. This only happens
+   a few times per pixel, so the cost of the atomics is negligible. */
+void updateCountHistogram(const uint previous)
+{
+    const int range = countRange(previous + 1u);
+    if (previous == 0u)
+    {
+        imageAtomicAdd(countHistogram, range, 1u);
+    }
+    else if (countRange(previous) != range)
+    {
+        imageAtomicAdd(countHistogram, range, 1u);
+        imageAtomicAdd(countHistogram, range - 1, 0xFFFFFFFFu);
+    }
+}
 
 void main(void)
 {
     /* This has to be done before writing anything, as the client code in
        fragmentDepth and shadeFragment may discard the fragmet. */
     const float depth = fragmentDepth();
+    /* Same predicate as in count_fragments.frag */
+    if (REJECT_FRAGMENT(depth))
+        discard;
 
 #ifdef USE_ALPHA_CUTOFF
     /* Checking the depth to decide if the fragment must be discarded. */
     int i = 0;
     uint depthTransp = imageLoad(depthTranspBuffer, ivec2(gl_FragCoord.xy)).r;
-    uint maxDepthi = depthTransp & 0x00FFFFFF;
-    uint transparency = depthTransp >> 24;
-    const uint depthi = uint(floor(depth * 0x00FFFFFF));
+    uint maxDepthi = depthTransp & DEPTH_MASK;
+    uint transparency = depthTransp >> DEPTH_BITS;
+    const uint depthi = uint(floor(depth * float(DEPTH_MASK)));
 
-    if (transparency <= minTransparency * 255.0 && depthi > maxDepthi)
+    if (transparency <= minTransparency * float(MAX_TRANSPARENCY) &&
+        depthi > maxDepthi)
         discard;
 #endif
 
+#ifdef DEFERRED_SHADING
+    /* Only the inputs of the shading are stored, it's done while the sorted
+       lists are blended. */
+    const float alpha = clamp(fragmentAlpha(), 0.0, 1.0);
+#else
     /* Color clamping needed to ensure that each channel is within [0, 1]. */
     const vec4 color = clamp(shadeFragment(), vec4(0.0), vec4(1.0));
+    const float alpha = color.a;
+#endif
 
 #ifdef USE_ALPHA_CUTOFF
+#if TRANSPARENCY_BITS == 8
     /* The formula below is an approximation of the more ideal t = t (1 - a)
        where t and a are floats in [0, 1]. The most conservative approach would
        be without 0.25, but the resulting formula converges to 0 very badly.
        The biased rounding provided by adding 0.25 overestimates the
        transparency in general, so it's still quite conservative while it
        converges much faster that using floor alone. */
-    transparency -= uint(floor(transparency * color.a + 0.25));
+    transparency -= uint(floor(transparency * alpha + 0.25));
+#else
+    /* With 16 bits the exact product rounded up is used. It only stops
+       converging at about 1 / alpha units, which is far below any useful
+       threshold. */
+    transparency -= uint(floor(transparency * alpha));
+#endif
 
     if (maxDepthi < depthi)
         maxDepthi = depthi;
@@ -79,26 +197,142 @@ void main(void)
        z-axis, the convergence of the transparency to 0 will happen much
        more slowly. */
     imageAtomicMin(depthTranspBuffer, ivec2(gl_FragCoord.xy),
-                   maxDepthi | transparency << 24);
+                   maxDepthi | transparency << DEPTH_BITS);
 #endif
 
+#ifdef PREFIX_SUM_ARRAYS
+    /* The fragments of each pixel are stored contiguously. listHead contains
+       the offset of the pixel array computed by the prefix sum of the
+       fragment counts from the previous pass. */
+    const uint slot =
+        imageAtomicAdd(fragmentCounts, ivec2(gl_FragCoord.xy), 1u);
+    const uint index = imageLoad(listHead, ivec2(gl_FragCoord.xy)).r + slot;
+    const uint next = 0xFFFFFFFF;
+    if (index >= fragmentCapacity)
+    {
+        /* The buffer is smaller than the total count when it's limited by
+           the memory budget. The slot is given back so the final count of
+           the pixel only includes the fragments stored. Slots past the
+           capacity are the only ones given back, so the count never drops
+           below the first of them and no stored slot is assigned twice. */
+        imageAtomicAdd(fragmentCounts, ivec2(gl_FragCoord.xy), 0xFFFFFFFFu);
+        discard;
+    }
+    updateCountHistogram(slot);
+#elif defined PAGED_LISTS
+    /* The list head of each pixel packs the current page index and how many
+       fragments of that page have been taken. A fragment slot is taken by
+       incrementing the fill count with a compare and swap. When the page is
+       full, the first fragment to set the fill count to LOCKED allocates a
+       new page and publishes it. All the work is done inside the iteration
+       that succeeds, so threads of the same SIMD group never wait for each
+       other. */
+    const ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uint index = 0xFFFFFFFF;
+    for (int i = 0; i < MAX_ALLOCATION_ATTEMPTS && index == 0xFFFFFFFF; ++i)
+    {
+        const uint head = imageAtomicAdd(listHead, pixel, 0u);
+        const uint fill = head & FILL_MASK;
+        if (fill < FRAGMENTS_PER_PAGE)
+        {
+            if (imageAtomicCompSwap(listHead, pixel, head, head + 1u) == head)
+                index = (head >> PAGE_FILL_BITS) * FRAGMENTS_PER_PAGE + fill;
+        }
+        else if (fill == FRAGMENTS_PER_PAGE &&
+                 imageAtomicCompSwap(listHead, pixel, head, head | LOCKED) ==
+                     head)
+        {
+            const uint page = atomicCounterIncrement(counter);
+            if (page >= fragmentCapacity / FRAGMENTS_PER_PAGE)
+            {
+                /* Buffer overflow, releasing the lock. */
+                imageAtomicExchange(listHead, pixel, head);
+                discard;
+            }
+            imageStore(pageLinks, int(page), uvec4(head >> PAGE_FILL_BITS));
+            /* The first slot of the new page is taken by this fragment. */
+            imageAtomicExchange(listHead, pixel, page << PAGE_FILL_BITS | 1u);
+            index = page * FRAGMENTS_PER_PAGE;
+        }
+        /* Otherwise another fragment is allocating a new page. */
+    }
+    if (index == 0xFFFFFFFF)
+        discard;
+    const uint next = 0xFFFFFFFF;
+#else
     /* Taking a new fragment from the fragment buffer. */
     uint index = atomicCounterIncrement(counter);
 
+    /* Checking for buffer overflow. The counter is incremented anyway, this
+       way the client code can know how many fragments did not fit. */
+    if (index >= fragmentCapacity)
+        discard;
+
     /* Linking this fragment with the previous one. */
     uint next = imageAtomicExchange(listHead, ivec2(gl_FragCoord.xy), index);
+#endif
 
     /* Storing the fragment info.
-       Alpha channel goes without premultiplication. */
-    const int offset = int(index) * 3;
-    imageStore(fragmentBuffer, offset, uvec4(next));
+       Alpha channel goes without premultiplication.
+       RECORD_SIZE, DEPTH_WORD and COLOR_WORD are defined by the client code
+       depending on the record encoding. Compact records have no next
+       pointer. With deferred shading the color word holds the material and
+       the alpha and NORMAL_WORD the packed normal. Split records store the
+       color words in fragmentColors instead. */
     const uint idepth = floatBitsToUint(depth);
-    imageStore(fragmentBuffer, offset + 1, uvec4(idepth));
+#ifdef DEFERRED_SHADING
+    const uint icolor =
+        (fragmentMaterial() & 0x00FFFFFFu) | (uint(alpha * 255) << 24u);
+    const uint inormal = packNormal(fragmentNormal());
+#else
     const uint icolor = uint(color[0] * 255) + (uint(color[1] * 255) << 8u) +
                         (uint(color[2] * 255) << 16u) +
                         (uint(color[3] * 255) << 24u);
-    imageStore(fragmentBuffer, offset + 2, uvec4(icolor));
+#endif
 
+#ifdef SHADER_STORAGE_FRAGMENTS
+    /* The whole record is written with a single store. */
+    Fragment fragment;
+#ifndef COMPACT_RECORDS
+    fragment.next = next;
+#endif
+    fragment.depth = idepth;
+#ifndef SPLIT_RECORDS
+    fragment.color = icolor;
+#ifdef DEFERRED_SHADING
+    fragment.normal = inormal;
+#endif
+#endif
+    fragments[index] = fragment;
+#else
+    const int offset = int(index) * RECORD_SIZE;
+#ifndef COMPACT_RECORDS
+    imageStore(fragmentBuffer, offset, uvec4(next));
+#endif
+    imageStore(fragmentBuffer, offset + DEPTH_WORD, uvec4(idepth));
+#ifndef SPLIT_RECORDS
+    imageStore(fragmentBuffer, offset + COLOR_WORD, uvec4(icolor));
+#ifdef DEFERRED_SHADING
+    imageStore(fragmentBuffer, offset + NORMAL_WORD, uvec4(inormal));
+#endif
+#endif
+#endif
+
+#ifdef SPLIT_RECORDS
+    const int colorOffset = int(index) * COLOR_RECORD_SIZE;
+    imageStore(fragmentColors, colorOffset + COLOR_WORD, uvec4(icolor));
+#ifdef DEFERRED_SHADING
+    imageStore(fragmentColors, colorOffset + NORMAL_WORD, uvec4(inormal));
+#endif
+#endif
+
+#ifdef OBJECT_IDS
+    imageStore(objectIDs, int(index), uvec4(objectID));
+#endif
+
+#ifndef PREFIX_SUM_ARRAYS
     /* Increasing the fragment count */
-    imageAtomicAdd(fragmentCounts, ivec2(gl_FragCoord.xy), 1u);
+    updateCountHistogram(
+        imageAtomicAdd(fragmentCounts, ivec2(gl_FragCoord.xy), 1u));
+#endif
 }
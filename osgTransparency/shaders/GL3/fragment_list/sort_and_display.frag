@@ -23,15 +23,43 @@
 #version 420
 
 #extension GL_EXT_gpu_shader4 : enable
+/* Extension directives must precede any other token, so the ones that
+   depend on the defines are substituted here. */
+$EXTENSIONS
 
 layout(early_fragment_tests) in;
 
+$DEFINES
+
 const int MAX_FRAGMENTS_PER_LIST = $MAX_FRAGMENTS_PER_LIST;
 
 uniform usampler2DRect listHead;
+#ifdef PREFIX_SUM_ARRAYS
+uniform usampler2DRect fragmentCounts;
+#endif
+#ifdef PAGED_LISTS
+uniform usamplerBuffer pageLinks;
+#define NULL_PAGE (0xFFFFFFFFu >> PAGE_FILL_BITS)
+#endif
 
+#ifdef SHADER_STORAGE_FRAGMENTS
+/* The records are read one word at a time, so they are seen as a flat
+   array. */
+layout(std430, binding = FRAGMENT_STORAGE_BINDING) restrict readonly buffer
+    FragmentStorage
+{
+    uint fragmentWords[];
+};
+#else
 uniform usamplerBuffer fragmentBuffer;
-/* The lower left corner of the camera viewport */
+#endif
+#ifdef SPLIT_RECORDS
+uniform usamplerBuffer fragmentColors;
+#endif
+#if defined DEFERRED_SHADING || defined SPLIT_RECORDS
+#define LAZY_COLORS
+#endif
+/* The lower left corner of the viewport area being composited */
 uniform vec2 corner;
 
 layout(location = 0) out vec4 outColor;
@@ -44,9 +72,56 @@ layout(location = 0) out vec4 outColor;
     }
 
 float depths[$MAX_FRAGMENTS_PER_LIST];
+/* With deferred shading or split records the record indices are sorted
+   instead of the colors, the colors or shading inputs are only fetched for
+   the fragments that are blended. */
 uint icolors[$MAX_FRAGMENTS_PER_LIST];
 uint size = 0;
 
+#ifdef EARLY_TERMINATION
+/* Blending stops once the accumulated opacity reaches this value */
+uniform float maxOpacity;
+#endif
+
+#ifdef DEFERRED_SHADING
+/* Fragments are skipped once the transmittance is below this value */
+uniform float minTransmittance;
+
+vec3 shadeDeferredFragment(vec3 normal, uint material, float depth);
+
+vec3 unpackNormal(const uint packed)
+{
+    const vec2 p = unpackSnorm2x16(packed);
+    vec3 normal = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (normal.z < 0.0)
+        normal.xy = (1.0 - abs(normal.yx)) *
+                    vec2(normal.x >= 0.0 ? 1.0 : -1.0,
+                         normal.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(normal);
+}
+#endif
+
+uint fetchWord(const int offset)
+{
+#ifdef SHADER_STORAGE_FRAGMENTS
+    return fragmentWords[offset];
+#else
+    return texelFetchBuffer(fragmentBuffer, offset)[0];
+#endif
+}
+
+/* Returns a word of the color record of the fragment at index.
+   COLOR_RECORD_SIZE is defined by the client code for split records. */
+uint fetchColorWord(const uint index, const int word)
+{
+#ifdef SPLIT_RECORDS
+    return texelFetchBuffer(fragmentColors,
+                            int(index) * COLOR_RECORD_SIZE + word)[0];
+#else
+    return fetchWord(int(index) * RECORD_SIZE + word);
+#endif
+}
+
 vec4 unpackColor(uint icolor)
 {
     const vec4 color = vec4(float(icolor & 0xFFu) / 255.0,
@@ -57,10 +132,50 @@ vec4 unpackColor(uint icolor)
     return vec4(color.rgb * color.a, color.a);
 }
 
+/* Appends the fragment record at the given index to the arrays.
+   RECORD_SIZE, DEPTH_WORD and COLOR_WORD are defined by the client code
+   depending on the record encoding. */
+void appendFragment(const uint index)
+{
+    const int offset = int(index) * RECORD_SIZE;
+    depths[size] = uintBitsToFloat(fetchWord(offset + DEPTH_WORD));
+#ifdef LAZY_COLORS
+    icolors[size] = index;
+#else
+    icolors[size] = fetchWord(offset + COLOR_WORD);
+#endif
+    ++size;
+}
+
 void copyToArrays()
 {
     const vec2 coord = gl_FragCoord.xy - corner;
 
+#ifdef PREFIX_SUM_ARRAYS
+    const uint count = texture2DRect(fragmentCounts, coord).r;
+    if (count == 0)
+        discard;
+
+    const uint first = texture2DRect(listHead, coord).r;
+    for (uint index = first; index < first + count; ++index)
+        appendFragment(index);
+#elif defined PAGED_LISTS
+    const uint head = texture2DRect(listHead, coord).r;
+    uint page = head >> PAGE_FILL_BITS;
+    if (page == NULL_PAGE)
+        discard;
+
+    /* Only the last page allocated can be partially filled. */
+    uint fill = head & ((1u << PAGE_FILL_BITS) - 1u);
+    while (page != NULL_PAGE)
+    {
+        const uint first = page * FRAGMENTS_PER_PAGE;
+        for (uint index = first; index < first + fill; ++index)
+            appendFragment(index);
+        page = texelFetchBuffer(pageLinks, int(page))[0];
+        fill = FRAGMENTS_PER_PAGE;
+    }
+#else
     uint index = texture2DRect(listHead, coord).r;
 
     if (index == 0xFFFFFFFF)
@@ -68,13 +183,10 @@ void copyToArrays()
 
     while (index != 0xFFFFFFFF)
     {
-        const int offset = int(index) * 3;
-        index = texelFetchBuffer(fragmentBuffer, offset)[0];
-        const uint idepth = texelFetchBuffer(fragmentBuffer, offset + 1)[0];
-        depths[size] = uintBitsToFloat(idepth);
-        icolors[size] = texelFetchBuffer(fragmentBuffer, offset + 2)[0];
-        ++size;
+        appendFragment(index);
+        index = fetchWord(int(index) * RECORD_SIZE);
     }
+#endif
 }
 
 void insertSort()
@@ -142,9 +254,70 @@ void heapSort()
     }
 }
 
+/* Sorting network for the lists of this batch. The network is generated by
+   the client code for MAX_FRAGMENTS_PER_LIST elements, only constant indices
+   are used. */
+#define COMPARE_EXCHANGE(i, j)             \
+    if (depths[j] < depths[i])             \
+    {                                      \
+        SWAP(depths, i, j, float);         \
+        SWAP(icolors, i, j, uint);         \
+    }
+
+$SORTING_NETWORK
+
+#ifdef USE_SORTING_NETWORK
+void networkSort()
+{
+    /* Padding the list with fragments at infinity, so they stay at the end */
+    for (uint i = size; i < uint(MAX_FRAGMENTS_PER_LIST); ++i)
+        depths[i] = uintBitsToFloat(0x7F800000u);
+    sortingNetwork();
+}
+#endif
+
+/* The premultiplied color of a fragment given its depth and the value stored
+   in icolors. */
+vec4 fragmentColor(const float depth, const uint icolor)
+{
+#ifdef DEFERRED_SHADING
+    const uint inputs = fetchColorWord(icolor, COLOR_WORD);
+    const float alpha = float(inputs >> 24u) / 255.0;
+    /* Fully transparent fragments don't need to be shaded. */
+    if (alpha == 0.0)
+        return vec4(0.0);
+    const vec3 normal = unpackNormal(fetchColorWord(icolor, NORMAL_WORD));
+    const vec3 color = clamp(
+        shadeDeferredFragment(normal, inputs & 0x00FFFFFFu, depth),
+        vec3(0.0), vec3(1.0));
+    return vec4(color * alpha, alpha);
+#elif defined SPLIT_RECORDS
+    return unpackColor(fetchColorWord(icolor, COLOR_WORD));
+#else
+    return unpackColor(icolor);
+#endif
+}
+
+/* Whether the fragments behind those accumulated in color can be
+   skipped. */
+bool isSaturated(const vec4 color)
+{
+#ifdef EARLY_TERMINATION
+    if (color.a >= maxOpacity)
+        return true;
+#endif
+#ifdef DEFERRED_SHADING
+    /* The fragments behind can't change the result noticeably, so they are
+       not shaded. */
+    if (1 - color.a < minTransmittance)
+        return true;
+#endif
+    return false;
+}
+
 void blendAndDisplay()
 {
-    vec4 color = unpackColor(icolors[0]);
+    vec4 color = fragmentColor(depths[0], icolors[0]);
 
     float depth = depths[0];
     for (uint i = 1; i < size; ++i)
@@ -156,19 +329,68 @@ void blendAndDisplay()
         }
         depth = depths[i];
 
-        color += unpackColor(icolors[i]) * (1 - color.a);
+        if (isSaturated(color))
+            break;
+        color += fragmentColor(depths[i], icolors[i]) * (1 - color.a);
     }
 
     outColor = color;
 }
 
+#ifdef EARLY_TERMINATION
+void fixMinHeapDown(uint root, const uint end)
+{
+    uint child = LEFT(root);
+    while (child < end)
+    {
+        /* Find the smallest of the children */
+        if (child + 1 < end && depths[child + 1] < depths[child])
+            ++child;
+        if (depths[root] <= depths[child])
+            return;
+        SWAP(depths, child, root, float);
+        SWAP(icolors, child, root, uint);
+        root = child;
+        child = LEFT(root);
+    }
+}
+
+/* Extracts the fragments front to back from a min-heap and blends them
+   until the color is saturated. Heapifying is linear, so the cost of the
+   sorting is proportional to the number of fragments that are blended
+   instead of the list length. The extraction order guarantees the depth
+   order, so there's no need to check it. */
+void selectAndDisplay()
+{
+    for (uint start = size / 2; start > 0; --start)
+        fixMinHeapDown(start - 1, size);
+
+    vec4 color = vec4(0.0);
+    for (uint end = size; end > 0 && !isSaturated(color); --end)
+    {
+        color += fragmentColor(depths[0], icolors[0]) * (1 - color.a);
+        SWAP(depths, 0, end - 1, float);
+        SWAP(icolors, 0, end - 1, uint);
+        fixMinHeapDown(0, end - 1);
+    }
+
+    outColor = color;
+}
+#endif
+
 void main(void)
 {
     copyToArrays();
-#if $MAX_FRAGMENTS_PER_LIST < 32
+#if defined USE_SORTING_NETWORK
+    networkSort();
+    blendAndDisplay();
+#elif $MAX_FRAGMENTS_PER_LIST < 32
     insertSort();
+    blendAndDisplay();
+#elif defined EARLY_TERMINATION
+    selectAndDisplay();
 #else
     heapSort();
-#endif
     blendAndDisplay();
+#endif
 }
@@ -26,6 +26,7 @@
 $DEFINES
 //#define SLICES n
 //#define ADJUST_QUANTILES_WITH_ALPHA?
+//#define PARTITION_TILE_SIZE n?
 
 #if defined ADJUST_QUANTILES_WITH_ALPHA
 #define POINTS SLICES
@@ -33,9 +34,10 @@ $DEFINES
 #define POINTS SLICES - 1
 #endif
 #define SPLITS SLICES - 1
+#define PARTITION_TEXTURES ((POINTS + 3) / 4)
 
 #if POINTS >= 1
-uniform sampler2DRect depthPartitionTextures[(POINTS + 3) / 4];
+uniform sampler2DRect depthPartitionTextures[PARTITION_TEXTURES];
 #endif
 
 /* Define for the return type and the value for the discard case. */
@@ -51,19 +53,17 @@ uniform sampler2DRect depthPartitionTextures[(POINTS + 3) / 4];
 #define RETURN_TYPE bool
 #endif
 
-/* Defines for the vector type and swizzle declarations for the last texture
-   fetch and the return value. */
+/* Defines for the swizzle declaration of the texture fetch when there's
+   a single partition texture. */
 /* Macro arithmetics are working funny */
-#if POINTS == 1 || POINTS == 5
+#if POINTS == 1
 #define CHANNELS r
-#elif POINTS == 2 || POINTS == 6
+#elif POINTS == 2
 #define CHANNELS rg
-#elif POINTS == 3 || POINTS == 7
+#elif POINTS == 3
 #define CHANNELS rgb
-#elif POINTS == 4 || POINTS == 8
+#elif POINTS == 4
 #define CHANNELS rgba
-#elif POINTS > 8
-#error "Unsupported number of split points"
 #endif
 
 #if SPLITS > 4
@@ -74,27 +74,28 @@ float splitPoints[SPLITS];
 /* Function prototype. */
 RETURN_TYPE checkPartitionAndGetSplitPoints(const vec2 coord, float depth)
 {
-/* Reading depth partition textures. */
+#ifdef PARTITION_TILE_SIZE
+    /* The partition textures have one texel per screen tile. */
+    const vec2 texel = floor(coord / float(PARTITION_TILE_SIZE)) + 0.5;
+#else
+    const vec2 texel = coord;
+#endif
+/* Reading depth partition textures. The unused channels of the last
+   texture are never read. */
 #if POINTS > 4
-    vec4 points[2];
-    points[0] = texture2DRect(depthPartitionTextures[0], coord).rgba;
-    points[1].CHANNELS =
-        texture2DRect(depthPartitionTextures[1], coord).CHANNELS;
+    vec4 points[PARTITION_TEXTURES];
+    for (int i = 0; i < PARTITION_TEXTURES; ++i)
+        points[i] = texture2DRect(depthPartitionTextures[i], texel);
 #elif POINTS != 0
     vec4 points[1];
     points[0].CHANNELS =
-        texture2DRect(depthPartitionTextures[0], coord).CHANNELS;
+        texture2DRect(depthPartitionTextures[0], texel).CHANNELS;
 #endif
 
 #if defined ADJUST_QUANTILES_WITH_ALPHA
 
-#if POINTS < 5
-    if (depth > points[0][POINTS - 1])
+    if (depth > points[(POINTS - 1) / 4][(POINTS - 1) % 4])
         discard;
-#else
-    if (depth > points[1][POINTS - 5])
-        discard;
-#endif
 
 #if SPLITS == 0
     return true;
@@ -107,10 +108,8 @@ RETURN_TYPE checkPartitionAndGetSplitPoints(const vec2 coord, float depth)
 #elif SPLITS == 4
     return points[0];
 #else
-    for (int i = 0; i < 4; ++i)
-        splitPoints[i] = points[0][i];
-    for (int i = 4; i < SPLITS; ++i)
-        splitPoints[i] = points[1][i - 4];
+    for (int i = 0; i < SPLITS; ++i)
+        splitPoints[i] = points[i / 4][i % 4];
     return true;
 #endif
 
@@ -127,10 +126,8 @@ RETURN_TYPE checkPartitionAndGetSplitPoints(const vec2 coord, float depth)
 #elif SPLITS == 4
     return points[0].rgba;
 #else
-    for (int i = 0; i < 4; ++i)
-        splitPoints[i] = points[0][i];
-    for (int i = 4; i < SPLITS; ++i)
-        splitPoints[i] = points[1][i - 4];
+    for (int i = 0; i < SPLITS; ++i)
+        splitPoints[i] = points[i / 4][i % 4];
     return true;
 #endif
 #endif
@@ -0,0 +1,85 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_shader_image_load_store : enable
+
+uniform float proj33;
+uniform float proj34;
+float unproject(float x)
+{
+    return -proj34 / (proj33 + 2.0 * x - 1.0);
+}
+float reproject(float x)
+{
+    return 0.5 * (1.0 - proj33 - proj34 / x);
+}
+
+//#define BINS x
+//#define PACKED_BINS?
+//#define TILE_SIZE n?
+$DEFINES
+
+#ifdef PACKED_BINS
+/* Two 16-bit counters per texel. The counters saturate at SATURATION,
+   leaving headroom for the fragments that increment a counter at the same
+   time, so they never carry into the other half. */
+#define LAYERS (BINS / 2)
+#define SATURATION 0x8000u
+#else
+#define LAYERS BINS
+#endif
+
+layout(r32ui) restrict uniform uimage2DArray histogram;
+
+float fragmentDepth();
+
+void main()
+{
+    /* Bins are evenly spaced in logarithmic depth between the near and far
+       planes. */
+    float near = -unproject(0.0);
+    float far = -unproject(1.0);
+    float depth = -unproject(fragmentDepth());
+    int bin = int(log(depth / near) / log(far / near) * float(BINS));
+    bin = clamp(bin, 0, BINS - 1);
+
+#ifdef TILE_SIZE
+    ivec2 pixel = ivec2(gl_FragCoord.xy) / TILE_SIZE;
+#else
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+#endif
+
+#ifdef PACKED_BINS
+    /* Consecutive bins are stored in different layers to reduce the
+       collisions in the atomic operations. */
+    const ivec3 texel = ivec3(pixel, bin % LAYERS);
+    const uint shift = uint(bin / LAYERS) * 16u;
+    const uint previous = imageAtomicAdd(histogram, texel, 1u << shift);
+    if (((previous >> shift) & 0xFFFFu) >= SATURATION)
+        /* Undoing the increment of a saturated counter */
+        imageAtomicAdd(histogram, texel, 0u - (1u << shift));
+#else
+    imageAtomicAdd(histogram, ivec3(pixel, bin), 1u);
+#endif
+}
@@ -0,0 +1,127 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_shader_image_load_store : enable
+
+uniform float proj33;
+uniform float proj34;
+float unproject(float x)
+{
+    return -proj34 / (proj33 + 2.0 * x - 1.0);
+}
+float reproject(float x)
+{
+    return 0.5 * (1.0 - proj33 - proj34 / x);
+}
+
+//#define POINTS x
+//#define BINS x
+//#define PACKED_BINS?
+//#define TILE_SIZE n?
+//#define PROJECT_Z?
+$DEFINES
+
+#ifdef PACKED_BINS
+/* Two 16-bit counters per texel */
+#define LAYERS (BINS / 2)
+#else
+#define LAYERS BINS
+#endif
+
+layout(r32ui) restrict uniform uimage2DArray histogram;
+
+uniform float quantiles[POINTS];
+
+layout(location = 0) out vec4 splitPoints[(POINTS + 3) / 4];
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+
+    uint texels[LAYERS];
+    float total = 0.0;
+    for (int layer = 0; layer < LAYERS; ++layer)
+    {
+        texels[layer] = imageLoad(histogram, ivec3(pixel, layer)).r;
+#ifdef PACKED_BINS
+        total += float((texels[layer] & 0xFFFFu) + (texels[layer] >> 16));
+#else
+        total += float(texels[layer]);
+#endif
+    }
+    if (total == 0.0)
+        discard;
+
+    /* Clearing the histogram for the next frame */
+    for (int layer = 0; layer < LAYERS; ++layer)
+        imageStore(histogram, ivec3(pixel, layer), uvec4(0u));
+
+    float near = -unproject(0.0);
+    float far = -unproject(1.0);
+    float logRange = log(far / near);
+
+    /* The quantiles are sorted, so all the split points are found in a
+       single sweep. Depths are interpolated linearly inside each bin. */
+    float values[POINTS];
+    for (int point = 0; point < POINTS; ++point)
+        values[point] = far;
+    int point = 0;
+    float left = 0.0;
+    for (int bin = 0; bin < BINS && point < POINTS; ++bin)
+    {
+#ifdef PACKED_BINS
+        float count =
+            float(texels[bin % LAYERS] >> ((bin / LAYERS) * 16) & 0xFFFFu);
+#else
+        float count = float(texels[bin]);
+#endif
+        while (point < POINTS && count != 0.0 &&
+               left + count >= total * quantiles[point])
+        {
+            float fraction = max(total * quantiles[point] - left, 0.0) / count;
+            values[point] =
+                near * exp((float(bin) + fraction) / float(BINS) * logRange);
+            ++point;
+        }
+        left += count;
+    }
+
+    for (int point = 0; point < POINTS; ++point)
+    {
+        float value = values[point];
+#ifdef PROJECT_Z
+        if (quantiles[point] == 0.0)
+            value = 0;
+        else if (quantiles[point] == 1.0)
+            value = 1;
+        else
+            value = reproject(-value);
+#endif
+        splitPoints[point / 4][point % 4] = value;
+    }
+
+#if (POINTS + 3) / 4 > 8
+#error "Unsupported number of simultaneous quantiles"
+#endif
+}
@@ -45,6 +45,10 @@ uniform sampler2DRect codedPreviousIntervalsTexture1;
 #if POINTS > 4
 uniform sampler2DRect codedPreviousIntervalsTexture2;
 #endif
+#ifdef TEMPORAL
+/* Only the pixels for which the temporal guess failed are searched. */
+uniform sampler2DRect failedPixels;
+#endif
 
 int findInterval(float depth, float abs_min, float abs_max,
                  int previous_intervals);
@@ -53,6 +57,10 @@ float fragmentDepth();
 
 void main()
 {
+#ifdef TEMPORAL
+    if (texture2DRect(failedPixels, gl_FragCoord.xy).r == 0.0)
+        discard;
+#endif
     vec2 minMax = texture2DRect(minMaxTexture, gl_FragCoord.xy).rg;
     float min = -minMax[0];
     float max = minMax[1];
@@ -40,6 +40,7 @@ float reproject(float x)
 //#define ADJUST_QUANTILES_WITH_ALPHA
 //#define DOUBLE_WIDTH?
 //#define PROJECT_Z?
+//#define TEMPORAL?
 $DEFINES
 
 uniform sampler2DRect minMaxTexture;
@@ -56,7 +57,13 @@ uint get_interval_count(int point, int interval)
     return texel >> (interval * 8) & 0xFF;
 }
 
-out vec4 splitPoints[POINTS / 4 + 1];
+layout(location = 0) out vec4 splitPoints[POINTS / 4 + 1];
+#ifdef TEMPORAL
+/* Unprojected split points and bin width for the next frame. */
+layout(location = 2) out vec4 history[POINTS / 4 + 1];
+/* Only the pixels for which the temporal guess failed are searched. */
+uniform sampler2DRect failedPixels;
+#endif
 
 void main()
 {
@@ -66,6 +73,10 @@ void main()
     float total = texture2DRect(totalCountsTexture, gl_FragCoord.xy).r;
     if (total == 0.0)
         discard;
+#ifdef TEMPORAL
+    if (texture2DRect(failedPixels, gl_FragCoord.xy).r == 0.0)
+        discard;
+#endif
 
     vec4 codes1 =
         texture2DRect(codedPreviousIntervalsTextures[0], gl_FragCoord.xy);
@@ -133,19 +144,11 @@ void main()
 
         if (quantile == 0.0)
         {
-#ifdef PROJECT_Z
-            value = 0;
-#else
             value = abs_min;
-#endif
         }
         else if (quantile == 1.0)
         {
-#ifdef PROJECT_Z
-            value = 1;
-#else
             value = abs_max;
-#endif
         }
         else
         {
@@ -155,10 +158,19 @@ void main()
                 value = start;
             else
                 value = start + width;
+        }
+#ifdef TEMPORAL
+        history[point / 4][point % 4] = value;
+        history[POINTS / 4][POINTS % 4] = width;
+#endif
 #ifdef PROJECT_Z
+        if (quantile == 0.0)
+            value = 0;
+        else if (quantile == 1.0)
+            value = 1;
+        else
             value = reproject(-value);
 #endif
-        }
         splitPoints[point / 4][point % 4] = value;
     }
 }
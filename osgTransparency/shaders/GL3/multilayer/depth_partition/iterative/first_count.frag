@@ -45,6 +45,10 @@ float reproject(float x)
 }
 
 uniform sampler2DRect minMaxTexture;
+#ifdef TEMPORAL
+/* Only the pixels for which the temporal guess failed are searched. */
+uniform sampler2DRect failedPixels;
+#endif
 float fragmentDepth();
 
 /* http://graphics.stanford.edu/~seander/bithacks.html#ZerosOnRightLinear */
@@ -69,6 +73,10 @@ uint index_of_first_one(uint v)
 
 void main()
 {
+#ifdef TEMPORAL
+    if (texture2DRect(failedPixels, gl_FragCoord.xy).r == 0.0)
+        discard;
+#endif
     /* We count unprojected depth values */
     float depth = -unproject(fragmentDepth());
     vec2 minMax = texture2DRect(minMaxTexture, gl_FragCoord.xy).rg;
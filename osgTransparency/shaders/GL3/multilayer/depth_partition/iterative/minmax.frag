@@ -22,8 +22,15 @@
 
 #version 420
 
+#extension GL_ARB_texture_rectangle : enable
+
 $DEFINES
 
+#ifdef TEMPORAL
+/* Only the pixels for which the temporal guess failed are searched. */
+uniform sampler2DRect failedPixels;
+#endif
+
 out vec2 minMax;
 
 uniform float proj33;
@@ -41,6 +48,11 @@ float fragmentDepth();
 
 void main()
 {
+#ifdef TEMPORAL
+    if (texture2DRect(failedPixels, gl_FragCoord.xy).r == 0.0)
+        discard;
+#endif
+
     /* We want to compute:
        min = unproject(max_i{x_i} + delta)
        max = unproject(min_i{x_i} - delta)
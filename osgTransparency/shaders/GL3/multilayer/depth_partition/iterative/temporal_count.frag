@@ -0,0 +1,96 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+
+#extension GL_EXT_shader_image_load_store : enable
+#extension GL_ARB_texture_rectangle : enable
+
+uniform float proj33;
+uniform float proj34;
+float unproject(float x)
+{
+    return -proj34 / (proj33 + 2.0 * x - 1.0);
+}
+float reproject(float x)
+{
+    return 0.5 * (1.0 - proj33 - proj34 / x);
+}
+
+//#define POINTS x
+$DEFINES
+
+layout(r32ui) restrict uniform uimage2DRect counts[POINTS];
+
+/* Unprojected split points of the previous frame followed by the width of
+   the bins with which they were found. */
+uniform sampler2DRect historyTextures[POINTS / 4 + 1];
+
+float fragmentDepth();
+
+/* Additive blending is used to count the total number of fragments and the
+   fragments in front of the search bracket of each point. */
+layout(location = 0) out vec2 total;
+layout(location = 1) out vec4 leftCounts[(POINTS - 1) / 4 + 1];
+
+void main()
+{
+    float history[(POINTS / 4 + 1) * 4];
+    for (int i = 0; i < POINTS / 4 + 1; ++i)
+    {
+        vec4 texel = texture2DRect(historyTextures[i], gl_FragCoord.xy);
+        for (int j = 0; j < 4; ++j)
+            history[i * 4 + j] = texel[j];
+    }
+    float width = history[POINTS];
+
+    float depth = -unproject(fragmentDepth());
+
+    for (int i = 0; i < (POINTS - 1) / 4 + 1; ++i)
+        leftCounts[i] = vec4(0.0);
+
+    for (int point = 0; point < POINTS; ++point)
+    {
+        /* The search bracket of each point is made of 4 bins, two at each
+           side of the previous split point. Fragments are counted with the
+           same half open intervals as in findInterval. A zero width (no
+           history for this pixel) leaves all the bins empty, so the guess
+           is rejected later on. */
+        float start = history[point] - 2.0 * width;
+        if (depth < start)
+        {
+            leftCounts[point / 4][point % 4] = 1.0;
+        }
+        else if (width > 0.0)
+        {
+            int interval = int((depth - start) / width);
+            if (interval < 4)
+                imageAtomicAdd(counts[point], ivec2(gl_FragCoord.xy),
+                               1u << (interval * 8));
+        }
+    }
+    total = vec2(1.0, 0.0);
+
+#if POINTS > 7
+#error "Unsupported number of simultaneous quantiles"
+#endif
+}
@@ -0,0 +1,38 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+#extension GL_ARB_texture_rectangle : enable
+
+uniform sampler2DRect failedPixels;
+
+out vec2 minMax;
+
+void main()
+{
+    /* Only the pixels for which the depth partition of the previous frame
+       was a bad guess pass through. The min/max depths of those pixels are
+       reset for the full search that follows. */
+    if (texture2DRect(failedPixels, gl_FragCoord.xy).r == 0.0)
+        discard;
+    minMax = vec2(-1000000000.0, 0.0);
+}
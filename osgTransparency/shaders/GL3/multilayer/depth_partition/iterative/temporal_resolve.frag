@@ -0,0 +1,140 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#version 420
+#extension GL_ARB_texture_rectangle : enable
+#extension GL_EXT_gpu_shader4 : enable
+
+uniform float proj33;
+uniform float proj34;
+float unproject(float x)
+{
+    return -proj34 / (proj33 + 2.0 * x - 1.0);
+}
+float reproject(float x)
+{
+    return 0.5 * (1.0 - proj33 - proj34 / x);
+}
+
+//#define POINTS x
+//#define PROJECT_Z?
+$DEFINES
+
+uniform sampler2DRect historyTextures[POINTS / 4 + 1];
+uniform sampler2DRect totalCountsTexture;
+uniform sampler2DRect leftAccumTextures[(POINTS - 1) / 4 + 1];
+uniform usampler2DRect countTextures[POINTS];
+
+uniform float quantiles[POINTS];
+
+uint get_interval_count(int point, int interval)
+{
+    uint texel = texture2DRect(countTextures[point], gl_FragCoord.xy).r;
+    return texel >> (interval * 8) & 0xFF;
+}
+
+layout(location = 0) out vec4 splitPoints[POINTS / 4 + 1];
+layout(location = 2) out vec4 history[POINTS / 4 + 1];
+layout(location = 4) out float failed;
+
+void main()
+{
+    float points[(POINTS / 4 + 1) * 4];
+    for (int i = 0; i < POINTS / 4 + 1; ++i)
+    {
+        vec4 texel = texture2DRect(historyTextures[i], gl_FragCoord.xy);
+        for (int j = 0; j < 4; ++j)
+            points[i * 4 + j] = texel[j];
+    }
+    float width = points[POINTS];
+    float total = texture2DRect(totalCountsTexture, gl_FragCoord.xy).r;
+
+    vec4 left_accums1 = texture2DRect(leftAccumTextures[0], gl_FragCoord.xy);
+#if POINTS > 4
+    vec4 left_accums2 = texture2DRect(leftAccumTextures[1], gl_FragCoord.xy);
+#endif
+
+    /* Pixels without fragments keep their history for later frames. */
+    bool success = total == 0.0 || width > 0.0;
+
+    for (int point = 0; point < POINTS && total != 0.0 && success; ++point)
+    {
+        float quantile = quantiles[point];
+        /* The end points of the depth range are not tracked from frame to
+           frame, the full search finds them. */
+        if (quantile == 0.0 || quantile == 1.0)
+        {
+            success = false;
+            break;
+        }
+
+#if POINTS > 4
+        float left =
+            point < 4 ? left_accums1[point] : left_accums2[point - 4];
+#else
+        float left = left_accums1[point];
+#endif
+        float expected = total * quantile;
+        /* The guess is only valid if the quantile lies inside the bracket
+           of 4 bins around the previous split point. */
+        if (expected < left)
+        {
+            success = false;
+            break;
+        }
+        int interval = 0;
+        float count = get_interval_count(point, 0);
+        while (interval < 3 && count + left <= expected)
+        {
+            left += count;
+            ++interval;
+            count = get_interval_count(point, interval);
+        }
+        if (count + left <= expected)
+        {
+            success = false;
+            break;
+        }
+
+        /* Same rounding as in the final step of the full search. */
+        float start = points[point] + width * float(interval - 2);
+        if (expected - left < (count + left) - expected)
+            points[point] = start;
+        else
+            points[point] = start + width;
+    }
+
+    failed = success ? 0.0 : 1.0;
+
+    for (int i = 0; i < POINTS / 4 + 1; ++i)
+        history[i] = vec4(points[i * 4], points[i * 4 + 1], points[i * 4 + 2],
+                          points[i * 4 + 3]);
+
+    for (int point = 0; point < POINTS; ++point)
+    {
+#ifdef PROJECT_Z
+        splitPoints[point / 4][point % 4] = reproject(-points[point]);
+#else
+        splitPoints[point / 4][point % 4] = points[point];
+#endif
+    }
+}
@@ -43,7 +43,8 @@ $DEFINES
 
 #define DEPTH_BUFFERS ((SLICES + 1) / 2)
 
-uniform sampler2DRect depthBuffers[DEPTH_BUFFERS];
+/* One layer per depth buffer */
+uniform sampler2DArray depthBuffers;
 
 /* Each sampler2DArray  image2DArray pair uses the same underlying texture. */
 
@@ -144,7 +145,8 @@ void main(void)
     const float depth = fragmentDepth();
 #endif
     for (int i = 0; i < DEPTH_BUFFERS; ++i)
-        currentDepths[i] = texture2DRect(depthBuffers[i], gl_FragCoord.xy);
+        currentDepths[i] =
+            texelFetch(depthBuffers, ivec3(gl_FragCoord.xy, i), 0);
 
     const vec2 coord = gl_FragCoord.xy;
 /* Getting split points with depth range check included. */
@@ -50,6 +50,8 @@ namespace osgTransparency
 /** @internal */
 class ShapeData;
 typedef std::map<const osg::Drawable*, ShapeData> BoundShapesStorage;
+/** @internal */
+struct BoundsInstances;
 
 typedef osg::ref_ptr<osg::Program> ProgramPtr;
 typedef std::map<const osg::StateSet*, ProgramPtr> ProgramMap;
@@ -0,0 +1,172 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_UTIL_CAMERACACHE_H
+#define OSGTRANSPARENCY_UTIL_CAMERACACHE_H
+
+#include "constants.h"
+
+#include <osg/Camera>
+#include <osg/observer_ptr>
+
+#include <algorithm>
+#include <list>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+/**
+   Bounded LRU cache of the per camera resources of a rendering context.
+
+   Without it, a context that renders several cameras per frame (e.g. an
+   overview and a main view, or render to texture cameras) reallocates all
+   its buffers and state sets on every camera switch.
+
+   Entries are looked up by camera. The caller must still check that the
+   entry found is valid for the current viewport size and replace it
+   otherwise. Entries whose camera has been deleted are dropped.
+   The least recently used entries are evicted when there are more than
+   maxEntries or when the memory used by all of them, as reported by their
+   getMemoryUsage() member function, goes above maxMemory. The most recently
+   used entry is never evicted.
+
+   Ptr is a smart pointer type (osg::ref_ptr, boost::shared_ptr).
+*/
+template <typename Ptr>
+class CameraCache
+{
+public:
+    /**
+       @param maxEntries Maximum number of cameras, at least 1.
+       @param maxMemory Maximum memory in bytes, 0 for no limit.
+    */
+    CameraCache(const size_t maxEntries = CAMERA_CACHE_SIZE,
+                const size_t maxMemory = CAMERA_CACHE_MEMORY)
+        : _maxEntries(std::max(size_t(1), maxEntries))
+        , _maxMemory(maxMemory)
+    {
+    }
+
+    /** Returns the entry of a camera and makes it the most recently used,
+        or a null pointer if there's none. */
+    Ptr find(const osg::Camera* camera)
+    {
+        _dropDeletedCameras();
+        for (typename Entries::iterator i = _entries.begin();
+             i != _entries.end(); ++i)
+        {
+            if (i->camera == camera)
+            {
+                _entries.splice(_entries.begin(), _entries, i);
+                return i->value;
+            }
+        }
+        return Ptr();
+    }
+
+    /** Inserts or replaces the entry of a camera as the most recently used
+        and evicts entries if needed. */
+    void insert(osg::Camera* camera, const Ptr& value)
+    {
+        erase(camera);
+        _entries.push_front(Entry(camera, value));
+        shrink();
+    }
+
+    void erase(const osg::Camera* camera)
+    {
+        for (typename Entries::iterator i = _entries.begin();
+             i != _entries.end(); ++i)
+        {
+            if (i->camera == camera)
+            {
+                _entries.erase(i);
+                return;
+            }
+        }
+    }
+
+    /** Evicts the least recently used entries until the limits are
+        honoured. Must be called when the resources of an entry grow. */
+    void shrink()
+    {
+        size_t memory = 0;
+        for (typename Entries::const_iterator i = _entries.begin();
+             i != _entries.end(); ++i)
+        {
+            memory += i->value->getMemoryUsage();
+        }
+        while (_entries.size() > 1 &&
+               (_entries.size() > _maxEntries ||
+                (_maxMemory != 0 && memory > _maxMemory)))
+        {
+            memory -= _entries.back().value->getMemoryUsage();
+            _entries.pop_back();
+        }
+    }
+
+    /** The most recently used entry or a null pointer if the cache is
+        empty. */
+    Ptr mostRecent() const
+    {
+        return _entries.empty() ? Ptr() : _entries.front().value;
+    }
+
+    size_t size() const { return _entries.size(); }
+
+private:
+    struct Entry
+    {
+        Entry(osg::Camera* camera_, const Ptr& value_)
+            : camera(camera_)
+            , observer(camera_)
+            , value(value_)
+        {
+        }
+        /* Kept apart from the observer because the observer returns null
+           once the camera is deleted. */
+        const osg::Camera* camera;
+        osg::observer_ptr<osg::Camera> observer;
+        Ptr value;
+    };
+    typedef std::list<Entry> Entries;
+
+    Entries _entries;
+    const size_t _maxEntries;
+    const size_t _maxMemory;
+
+    void _dropDeletedCameras()
+    {
+        for (typename Entries::iterator i = _entries.begin();
+             i != _entries.end();)
+        {
+            if (!i->observer.valid())
+                i = _entries.erase(i);
+            else
+                ++i;
+        }
+    }
+};
+}
+}
+#endif
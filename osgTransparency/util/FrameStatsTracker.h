@@ -0,0 +1,86 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_UTIL_FRAMESTATSTRACKER_H
+#define OSGTRANSPARENCY_UTIL_FRAMESTATSTRACKER_H
+
+#include "GPUTimer.h"
+
+#include "osgTransparency/BaseRenderBin.h"
+
+#include <deque>
+#include <utility>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+/**
+   Matches the pass counts of the frames drawn by a render bin with the GPU
+   times of the same frames, which are only known some frames later.
+
+   This class is not thread safe.
+*/
+class FrameStatsTracker
+{
+public:
+    typedef BaseRenderBin::FrameStats FrameStats;
+
+    /** Records the number of passes of a frame and returns in stats the
+        statistics of the last frame that is complete.
+
+        Must be called after timer->checkQueries(). If timer is null the
+        statistics of the given frame are returned right away.
+
+        @return false if no frame is complete yet.
+    */
+    bool update(const unsigned int frame, const unsigned int passes,
+                const GPUTimer* timer, FrameStats& stats)
+    {
+        if (!timer)
+        {
+            stats.frame = frame;
+            stats.passes = passes;
+            stats.milliseconds.clear();
+            return true;
+        }
+
+        _passes.push_back(std::make_pair(frame, passes));
+        FrameStats completed;
+        if (!timer->getLastCompletedFrame(completed.frame,
+                                          completed.milliseconds))
+            return false;
+        while (!_passes.empty() && _passes.front().first < completed.frame)
+            _passes.pop_front();
+        if (!_passes.empty() && _passes.front().first == completed.frame)
+            completed.passes = _passes.front().second;
+        stats = completed;
+        return true;
+    }
+
+private:
+    /* Pass counts of the frames whose GPU times are still pending */
+    std::deque<std::pair<unsigned int, unsigned int>> _passes;
+};
+}
+}
+#endif
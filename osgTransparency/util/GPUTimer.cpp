@@ -63,6 +63,8 @@ public:
         : _contextID(state->getContextID())
         , _extensions(getDrawExtensions(_contextID))
         , _started(false)
+        , _hasLastFrame(false)
+        , _lastFrame(0)
     {
     }
 
@@ -144,6 +146,7 @@ public:
                moved one (which hasn't been invalidated at all). */
             _available.splice(_available.end(), _pending, q++);
         }
+        _updateCompletedFrames();
         return _pending.empty();
     }
 
@@ -165,6 +168,15 @@ public:
         return true;
     }
 
+    bool getLastCompletedFrame(unsigned int& frame, FrameTimes& times) const
+    {
+        if (!_hasLastFrame)
+            return false;
+        frame = _lastFrame;
+        times = _lastFrameTimes;
+        return true;
+    }
+
     const unsigned int _contextID;
     const DrawExtensions* _extensions;
 
@@ -182,6 +194,32 @@ public:
 
     typedef std::vector<Result> Results;
     Results _completed;
+
+    /* Times of the frames with queries still pending */
+    std::map<unsigned int, FrameTimes> _partialFrames;
+    bool _hasLastFrame;
+    unsigned int _lastFrame;
+    FrameTimes _lastFrameTimes;
+
+    void _updateCompletedFrames()
+    {
+        for (Results::const_iterator i = _completed.begin();
+             i != _completed.end(); ++i)
+        {
+            _partialFrames[i->frame][i->name] += i->milliseconds;
+        }
+
+        unsigned int pendingFrame = 0;
+        const bool pending = pendingQueriesMinimumFrame(pendingFrame);
+        while (!_partialFrames.empty() &&
+               (!pending || _partialFrames.begin()->first < pendingFrame))
+        {
+            _hasLastFrame = true;
+            _lastFrame = _partialFrames.begin()->first;
+            _lastFrameTimes.swap(_partialFrames.begin()->second);
+            _partialFrames.erase(_partialFrames.begin());
+        }
+    }
 };
 
 GPUTimer::GPUTimer(osg::State* state)
@@ -223,5 +261,11 @@ bool GPUTimer::pendingQueriesMinimumFrame(unsigned int& frame) const
 {
     return _impl->pendingQueriesMinimumFrame(frame);
 }
+
+bool GPUTimer::getLastCompletedFrame(unsigned int& frame,
+                                     FrameTimes& times) const
+{
+    return _impl->getLastCompletedFrame(frame, times);
+}
 }
 }
@@ -30,6 +30,7 @@
 #include <osg/Version>
 
 #include <iostream>
+#include <map>
 #include <vector>
 
 namespace bbp
@@ -106,6 +107,19 @@ public:
     */
     bool pendingQueriesMinimumFrame(unsigned int& frame) const;
 
+    typedef std::map<std::string, float> FrameTimes;
+
+    /** Return the times of the last frame whose queries have all been
+        completed by checkQueries.
+
+        The times of the queries with the same name in a frame are added up.
+        A frame is considered complete once there are no pending queries
+        started on it or on any frame before it.
+
+        @return false if no frame has been completed yet.
+    */
+    bool getLastCompletedFrame(unsigned int& frame, FrameTimes& times) const;
+
 private:
     class Impl;
     Impl* _impl;
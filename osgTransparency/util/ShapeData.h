@@ -25,6 +25,13 @@
 
 #include <osg/ShapeDrawable>
 
+#ifdef OSG_GL3_AVAILABLE
+#include "../TextureBuffer.h"
+
+#include <osg/Image>
+#include <osg/StateSet>
+#endif
+
 namespace bbp
 {
 namespace osgTransparency
@@ -39,6 +46,37 @@ struct ShapeData
     osg::ref_ptr<osg::ShapeDrawable> shape;
     GLuint list;
 };
+
+#ifdef OSG_GL3_AVAILABLE
+/**
+   Instance buffer of the bounding boxes drawn by BaseRenderBin::renderBounds
+   in GL3.
+   Each box takes INSTANCE_TEXELS RGBA32F texels: the 4 columns of its
+   model-view-projection matrix followed by its lower and upper corners.
+   The buffer is rewritten every frame and grows as needed. It mustn't be
+   shared between contexts.
+*/
+struct BoundsInstances
+{
+    static const unsigned int INSTANCE_TEXELS = 6;
+
+    /** @param textureUnit The texture unit to which the instance buffer is
+        bound while drawing. */
+    explicit BoundsInstances(const unsigned int textureUnit_)
+        : textureUnit(textureUnit_)
+        , capacity(0)
+    {
+    }
+
+    const unsigned int textureUnit;
+    size_t capacity;
+    osg::ref_ptr<osg::Image> data;
+    osg::ref_ptr<TextureBuffer> buffer;
+    /* Contains the instance buffer, its sampler uniform and the program
+       used to draw the boxes */
+    osg::ref_ptr<osg::StateSet> stateSet;
+};
+#endif
 }
 }
 #endif
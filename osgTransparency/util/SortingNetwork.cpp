@@ -0,0 +1,76 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "SortingNetwork.h"
+
+#include <sstream>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+SortingNetwork createSortingNetwork(const unsigned int size)
+{
+    unsigned int n = 1;
+    while (n < size)
+        n <<= 1;
+
+    SortingNetwork network;
+    for (unsigned int p = 1; p < n; p <<= 1)
+    {
+        for (unsigned int k = p; k >= 1; k >>= 1)
+        {
+            for (unsigned int j = k % p; j + k < n; j += 2 * k)
+            {
+                for (unsigned int i = 0; i < k && i + j + k < n; ++i)
+                {
+                    const unsigned int a = i + j;
+                    const unsigned int b = i + j + k;
+                    /* Only elements inside the same merge block of size
+                       2p are compared. */
+                    if (a / (2 * p) != b / (2 * p))
+                        continue;
+                    if (b < size)
+                        network.push_back(Comparator(a, b));
+                }
+            }
+        }
+    }
+    return network;
+}
+
+std::string createSortingNetworkShader(const SortingNetwork& network,
+                                       const std::string& functionName)
+{
+    std::stringstream code;
+    code << "void " << functionName << "()\n{\n";
+    for (SortingNetwork::const_iterator i = network.begin();
+         i != network.end(); ++i)
+    {
+        code << "    COMPARE_EXCHANGE(" << i->first << ", " << i->second
+             << ");\n";
+    }
+    code << "}\n";
+    return code.str();
+}
+}
+}
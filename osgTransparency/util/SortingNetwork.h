@@ -0,0 +1,59 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef OSGTRANSPARENCY_UTIL_SORTINGNETWORK_H
+#define OSGTRANSPARENCY_UTIL_SORTINGNETWORK_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bbp
+{
+namespace osgTransparency
+{
+/** A compare-exchange operation between two positions of an array.
+    After the operation the smallest element is at first and the largest
+    at second. first is always smaller than second. */
+typedef std::pair<unsigned int, unsigned int> Comparator;
+typedef std::vector<Comparator> SortingNetwork;
+
+/**
+   Returns a Batcher odd-even merge sorting network for arrays of the given
+   size.
+   The network is generated for the next power of two and the comparators
+   that reference positions out of range are dropped. This is equivalent to
+   sorting an array padded with elements larger than any other.
+ */
+SortingNetwork createSortingNetwork(unsigned int size);
+
+/**
+   Returns the GLSL source code of a function that applies a sorting network.
+   The function has no arguments and applies the macro
+   COMPARE_EXCHANGE(i, j) to each comparator of the network in order. The
+   macro must be defined by the shader that includes the code.
+ */
+std::string createSortingNetworkShader(const SortingNetwork& network,
+                                       const std::string& functionName);
+}
+}
+#endif
@@ -24,6 +24,9 @@
 
 #include "constants.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 namespace bbp
 {
 namespace osgTransparency
@@ -55,5 +58,27 @@ const std::string PROJECT_UNPROJECT_SNIPPET =
     "uniform float proj34;\n"
     "float unproject(float x) { return -proj34 / (proj33 + 2.0 * x - 1.0); }\n"
     "float reproject(float x) { return 0.5 * (1.0 - proj33 - proj34 / x); }\n";
+
+/*
+  Run-time constants depending on environmental variables
+*/
+namespace
+{
+/* Returns the value of a positive integer variable, or the default value if
+   the variable is not set or not valid. */
+size_t readVariable(const char* name, const size_t defaultValue)
+{
+    const char* value = ::getenv(name);
+    if (!value)
+        return defaultValue;
+    const long number = strtol(value, 0, 10);
+    return number >= 0 ? size_t(number) : defaultValue;
+}
+}
+
+const size_t CAMERA_CACHE_SIZE =
+    std::max(size_t(1), readVariable("OSGTRANSPARENCY_CAMERA_CACHE_SIZE", 4));
+const size_t CAMERA_CACHE_MEMORY =
+    readVariable("OSGTRANSPARENCY_CAMERA_CACHE_MEMORY", 1024) << 20;
 }
 }
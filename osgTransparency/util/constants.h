@@ -43,8 +43,17 @@ namespace osgTransparency
    Compile time constants
 */
 static const unsigned int SUPERSAMPLING_FACTOR = 3;
+#ifdef OSG_GL3_AVAILABLE
+/* Two slices are peeled per depth buffer and all the depth buffers are
+   written at once, so the actual limit depends on the draw buffers of the
+   context, see multilayer::Canvas::getMaxSlices. */
+static const unsigned int MAX_SLICES = 32;
+#else
 static const unsigned int MAX_SLICES = 8;
+#endif
 static const unsigned int MAX_DEPTH_BUFFERS = MAX_SLICES / 2;
+/* The iterative depth partitioners store at most 8 split points. */
+static const unsigned int MAX_ITERATIVE_PARTITION_SLICES = 8;
 
 /* Some declarations used to enhance readbility */
 static const int OFF_OVERRIDE =
@@ -69,12 +78,23 @@ static const osg::Camera::BufferComponent COLOR_BUFFERS[] = {
     osg::Camera::COLOR_BUFFER0, osg::Camera::COLOR_BUFFER1,
     osg::Camera::COLOR_BUFFER2, osg::Camera::COLOR_BUFFER3,
     osg::Camera::COLOR_BUFFER4, osg::Camera::COLOR_BUFFER5,
-    osg::Camera::COLOR_BUFFER6, osg::Camera::COLOR_BUFFER7};
+    osg::Camera::COLOR_BUFFER6, osg::Camera::COLOR_BUFFER7,
+    osg::Camera::COLOR_BUFFER8, osg::Camera::COLOR_BUFFER9,
+    osg::Camera::COLOR_BUFFER10, osg::Camera::COLOR_BUFFER11,
+    osg::Camera::COLOR_BUFFER12, osg::Camera::COLOR_BUFFER13,
+    osg::Camera::COLOR_BUFFER14, osg::Camera::COLOR_BUFFER15};
 
 static const GLenum GL_BUFFER_NAMES[] = {
     GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
     GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
-    GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7};
+    GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7, GL_COLOR_ATTACHMENT8_EXT,
+    GL_COLOR_ATTACHMENT9_EXT, GL_COLOR_ATTACHMENT10_EXT,
+    GL_COLOR_ATTACHMENT11_EXT, GL_COLOR_ATTACHMENT12_EXT,
+    GL_COLOR_ATTACHMENT13_EXT, GL_COLOR_ATTACHMENT14_EXT,
+    GL_COLOR_ATTACHMENT15_EXT};
+
+static const unsigned int MAX_COLOR_BUFFERS =
+    sizeof(COLOR_BUFFERS) / sizeof(COLOR_BUFFERS[0]);
 
 inline std::string sm(const char *main)
 {
@@ -98,6 +118,13 @@ extern bool ADJUST_QUANTILES_WITH_ALPHA;
 extern bool COMPUTE_MAX_DEPTH_COMPLEXITY;
 extern bool PROFILE_DEPTH_PARTITION;
 extern float OPACITY_THRESHOLD;
+/* Maximum number of cameras whose resources are kept per context,
+   OSGTRANSPARENCY_CAMERA_CACHE_SIZE (4 by default). */
+extern const size_t CAMERA_CACHE_SIZE;
+/* Maximum GPU memory in bytes kept for cached cameras per context,
+   OSGTRANSPARENCY_CAMERA_CACHE_MEMORY in MiB (1024 by default, 0 means
+   no limit). */
+extern const size_t CAMERA_CACHE_MEMORY;
 }
 }
 #endif
@@ -236,12 +236,14 @@ void clearTexture(osg::State& state, osg::FrameBufferObject* fbo,
 
     for (int i = 0; i < texture->getTextureDepth(); i += 8)
     {
-        for (int j = 0; i + j < texture->getTextureDepth() && j < 8; ++j)
+        int j = 0;
+        for (; i + j < texture->getTextureDepth() && j < 8; ++j)
         {
             osg::FrameBufferAttachment buffer(texture, j + i);
-            fbo->setAttachment(COLOR_BUFFERS[j + i], buffer);
+            fbo->setAttachment(COLOR_BUFFERS[j], buffer);
         }
         fbo->apply(state);
+        glDrawBuffers(j, GL_BUFFER_NAMES);
         glClear(GL_COLOR_BUFFER_BIT);
     }
 
@@ -34,6 +34,13 @@
 #include <osgDB/WriteFile>
 #include <osgViewer/Viewer>
 
+#ifdef OSG_GL3_AVAILABLE
+#include <osgTransparency/util/ShapeData.h>
+#include <osgTransparency/util/loaders.h>
+
+#include <osg/Shader>
+#endif
+
 #define BOOST_TEST_MODULE
 #include <boost/test/unit_test.hpp>
 
@@ -137,7 +144,7 @@ public:
         BaseRenderBin::reset();
     }
 
-private:
+protected:
     test::RenderContext &_renderContext;
 
     osg::ref_ptr<osgUtil::StateGraph> _stateGraph;
@@ -149,6 +156,43 @@ private:
     ProgramMap _programs;
 };
 
+#ifdef OSG_GL3_AVAILABLE
+class RenderBinWithBounds : public RenderBinWithSimpleStateGraph
+{
+public:
+    RenderBinWithBounds(test::RenderContext &renderContext)
+        : RenderBinWithSimpleStateGraph(renderContext)
+        , _identity(new osg::RefMatrix)
+        , _instances(0)
+    {
+        _boundsProgram =
+            loadProgram(std::vector<std::string>(1, "bounds.vert"));
+        _boundsProgram->addShader(
+            new osg::Shader(osg::Shader::FRAGMENT,
+                            "#version 420\n"
+                            "out vec4 color;\n"
+                            "void main() { color = vec4(1.0); }\n"));
+    }
+
+    virtual void drawImplementation(osg::RenderInfo &renderInfo,
+                                    osgUtil::RenderLeaf *& /*previous*/)
+    {
+        glClearColor(1, 0, 0, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glViewport(0, 0, _renderContext.width, _renderContext.height);
+
+        /* The boxes are given in clip coordinates */
+        renderBounds(renderInfo, _stateSet, _boundsProgram, _instances,
+                     _identity);
+    }
+
+private:
+    osg::ref_ptr<osg::RefMatrix> _identity;
+    osg::ref_ptr<osg::Program> _boundsProgram;
+    BoundsInstances _instances;
+};
+#endif
+
 #define RC_200x200 test::SizedRenderContext<200, 200>
 
 BOOST_FIXTURE_TEST_SUITE(suite, RC_200x200)
@@ -186,4 +230,26 @@ BOOST_AUTO_TEST_CASE(test_render_state_graph)
     BOOST_CHECK(test::compare("small_triangle.png", 0, 0, width, height));
 }
 
+#ifdef OSG_GL3_AVAILABLE
+BOOST_AUTO_TEST_CASE(test_render_bounds)
+{
+    osg::ref_ptr<RenderBinWithBounds> renderBin(new RenderBinWithBounds(*this));
+
+    /* The bounding box spans [-0.5, 0.5] in all axes */
+    osg::ref_ptr<osg::Drawable> triangle =
+        createTriangle(osg::Vec3(-0.5, -0.5, -0.5), osg::Vec3(0.5, -0.5, 0),
+                       osg::Vec3(0, 0.5, 0.5));
+    /* The boxes are drawn with the program of the render bin */
+    renderBin->addDrawable(triangle, 0);
+
+    const unsigned int stackSize = state->getStateSetStackSize();
+    saveCurrentState();
+    renderBin->draw(*renderInfo, previousLeaf);
+    compareCurrentAndSavedState();
+    BOOST_CHECK_EQUAL(state->getStateSetStackSize(), stackSize);
+
+    BOOST_CHECK(test::compare("bounds.png", 0, 0, width, height));
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,121 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <osgTransparency/util/CameraCache.h>
+
+#include <osg/Camera>
+
+#define BOOST_TEST_MODULE
+#include <boost/test/unit_test.hpp>
+
+using namespace bbp::osgTransparency;
+
+namespace
+{
+struct Resources : public osg::Referenced
+{
+    explicit Resources(const size_t memory_ = 0)
+        : memory(memory_)
+    {
+    }
+    size_t getMemoryUsage() const { return memory; }
+    size_t memory;
+};
+typedef osg::ref_ptr<Resources> ResourcesPtr;
+typedef CameraCache<ResourcesPtr> Cache;
+}
+
+BOOST_AUTO_TEST_CASE(find_and_insert)
+{
+    osg::ref_ptr<osg::Camera> camera1(new osg::Camera());
+    osg::ref_ptr<osg::Camera> camera2(new osg::Camera());
+    Cache cache(4, 0);
+
+    BOOST_CHECK(!cache.find(camera1.get()));
+    BOOST_CHECK(!cache.mostRecent());
+
+    ResourcesPtr resources1(new Resources());
+    ResourcesPtr resources2(new Resources());
+    cache.insert(camera1.get(), resources1);
+    cache.insert(camera2.get(), resources2);
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK_EQUAL(cache.mostRecent(), resources2);
+    BOOST_CHECK_EQUAL(cache.find(camera1.get()), resources1);
+    BOOST_CHECK_EQUAL(cache.mostRecent(), resources1);
+
+    /* Replacing an entry */
+    ResourcesPtr resources3(new Resources());
+    cache.insert(camera1.get(), resources3);
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK_EQUAL(cache.find(camera1.get()), resources3);
+}
+
+BOOST_AUTO_TEST_CASE(entry_limit)
+{
+    osg::ref_ptr<osg::Camera> cameras[3] = {new osg::Camera(),
+                                            new osg::Camera(),
+                                            new osg::Camera()};
+    Cache cache(2, 0);
+    cache.insert(cameras[0].get(), new Resources());
+    cache.insert(cameras[1].get(), new Resources());
+    /* Making the first camera the most recently used */
+    cache.find(cameras[0].get());
+    cache.insert(cameras[2].get(), new Resources());
+
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK(cache.find(cameras[0].get()));
+    BOOST_CHECK(!cache.find(cameras[1].get()));
+    BOOST_CHECK(cache.find(cameras[2].get()));
+}
+
+BOOST_AUTO_TEST_CASE(memory_limit)
+{
+    osg::ref_ptr<osg::Camera> cameras[3] = {new osg::Camera(),
+                                            new osg::Camera(),
+                                            new osg::Camera()};
+    Cache cache(4, 100);
+    ResourcesPtr resources(new Resources(40));
+    cache.insert(cameras[0].get(), resources);
+    cache.insert(cameras[1].get(), new Resources(40));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    cache.insert(cameras[2].get(), new Resources(40));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK(!cache.find(cameras[0].get()));
+
+    /* The most recently used entry is kept even if it's over the limit */
+    resources = cache.find(cameras[1].get());
+    resources->memory = 200;
+    cache.shrink();
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+    BOOST_CHECK_EQUAL(cache.mostRecent(), resources);
+}
+
+BOOST_AUTO_TEST_CASE(deleted_cameras)
+{
+    osg::ref_ptr<osg::Camera> camera(new osg::Camera());
+    Cache cache(4, 0);
+    cache.insert(camera.get(), new Resources());
+    camera = 0;
+    osg::ref_ptr<osg::Camera> other(new osg::Camera());
+    BOOST_CHECK(!cache.find(other.get()));
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+}
@@ -0,0 +1,233 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <osgTransparency/FragmentCompositor.h>
+#include <osgTransparency/FragmentDump.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define BOOST_TEST_MODULE
+#include <boost/test/unit_test.hpp>
+
+using namespace bbp::osgTransparency;
+
+namespace
+{
+uint32_t floatBits(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    return bits;
+}
+
+/* Per pixel arrays of compact records stored as prefix sum arrays */
+struct Capture
+{
+    Capture(const unsigned int width_, const unsigned int height_)
+        : width(width_)
+        , height(height_)
+        , counts(width * height, 0)
+        , heads(width * height, 0)
+    {
+    }
+
+    void add(const unsigned int x, const unsigned int y, const float depth,
+             const uint32_t color)
+    {
+        /* Pixels must be filled in order */
+        const size_t pixel = y * width + x;
+        if (counts[pixel] == 0)
+            heads[pixel] = records.size() / 2;
+        ++counts[pixel];
+        records.push_back(floatBits(depth));
+        records.push_back(color);
+    }
+
+    FragmentDump::Header header() const
+    {
+        FragmentDump::Header header;
+        std::memset(&header, 0, sizeof(header));
+        header.width = width;
+        header.height = height;
+        header.storage = FragmentDump::PREFIX_SUM_ARRAYS;
+        header.recordSize = 2;
+        header.numFragments = records.size() / 2;
+        return header;
+    }
+
+    const unsigned int width;
+    const unsigned int height;
+    std::vector<uint32_t> counts;
+    std::vector<uint32_t> heads;
+    std::vector<uint32_t> records;
+};
+
+/* Straightforward front to back blending of fragments sorted by depth */
+void blend(std::vector<std::pair<float, uint32_t>> fragments, float* color)
+{
+    std::stable_sort(fragments.begin(), fragments.end(),
+                     [](const std::pair<float, uint32_t>& a,
+                        const std::pair<float, uint32_t>& b) {
+                         return a.first < b.first;
+                     });
+    color[0] = color[1] = color[2] = color[3] = 0;
+    for (const auto& fragment : fragments)
+    {
+        const uint32_t c = fragment.second;
+        const float alpha = (c >> 24) / 255.f;
+        const float source[4] = {(c & 0xFF) / 255.f * alpha,
+                                 ((c >> 8) & 0xFF) / 255.f * alpha,
+                                 ((c >> 16) & 0xFF) / 255.f * alpha, alpha};
+        const float transmittance = 1 - color[3];
+        for (int i = 0; i != 4; ++i)
+            color[i] += source[i] * transmittance;
+    }
+}
+
+void checkPixel(const osg::Image& image, const unsigned int x,
+                const unsigned int y, const float* color)
+{
+    const unsigned char* pixel = image.data(x, y);
+    for (int i = 0; i != 4; ++i)
+        BOOST_CHECK_SMALL(pixel[i] / 255.f - color[i], 0.5f / 255 + 1e-5f);
+}
+}
+
+BOOST_AUTO_TEST_CASE(sorted_blending)
+{
+    Capture capture(2, 1);
+    /* Opaque red behind half transparent green, in back to front order */
+    capture.add(0, 0, 0.5, 0xFF0000FF);
+    capture.add(0, 0, 0.25, 0x8000FF00);
+
+    FragmentCompositor compositor(1);
+    const FragmentDump dump(capture.header(), capture.counts.data(),
+                            capture.heads.data(), capture.records.data(), 0);
+    const osg::ref_ptr<osg::Image> image =
+        compositor.composite(dump, osg::Vec4(0, 0, 1, 1));
+
+    BOOST_CHECK_EQUAL(image->s(), 2);
+    BOOST_CHECK_EQUAL(image->t(), 1);
+    const unsigned char* pixel = image->data(0, 0);
+    BOOST_CHECK_EQUAL(int(pixel[0]), 127);
+    BOOST_CHECK_EQUAL(int(pixel[1]), 128);
+    BOOST_CHECK_EQUAL(int(pixel[2]), 0);
+    BOOST_CHECK_EQUAL(int(pixel[3]), 255);
+    /* The empty pixel gets the background */
+    pixel = image->data(1, 0);
+    BOOST_CHECK_EQUAL(int(pixel[0]), 0);
+    BOOST_CHECK_EQUAL(int(pixel[1]), 0);
+    BOOST_CHECK_EQUAL(int(pixel[2]), 255);
+    BOOST_CHECK_EQUAL(int(pixel[3]), 255);
+
+    const FragmentCompositor::Statistics& stats = compositor.getStatistics();
+    BOOST_CHECK_EQUAL(stats.pixels, 2);
+    BOOST_CHECK_EQUAL(stats.fragments, 2);
+    BOOST_CHECK_EQUAL(stats.maxListLength, 2);
+    BOOST_CHECK_EQUAL(stats.threads, 1);
+}
+
+BOOST_AUTO_TEST_CASE(multithreaded)
+{
+    /* Random lists, some of them longer than the insertion sort limit */
+    const unsigned int width = 37;
+    const unsigned int height = 23;
+    Capture capture(width, height);
+    std::vector<std::vector<std::pair<float, uint32_t>>> fragments(width *
+                                                                    height);
+    std::srand(0);
+    size_t total = 0;
+    for (unsigned int y = 0; y != height; ++y)
+        for (unsigned int x = 0; x != width; ++x)
+        {
+            const unsigned int count = std::rand() % (x % 7 == 0 ? 100 : 10);
+            for (unsigned int i = 0; i != count; ++i)
+            {
+                const float depth = (std::rand() % 1000) / 1000.f;
+                const uint32_t color = std::rand() << 16 ^ std::rand();
+                capture.add(x, y, depth, color);
+                fragments[y * width + x].push_back(
+                    std::make_pair(depth, color));
+            }
+            total += count;
+        }
+
+    const FragmentDump dump(capture.header(), capture.counts.data(),
+                            capture.heads.data(), capture.records.data(), 0);
+    FragmentCompositor serial(1);
+    FragmentCompositor parallel(4);
+    const osg::ref_ptr<osg::Image> reference = serial.composite(dump);
+    const osg::ref_ptr<osg::Image> image = parallel.composite(dump);
+
+    BOOST_CHECK_EQUAL(parallel.getStatistics().threads, 4);
+    BOOST_CHECK_EQUAL(parallel.getStatistics().fragments, total);
+    BOOST_CHECK_EQUAL(serial.getStatistics().fragments, total);
+    BOOST_CHECK_EQUAL(std::memcmp(reference->data(), image->data(),
+                                  image->getTotalSizeInBytes()),
+                      0);
+
+    for (unsigned int y = 0; y != height; ++y)
+        for (unsigned int x = 0; x != width; ++x)
+        {
+            float color[4];
+            blend(fragments[y * width + x], color);
+            checkPixel(*image, x, y, color);
+        }
+}
+
+BOOST_AUTO_TEST_CASE(invalid_header)
+{
+    Capture capture(1, 1);
+    FragmentDump::Header header = capture.header();
+    header.recordSize = 4;
+    BOOST_CHECK_THROW(FragmentDump(header, capture.counts.data(),
+                                   capture.heads.data(),
+                                   capture.records.data(), 0),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(corrupted_lists)
+{
+    /* A linked list of 2 fragments whose records point 0 -> 1 -> 0 */
+    const uint32_t records[] = {1, floatBits(0.5), 0xFF0000FF,
+                                0, floatBits(0.25), 0x8000FF00};
+    const uint32_t counts[] = {2};
+    const uint32_t heads[] = {0};
+    FragmentDump::Header header = Capture(1, 1).header();
+    header.storage = FragmentDump::LINKED_LISTS;
+    header.recordSize = 3;
+    header.numFragments = 2;
+    const FragmentDump dump(header, counts, heads, records, 0);
+
+    FragmentCompositor compositor(2);
+    const osg::ref_ptr<osg::Image> image = compositor.composite(dump);
+    BOOST_CHECK_EQUAL(compositor.getStatistics().fragments, 2);
+    BOOST_CHECK_EQUAL(compositor.getStatistics().maxListLength, 2);
+
+    float color[4];
+    blend({std::make_pair(0.5f, 0xFF0000FFu),
+           std::make_pair(0.25f, 0x8000FF00u)},
+          color);
+    checkPixel(*image, 0, 0, color);
+}
@@ -0,0 +1,231 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <osgTransparency/FragmentDump.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#define BOOST_TEST_MODULE
+#include <boost/test/unit_test.hpp>
+
+using namespace bbp::osgTransparency;
+
+namespace
+{
+/* 2x1 pixels, the first with fragments of depth 0.5 and 0.25 (in that
+   storage order), the second empty. */
+const float DEPTHS[] = {0.5f, 0.25f};
+const uint32_t COLORS[] = {0xFF0000FF, 0x8000FF00};
+
+uint32_t floatBits(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(float));
+    return bits;
+}
+
+struct TempFile
+{
+    TempFile()
+        : path((boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path())
+                   .string())
+    {
+    }
+    ~TempFile() { boost::filesystem::remove(path); }
+    const std::string path;
+};
+
+FragmentDump::Header createHeader(const FragmentDump::Storage storage,
+                                  const uint32_t recordSize,
+                                  const uint64_t numFragments)
+{
+    FragmentDump::Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.width = 2;
+    header.height = 1;
+    header.storage = storage;
+    header.recordSize = recordSize;
+    header.numFragments = numFragments;
+    header.frameNumber = 7;
+    return header;
+}
+
+void checkFragments(const FragmentDump& dump)
+{
+    std::vector<FragmentDump::Fragment> fragments;
+    for (const auto& fragment : dump.getFragments(0, 0))
+        fragments.push_back(fragment);
+    BOOST_REQUIRE_EQUAL(fragments.size(), 2);
+    for (size_t i = 0; i != 2; ++i)
+    {
+        BOOST_CHECK_EQUAL(fragments[i].depth, DEPTHS[i]);
+        BOOST_CHECK_EQUAL(fragments[i].color, COLORS[i]);
+    }
+
+    const FragmentDump::Fragments empty = dump.getFragments(1, 0);
+    BOOST_CHECK(empty.begin() == empty.end());
+    BOOST_CHECK_EQUAL(dump.getCount(0, 0), 2);
+    BOOST_CHECK_EQUAL(dump.getHeader().frameNumber, 7);
+}
+}
+
+BOOST_AUTO_TEST_CASE(linked_lists)
+{
+    /* The second record is the head of the list */
+    const uint32_t records[] = {0xFFFFFFFF, floatBits(DEPTHS[1]), COLORS[1],
+                                0,          floatBits(DEPTHS[0]), COLORS[0]};
+    const uint32_t counts[] = {2, 0};
+    const uint32_t heads[] = {1, 0xFFFFFFFF};
+    TempFile file;
+    FragmentDump::write(file.path,
+                        createHeader(FragmentDump::LINKED_LISTS, 3, 2),
+                        counts, heads, records, 0);
+    const FragmentDump dump(file.path);
+    BOOST_CHECK_EQUAL(dump.getStorage(), FragmentDump::LINKED_LISTS);
+    checkFragments(dump);
+}
+
+BOOST_AUTO_TEST_CASE(prefix_sum_arrays)
+{
+    const uint32_t records[] = {floatBits(DEPTHS[0]), COLORS[0],
+                                floatBits(DEPTHS[1]), COLORS[1]};
+    const uint32_t counts[] = {2, 0};
+    const uint32_t heads[] = {0, 2};
+    TempFile file;
+    FragmentDump::write(file.path,
+                        createHeader(FragmentDump::PREFIX_SUM_ARRAYS, 2, 2),
+                        counts, heads, records, 0);
+    checkFragments(FragmentDump(file.path));
+}
+
+BOOST_AUTO_TEST_CASE(paged_lists)
+{
+    /* Pages of 1 fragment, page 1 is the last one allocated and links to
+       page 0. */
+    const uint32_t records[] = {floatBits(DEPTHS[1]), COLORS[1],
+                                floatBits(DEPTHS[0]), COLORS[0]};
+    const uint32_t pageLinks[] = {0x0FFFFFFF, 0};
+    const uint32_t counts[] = {2, 0};
+    const uint32_t heads[] = {1 << 4 | 1, 0xFFFFFFF1};
+    FragmentDump::Header header =
+        createHeader(FragmentDump::PAGED_LISTS, 2, 2);
+    header.fragmentsPerPage = 1;
+    header.pageFillBits = 4;
+    header.numPages = 2;
+    TempFile file;
+    FragmentDump::write(file.path, header, counts, heads, records, pageLinks);
+    const FragmentDump dump(file.path);
+    BOOST_REQUIRE(dump.getPageLinks());
+    checkFragments(dump);
+}
+
+BOOST_AUTO_TEST_CASE(k_buffer)
+{
+    const uint32_t records[] = {floatBits(DEPTHS[0]), COLORS[0],
+                                floatBits(DEPTHS[1]), COLORS[1],
+                                0xFFFFFFFF,           0,
+                                0xFFFFFFFF,           0,
+                                0xFFFFFFFF,           0,
+                                0xFFFFFFFF,           0};
+    const uint32_t counts[] = {2, 0};
+    const uint32_t heads[] = {0, 0};
+    FragmentDump::Header header = createHeader(FragmentDump::K_BUFFER, 2, 6);
+    header.kBufferSize = 3;
+    TempFile file;
+    FragmentDump::write(file.path, header, counts, heads, records, 0);
+    checkFragments(FragmentDump(file.path));
+}
+
+BOOST_AUTO_TEST_CASE(aligned_sections)
+{
+    const uint32_t records[] = {floatBits(DEPTHS[0]), COLORS[0]};
+    const uint32_t counts[] = {1, 0};
+    const uint32_t heads[] = {0, 1};
+    TempFile file;
+    FragmentDump::write(file.path,
+                        createHeader(FragmentDump::PREFIX_SUM_ARRAYS, 2, 1),
+                        counts, heads, records, 0);
+    const FragmentDump dump(file.path);
+    const FragmentDump::Header& header = dump.getHeader();
+    BOOST_CHECK_EQUAL(header.version, FragmentDump::VERSION);
+    BOOST_CHECK_EQUAL(header.counts.offset % FragmentDump::SECTION_ALIGNMENT,
+                      0);
+    BOOST_CHECK_EQUAL(header.heads.offset % FragmentDump::SECTION_ALIGNMENT,
+                      0);
+    BOOST_CHECK_EQUAL(
+        header.fragments.offset % FragmentDump::SECTION_ALIGNMENT, 0);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_files)
+{
+    BOOST_CHECK_THROW(FragmentDump("/non/existent/file"), std::runtime_error);
+
+    TempFile file;
+    {
+        std::ofstream out(file.path.c_str(), std::ios::binary);
+        const std::vector<char> garbage(sizeof(FragmentDump::Header), 'x');
+        out.write(garbage.data(), garbage.size());
+    }
+    BOOST_CHECK_THROW(FragmentDump(file.path), std::runtime_error);
+
+    /* Truncating a valid file */
+    const uint32_t records[] = {floatBits(DEPTHS[0]), COLORS[0]};
+    const uint32_t counts[] = {1, 0};
+    const uint32_t heads[] = {0, 1};
+    FragmentDump::write(file.path,
+                        createHeader(FragmentDump::PREFIX_SUM_ARRAYS, 2, 1),
+                        counts, heads, records, 0);
+    boost::filesystem::resize_file(file.path,
+                                   boost::filesystem::file_size(file.path) -
+                                       1);
+    BOOST_CHECK_THROW(FragmentDump(file.path), std::runtime_error);
+
+    /* Corrupted lists whose records point 0 -> 1 -> 0 are cut at the pixel
+       count. */
+    const uint32_t cycle[] = {1, floatBits(DEPTHS[0]), COLORS[0],
+                              0, floatBits(DEPTHS[1]), COLORS[1]};
+    const uint32_t cycleCounts[] = {2, 0};
+    const uint32_t cycleHeads[] = {0, 0xFFFFFFFF};
+    FragmentDump::write(file.path,
+                        createHeader(FragmentDump::LINKED_LISTS, 3, 2),
+                        cycleCounts, cycleHeads, cycle, 0);
+    checkFragments(FragmentDump(file.path));
+
+    /* Same with pages of 1 fragment linked to each other */
+    const uint32_t pageRecords[] = {floatBits(DEPTHS[1]), COLORS[1],
+                                    floatBits(DEPTHS[0]), COLORS[0]};
+    const uint32_t pageCycle[] = {1, 0};
+    const uint32_t pageHeads[] = {1 << 4 | 1, 0xFFFFFFF1};
+    FragmentDump::Header header =
+        createHeader(FragmentDump::PAGED_LISTS, 2, 2);
+    header.fragmentsPerPage = 1;
+    header.pageFillBits = 4;
+    header.numPages = 2;
+    FragmentDump::write(file.path, header, cycleCounts, pageHeads,
+                        pageRecords, pageCycle);
+    checkFragments(FragmentDump(file.path));
+}
@@ -0,0 +1,172 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "RenderContext.h"
+
+#include <osgTransparency/FragmentCompositor.h>
+#include <osgTransparency/FragmentListOITBin.h>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/GraphicsContext>
+#include <osgViewer/Viewer>
+
+#include <algorithm>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE
+#include <boost/test/unit_test.hpp>
+
+using namespace bbp::osgTransparency;
+
+namespace
+{
+typedef FragmentListOITBin::Parameters Parameters;
+
+/* Three overlapping translucent quads at different depths */
+osg::ref_ptr<osg::Node> createScene()
+{
+    osg::ref_ptr<osg::Geometry> geometry(new osg::Geometry());
+    osg::Vec3Array* vertices = new osg::Vec3Array();
+    osg::Vec3Array* normals = new osg::Vec3Array();
+    osg::Vec4Array* colors = new osg::Vec4Array();
+    const osg::Vec4 quadColors[] = {osg::Vec4(1, 0, 0, 0.5),
+                                    osg::Vec4(0, 1, 0, 0.5),
+                                    osg::Vec4(0, 0, 1, 0.5)};
+    for (int i = 0; i != 3; ++i)
+    {
+        /* Drawn from front to back to make sure they get sorted */
+        const float offset = 0.25f * (i - 1);
+        const float depth = -0.25f * (i - 1);
+        vertices->push_back(osg::Vec3(-0.5 + offset, -0.5 + offset, depth));
+        vertices->push_back(osg::Vec3(0.5 + offset, -0.5 + offset, depth));
+        vertices->push_back(osg::Vec3(0.5 + offset, 0.5 + offset, depth));
+        vertices->push_back(osg::Vec3(-0.5 + offset, 0.5 + offset, depth));
+        for (int j = 0; j != 4; ++j)
+        {
+            normals->push_back(osg::Vec3(0, 0, 1));
+            colors->push_back(quadColors[i]);
+        }
+    }
+    geometry->setVertexArray(vertices);
+    geometry->setNormalArray(normals);
+    geometry->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+    geometry->setColorArray(colors);
+    geometry->setColorBinding(osg::Geometry::BIND_PER_VERTEX);
+    geometry->addPrimitiveSet(new osg::DrawArrays(GL_QUADS, 0, 12));
+    geometry->setUseDisplayList(false);
+    geometry->setUseVertexBufferObjects(true);
+
+    osg::ref_ptr<osg::Geode> geode(new osg::Geode());
+    geode->addDrawable(geometry);
+    return geode;
+}
+
+/* Largest difference between two channels of two RGBA8 images */
+int maxDifference(const osg::Image& image1, const osg::Image& image2)
+{
+    BOOST_REQUIRE_EQUAL(image1.s(), image2.s());
+    BOOST_REQUIRE_EQUAL(image1.t(), image2.t());
+    int difference = 0;
+    for (int j = 0; j < image1.t(); ++j)
+    {
+        const unsigned char* row1 = image1.data(0, j);
+        const unsigned char* row2 = image2.data(0, j);
+        for (int i = 0; i < image1.s() * 4; ++i)
+            difference = std::max(difference, std::abs(row1[i] - row2[i]));
+    }
+    return difference;
+}
+
+/* Renders the scene with the given storage and compares the framebuffer
+   with the fragments captured in the same frame composited on the CPU. */
+void checkAgainstCompositor(test::RenderContext& context,
+                            const Parameters::FragmentStorage storage)
+{
+    FragmentCompositor compositor(1);
+    osg::ref_ptr<osg::Image> composited;
+    Parameters parameters;
+    parameters.setFragmentStorage(storage);
+    parameters.setCaptureCallback(context.state->getContextID(),
+                                  [&](const FragmentData& data) {
+                                      composited =
+                                          compositeFragments(data, compositor);
+                                      return true;
+                                  });
+    osg::ref_ptr<FragmentListOITBin> renderBin(
+        new FragmentListOITBin(parameters));
+    osgUtil::RenderBin::addRenderBinPrototype("alphaBlended", renderBin);
+
+    osg::ref_ptr<osg::Node> scene = createScene();
+    osg::StateSet* stateSet = scene->getOrCreateStateSet();
+    stateSet->setRenderBinDetails(1, "alphaBlended");
+    renderBin->addExtraShadersForState(stateSet);
+
+    osgViewer::Viewer viewer;
+    viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+    osg::Camera* camera = viewer.getCamera();
+    camera->setGraphicsContext(context.context);
+    camera->setViewport(0, 0, context.width, context.height);
+    camera->setClearColor(osg::Vec4(0, 0, 0, 0));
+    camera->setComputeNearFarMode(osg::CullSettings::DO_NOT_COMPUTE_NEAR_FAR);
+    camera->setProjectionMatrixAsOrtho(-1, 1, -1, 1, -1, 1);
+    camera->setViewMatrix(osg::Matrix::identity());
+    viewer.setSceneData(scene);
+    viewer.frame();
+
+    context.context->makeCurrent();
+    osg::ref_ptr<osg::Image> image(new osg::Image());
+    image->readPixels(0, 0, context.width, context.height, GL_RGBA,
+                      GL_UNSIGNED_BYTE);
+    osgUtil::RenderBin::removeRenderBinPrototype(renderBin);
+
+    BOOST_REQUIRE(composited);
+    /* The GPU and the CPU may round the blended colors differently */
+    BOOST_CHECK_LE(maxDifference(*image, *composited), 2);
+}
+}
+
+#define RC_200x200 test::SizedRenderContext<200, 200>
+
+BOOST_FIXTURE_TEST_SUITE(suite, RC_200x200)
+
+BOOST_AUTO_TEST_CASE(linked_lists)
+{
+    checkAgainstCompositor(*this, Parameters::LINKED_LISTS);
+}
+
+BOOST_AUTO_TEST_CASE(prefix_sum_arrays)
+{
+    checkAgainstCompositor(*this, Parameters::PREFIX_SUM_ARRAYS);
+}
+
+BOOST_AUTO_TEST_CASE(paged_lists)
+{
+    checkAgainstCompositor(*this, Parameters::PAGED_LISTS);
+}
+
+BOOST_AUTO_TEST_CASE(k_buffer)
+{
+    checkAgainstCompositor(*this, Parameters::K_BUFFER);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
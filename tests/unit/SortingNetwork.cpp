@@ -0,0 +1,117 @@
+/* Copyright (c) 2006-2018, École Polytechnique Fédérale de Lausanne (EPFL) /
+ *                           Blue Brain Project and
+ *                          Universidad Politécnica de Madrid (UPM)
+ *                          Juan Hernando <juan.hernando@epfl.ch>
+ *
+ * This file is part of osgTransparency
+ * <https://github.com/BlueBrain/osgTransparency>
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License version 3.0 as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <osgTransparency/util/SortingNetwork.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#define BOOST_TEST_MODULE
+#include <boost/test/unit_test.hpp>
+
+using namespace bbp::osgTransparency;
+
+namespace
+{
+template <typename T>
+void apply(const SortingNetwork& network, std::vector<T>& values)
+{
+    for (SortingNetwork::const_iterator i = network.begin();
+         i != network.end(); ++i)
+    {
+        if (values[i->second] < values[i->first])
+            std::swap(values[i->first], values[i->second]);
+    }
+}
+}
+
+BOOST_AUTO_TEST_CASE(comparators_in_range)
+{
+    for (unsigned int size = 1; size <= 64; ++size)
+    {
+        const SortingNetwork network = createSortingNetwork(size);
+        for (SortingNetwork::const_iterator i = network.begin();
+             i != network.end(); ++i)
+        {
+            BOOST_CHECK_LT(i->first, i->second);
+            BOOST_CHECK_LT(i->second, size);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(power_of_two_comparator_count)
+{
+    /* Batcher's odd-even merge sort uses (k^2 - k + 4) * 2^(k - 2) - 1
+       comparators for 2^k elements. */
+    for (unsigned int k = 2; k <= 8; ++k)
+    {
+        const size_t expected = (k * k - k + 4) * (1u << (k - 2)) - 1;
+        BOOST_CHECK_EQUAL(createSortingNetwork(1u << k).size(), expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sorts_all_binary_sequences)
+{
+    /* By the 0-1 principle, a network that sorts all sequences of 0s and 1s
+       sorts any sequence. */
+    for (unsigned int size = 1; size <= 16; ++size)
+    {
+        const SortingNetwork network = createSortingNetwork(size);
+        for (unsigned int bits = 0; bits < (1u << size); ++bits)
+        {
+            std::vector<int> values(size);
+            for (unsigned int i = 0; i != size; ++i)
+                values[i] = (bits >> i) & 1;
+            apply(network, values);
+            BOOST_REQUIRE(std::is_sorted(values.begin(), values.end()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sorts_random_sequences)
+{
+    srand(0);
+    for (unsigned int size = 17; size <= 128; size += 37)
+    {
+        const SortingNetwork network = createSortingNetwork(size);
+        for (unsigned int n = 0; n != 100; ++n)
+        {
+            std::vector<float> values(size);
+            for (unsigned int i = 0; i != size; ++i)
+                values[i] = rand() / float(RAND_MAX);
+            apply(network, values);
+            BOOST_REQUIRE(std::is_sorted(values.begin(), values.end()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(shader_code)
+{
+    SortingNetwork network;
+    network.push_back(Comparator(0, 1));
+    network.push_back(Comparator(2, 3));
+    BOOST_CHECK_EQUAL(createSortingNetworkShader(network, "sort"),
+                      "void sort()\n{\n"
+                      "    COMPARE_EXCHANGE(0, 1);\n"
+                      "    COMPARE_EXCHANGE(2, 3);\n"
+                      "}\n");
+}